@@ -25,7 +25,6 @@ int main() {
 	CelWin *a = cel_create_window("Test Window Creation 1", 600, 400);
 	using namespace std;
 	vector<CelRect *> rects(100);
-	vector<float> rotation_speed(100);
 	for (int i = 0; i < 100; i++) {
 		float x = (rand() % 1000) / 500.0 - 1;
 		float y = (rand() % 1000) / 500.0 - 1;
@@ -33,13 +32,11 @@ int main() {
 		float g = (rand() % 1000) / 1000.0;
 		float b = (rand() % 1000) / 1000.0;
 		rects[i] = cel_create_rectangle(a, x, y, 0.5, 0.5, {{r, g, b, 1}, 0});
-		rotation_speed[i] = (rand() % 1000) / 1000.0;
-	}
-	while (!glfwWindowShouldClose(a->window)) {
-		for (int i = 0; i < 100; i++) {
-			rects[i]->rotation += rotation_speed[i] * 0.01;
-		}
-		this_thread::sleep_for(chrono::milliseconds(14));
+		// rotates with up to 0.7 radians per second for an hour, evaluated
+		// on the GPU
+		float rotation_speed = (rand() % 1000) / 1000.0 * 0.7;
+		cel_animate_rotation(rects[i], rotation_speed * 3600, 0, 3600,
+							 CEL_EASE_LINEAR);
 	}
 	cel_wait_for_window(a);
 }
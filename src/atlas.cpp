@@ -0,0 +1,363 @@
+#include "atlas.hpp"
+#include <algorithm>
+#include "src/logger.hpp"
+#include "src/memory.hpp"
+#include "src/ubo.hpp"
+// empty texels right and below of every image, so filtering never blends
+// neighbouring images
+#define ATLAS_PADDING 1
+TextureAtlas::TextureAtlas(GLenum internal_format, GLenum format,
+						   int page_size, unsigned max_pages)
+	: internal_format(internal_format),
+	  format(format),
+	  page_size(page_size) {
+	GLint max_layers;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+	this->max_pages = std::min<unsigned>(max_pages, max_layers);
+	switch (format) {
+		case GL_RED:
+			texel_size = 1;
+			break;
+		case GL_RG:
+			texel_size = 2;
+			break;
+		case GL_RGB:
+			texel_size = 3;
+			break;
+		default:
+			texel_size = 4;
+	}
+	pages.resize(1);
+	reset(pages[0], page_size);
+	texture = allocate(1);
+}
+void TextureAtlas::reset(Page &page, int page_size) {
+	page.skyline = {{0, 0, page_size}};
+	page.used = 0;
+}
+bool TextureAtlas::find_position(const Page &page, int width, int height,
+								 int &x, int &y, size_t &index) const {
+	const std::vector<Segment> &skyline = page.skyline;
+	int best_top = page_size + 1, best_width = 0;
+	for (size_t i = 0; i < skyline.size(); i++) {
+		if (skyline[i].x + width > page_size)
+			break;
+		// the image rests on the highest segment below it
+		int top = skyline[i].y, left = width;
+		for (size_t j = i; left > 0; j++) {
+			top = std::max(top, skyline[j].y);
+			left -= skyline[j].width;
+		}
+		if (top + height > page_size)
+			continue;
+		// lowest top edge first, then the tightest segment
+		if (top + height < best_top ||
+			(top + height == best_top && skyline[i].width < best_width)) {
+			best_top = top + height;
+			best_width = skyline[i].width;
+			x = skyline[i].x;
+			y = top;
+			index = i;
+		}
+	}
+	return best_top <= page_size;
+}
+void TextureAtlas::place(Page &page, size_t index, int x, int y, int width,
+						 int height) {
+	std::vector<Segment> &skyline = page.skyline;
+	skyline.insert(skyline.begin() + index, {x, y + height, width});
+	// the new segment shadows the ones it covers
+	for (size_t i = index + 1; i < skyline.size();) {
+		const int covered = x + width - skyline[i].x;
+		if (covered <= 0)
+			break;
+		if (skyline[i].width <= covered) {
+			skyline.erase(skyline.begin() + i);
+			continue;
+		}
+		skyline[i].x += covered;
+		skyline[i].width -= covered;
+		break;
+	}
+	for (size_t i = 0; i + 1 < skyline.size();) {
+		if (skyline[i].y == skyline[i + 1].y) {
+			skyline[i].width += skyline[i + 1].width;
+			skyline.erase(skyline.begin() + i + 1);
+		} else
+			i++;
+	}
+	page.used += (size_t)width * height;
+}
+bool TextureAtlas::pack(std::vector<Page> &pages, int width, int height,
+						uint32_t &layer, int &x, int &y) {
+	for (uint32_t l = 0; l < pages.size(); l++) {
+		size_t index;
+		if (find_position(pages[l], width, height, x, y, index)) {
+			place(pages[l], index, x, y, width, height);
+			layer = l;
+			return true;
+		}
+	}
+	return false;
+}
+GLuint TextureAtlas::allocate(unsigned layers) {
+	GLuint res;
+	glGenTextures(1, &res);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, res);
+	// no mipmaps, they would blend neighbouring images
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internal_format, page_size,
+				 page_size, layers, 0, format, GL_UNSIGNED_BYTE, nullptr);
+	track_memory(CEL_MEMORY_TEXTURES, res,
+				 (size_t)page_size * page_size * layers * texel_size);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	return res;
+}
+void TextureAtlas::copy(GLuint src, GLuint dst, int sx, int sy,
+						uint32_t slayer, int dx, int dy, uint32_t dlayer,
+						int width, int height) {
+	if (GLEW_ARB_copy_image) {
+		glCopyImageSubData(src, GL_TEXTURE_2D_ARRAY, 0, sx, sy, slayer, dst,
+						   GL_TEXTURE_2D_ARRAY, 0, dx, dy, dlayer, width,
+						   height, 1);
+		return;
+	}
+	// without ARB_copy_image the layers are blitted through framebuffers
+	if (!copy_fbos[0])
+		glGenFramebuffers(2, copy_fbos);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, copy_fbos[0]);
+	glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, src,
+							  0, slayer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, copy_fbos[1]);
+	glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, dst,
+							  0, dlayer);
+	glBlitFramebuffer(sx, sy, sx + width, sy + height, dx, dy, dx + width,
+					  dy + height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+bool TextureAtlas::grow() {
+	if (pages.size() >= max_pages)
+		return false;
+	// a texture array cannot be resized, the pages are copied into a larger
+	// one
+	const unsigned layers = pages.size() + 1;
+	GLuint res = allocate(layers);
+	for (uint32_t l = 0; l < pages.size(); l++)
+		copy(texture, res, 0, 0, l, 0, 0, l, page_size, page_size);
+	glDeleteTextures(1, &texture);
+	untrack_memory(CEL_MEMORY_TEXTURES, texture);
+	texture = res;
+	pages.emplace_back();
+	reset(pages.back(), page_size);
+	generation++;
+	return true;
+}
+TextureAtlas::handle TextureAtlas::insert(int width, int height,
+										  const void *pixels) {
+	const int w = width + ATLAS_PADDING, h = height + ATLAS_PADDING;
+	if (width <= 0 || height <= 0 || w > page_size || h > page_size)
+		return invalid;
+	uint32_t layer;
+	int x, y;
+	bool packed = pack(pages, w, h, layer, x, y);
+	while (!packed && grow())
+		packed = pack(pages, w, h, layer, x, y);
+	// the freed space is only usable once the images are repacked, so images
+	// are evicted until there is enough of it and the atlas is compacted once
+	bool compacted = false, evicted = false;
+	while (!packed) {
+		if (!compacted && free_area() >= (size_t)w * h) {
+			compacted = true;
+			evicted = false;
+			packed = defragment() && pack(pages, w, h, layer, x, y);
+		} else if (evict_lru(true)) {
+			// images used in this frame are kept
+			evicted = true;
+			packed = pack(pages, w, h, layer, x, y);
+		} else if (compacted && evicted && defragment() &&
+				   pack(pages, w, h, layer, x, y)) {
+			// the space evicted after the compaction was still fragmented
+			packed = true;
+		} else {
+			return invalid;
+		}
+	}
+	handle res;
+	if (free_handles.empty()) {
+		res = entries.size();
+		entries.emplace_back();
+	} else {
+		res = free_handles.back();
+		free_handles.pop_back();
+	}
+	entries[res] = {x, y, width, height, layer, frame, true};
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x, y, layer, width, height, 1,
+					format, GL_UNSIGNED_BYTE, pixels);
+	clear_border(x, y, layer, width, height);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	return res;
+}
+void TextureAtlas::clear_border(int x, int y, uint32_t layer, int width,
+								int height) {
+	// the texels around an image are padding or unused space, which is never
+	// covered by another image
+	const int x0 = std::max(x - 1, 0), y0 = std::max(y - 1, 0);
+	const int x1 = x + width, y1 = y + height;
+	const std::vector<unsigned char> zeros(
+		std::max(x1 - x0 + 1, y1 - y0 + 1) * texel_size, 0);
+	if (x > 0)
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x0, y0, layer, 1, y1 - y0 + 1, 1,
+						format, GL_UNSIGNED_BYTE, zeros.data());
+	if (y > 0)
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x0, y0, layer, x1 - x0 + 1, 1, 1,
+						format, GL_UNSIGNED_BYTE, zeros.data());
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x1, y0, layer, 1, y1 - y0 + 1, 1,
+					format, GL_UNSIGNED_BYTE, zeros.data());
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x0, y1, layer, x1 - x0 + 1, 1, 1,
+					format, GL_UNSIGNED_BYTE, zeros.data());
+}
+void TextureAtlas::remove(handle h) {
+	Entry &entry = entries[h];
+	if (!entry.live)
+		return;
+	entry.live = false;
+	Page &page = pages[entry.layer];
+	page.used -= (size_t)(entry.width + ATLAS_PADDING) *
+				 (entry.height + ATLAS_PADDING);
+	// an empty page is packed from scratch again
+	if (page.used == 0)
+		reset(page, page_size);
+	free_handles.push_back(h);
+}
+bool TextureAtlas::evict_lru(bool keep_current) {
+	handle victim = invalid;
+	for (handle e = 0; e < entries.size(); e++)
+		if (entries[e].live && (!keep_current || entries[e].last_used < frame) &&
+			(victim == invalid ||
+			 entries[e].last_used < entries[victim].last_used))
+			victim = e;
+	if (victim == invalid)
+		return false;
+	remove(victim);
+	if (on_evict)
+		on_evict(victim);
+	return true;
+}
+void TextureAtlas::set_max_pages(unsigned count) {
+	GLint max_layers;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+	max_pages = std::max(1u, std::min<unsigned>(count, max_layers));
+	// images are evicted until the remaining ones could fit into the allowed
+	// pages, then the atlas is compacted once
+	const size_t capacity = (size_t)max_pages * page_size * page_size;
+	while (pages.size() > max_pages) {
+		while (used_area() > capacity && evict_lru(false)) {
+		}
+		if (defragment() && pages.size() <= max_pages)
+			break;
+		if (!evict_lru(false))
+			break;
+	}
+}
+size_t TextureAtlas::used_area() const {
+	size_t used = 0;
+	for (const Page &page : pages)
+		used += page.used;
+	return used;
+}
+bool TextureAtlas::defragment() {
+	std::vector<handle> live;
+	for (handle e = 0; e < entries.size(); e++)
+		if (entries[e].live)
+			live.push_back(e);
+	// packing the tallest images first leaves the flattest skylines
+	std::sort(live.begin(), live.end(), [this](handle a, handle b) {
+		return entries[a].height > entries[b].height;
+	});
+	std::vector<Page> packed(pages.size());
+	for (Page &page : packed)
+		reset(page, page_size);
+	std::vector<Entry> moved = entries;
+	for (handle e : live) {
+		Entry &entry = moved[e];
+		if (!pack(packed, entry.width + ATLAS_PADDING,
+				  entry.height + ATLAS_PADDING, entry.layer, entry.x, entry.y))
+			return false;
+	}
+	// trailing empty pages are dropped
+	while (packed.size() > 1 && packed.back().used == 0)
+		packed.pop_back();
+	GLuint res = allocate(packed.size());
+	for (handle e : live)
+		copy(texture, res, entries[e].x, entries[e].y, entries[e].layer,
+			 moved[e].x, moved[e].y, moved[e].layer, entries[e].width,
+			 entries[e].height);
+	// the new texture is uninitialized around the images
+	glBindTexture(GL_TEXTURE_2D_ARRAY, res);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (handle e : live)
+		clear_border(moved[e].x, moved[e].y, moved[e].layer, moved[e].width,
+					 moved[e].height);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	glDeleteTextures(1, &texture);
+	untrack_memory(CEL_MEMORY_TEXTURES, texture);
+	texture = res;
+	pages = std::move(packed);
+	entries = std::move(moved);
+	generation++;
+	CEL_LOG(VERBOSE, "Defragmented atlas to {} pages", pages.size());
+	return true;
+}
+AtlasRegion TextureAtlas::region(handle h) const {
+	const Entry &entry = entries[h];
+	const float size = page_size;
+	return {{entry.x / size, entry.y / size, (entry.x + entry.width) / size,
+			 (entry.y + entry.height) / size},
+			entry.layer};
+}
+void TextureAtlas::clean_up() {
+	glDeleteTextures(1, &texture);
+	untrack_memory(CEL_MEMORY_TEXTURES, texture);
+	texture = 0;
+	if (copy_fbos[0])
+		glDeleteFramebuffers(2, copy_fbos);
+	copy_fbos[0] = copy_fbos[1] = 0;
+}
+const std::string primitive_traits<AtlasQuadInstance>::vertex_src = R"(
+#version 400
+)" FRAME_UBO_GLSL R"(
+layout (location = 0) in vec2 pos;
+layout (location = 1) in vec2 position;
+layout (location = 2) in vec2 scale;
+layout (location = 3) in vec4 region;
+layout (location = 4) in uint layer;
+layout (location = 5) in vec4 color;
+out vec3 uv;
+out vec4 tint;
+void main() {
+  // the top row of the quad samples the top row of the region
+  uv = vec3(mix(region.x, region.z, pos.x), mix(region.y, region.w, -pos.y),
+            layer);
+  tint = color;
+  gl_Position = view * vec4(position + pos * scale, 0.0, 1.0);
+}
+)";
+const std::string primitive_traits<AtlasQuadInstance>::fragment_src = R"(
+#version 400
+uniform sampler2DArray atlas;
+in vec3 uv;
+in vec4 tint;
+out vec4 final_color;
+void main() {
+  final_color = texture(atlas, uv) * tint;
+}
+)";
@@ -0,0 +1,166 @@
+#ifndef ATLAS_HPP
+#define ATLAS_HPP
+#include <GL/glew.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "batch.hpp"
+/**
+ * Location of an image in the atlas, uv holds the left, top, right and bottom
+ * texture coordinates in the page
+ */
+struct AtlasRegion {
+	float uv[4];
+	uint32_t layer;
+};
+/**
+ * Tinted quad sampling a region of an atlas. All quads of one atlas share its
+ * texture and are drawn by a single batch, regardless of the images they show.
+ */
+struct AtlasQuadInstance {
+	float pos[2];
+	float size[2];
+	float uv[4];
+	uint32_t layer;
+	uint8_t color[4];
+};
+template <>
+struct primitive_traits<AtlasQuadInstance> {
+	using layout = VertexLayout<AtlasQuadInstance,
+								CEL_ATTRIB(AtlasQuadInstance, pos, false),
+								CEL_ATTRIB(AtlasQuadInstance, size, false),
+								CEL_ATTRIB(AtlasQuadInstance, uv, false),
+								CEL_ATTRIB(AtlasQuadInstance, layer, false),
+								CEL_ATTRIB(AtlasQuadInstance, color, true)>;
+	static const std::string vertex_src;
+	static const std::string fragment_src;
+};
+/**
+ * Packs small images into the layers ("pages") of a GL_TEXTURE_2D_ARRAY. Every
+ * page is packed with a skyline bin packer, so insertion is incremental and
+ * pages whose images were all removed are reused. Space freed in the middle
+ * of a page is reclaimed by defragmenting, which repacks all images into a
+ * new texture and copies them on the GPU. Images keep their handle, but their
+ * regions change whenever the generation of the atlas changes.
+ */
+class TextureAtlas {
+   public:
+	using handle = uint32_t;
+	static constexpr handle invalid = UINT32_MAX;
+
+   private:
+	struct Segment {
+		int x, y, width;
+	};
+	struct Page {
+		std::vector<Segment> skyline;
+		// packed area of the images in the page
+		size_t used = 0;
+	};
+	struct Entry {
+		int x, y, width, height;
+		uint32_t layer;
+		uint64_t last_used;
+		bool live;
+	};
+	GLuint texture = 0, copy_fbos[2] = {0, 0};
+	GLenum internal_format, format;
+	int page_size;
+	unsigned max_pages;
+	size_t texel_size;
+	std::vector<Page> pages;
+	std::vector<Entry> entries;
+	std::vector<handle> free_handles;
+	uint64_t frame = 0;
+	uint32_t generation = 0;
+	static void reset(Page &page, int page_size);
+	/**
+	 * Bottom left position of a width x height rectangle on the skyline
+	 * @return false if it does not fit into the page
+	 */
+	bool find_position(const Page &page, int width, int height, int &x, int &y,
+					   size_t &index) const;
+	void place(Page &page, size_t index, int x, int y, int width, int height);
+	bool pack(std::vector<Page> &pages, int width, int height, uint32_t &layer,
+			  int &x, int &y);
+	/**
+	 * Allocates a texture with the given number of pages
+	 */
+	GLuint allocate(unsigned layers);
+	void copy(GLuint src, GLuint dst, int sx, int sy, uint32_t slayer, int dx,
+			  int dy, uint32_t dlayer, int width, int height);
+	bool grow();
+	/**
+	 * Zeroes the texels around an image in the bound texture, so bilinear
+	 * filtering does not blend in what was stored there before
+	 */
+	void clear_border(int x, int y, uint32_t layer, int width, int height);
+	/**
+	 * Removes the least recently used image
+	 * @param keep_current images touched in the current frame are kept
+	 * @return false if there was no image to evict
+	 */
+	bool evict_lru(bool keep_current);
+	/**
+	 * Packed area of all pages, including the padding
+	 */
+	size_t used_area() const;
+	size_t free_area() const {
+		return pages.size() * page_size * page_size - used_area();
+	}
+
+   public:
+	/**
+	 * Called with images that were evicted to make room for new ones
+	 */
+	std::function<void(handle)> on_evict;
+	/**
+	 * Needs a current OpenGL context.
+	 * @param internal_format format of the texels (e.g. GL_RGBA8 or GL_R8)
+	 * @param format          format of the uploaded pixels
+	 * @param page_size       width and height of a page in texels
+	 * @param max_pages       upper bound of layers, the texture grows on demand
+	 */
+	TextureAtlas(GLenum internal_format = GL_RGBA8, GLenum format = GL_RGBA,
+				 int page_size = 1024, unsigned max_pages = 16);
+	/**
+	 * Packs and uploads an image. If it does not fit the atlas grows, is
+	 * defragmented and finally evicts the least recently used images that
+	 * were not touched in the current frame.
+	 * @param pixels rows from top to bottom, tightly packed
+	 * @return invalid if the image does not fit
+	 */
+	handle insert(int width, int height, const void *pixels);
+	void remove(handle h);
+	/**
+	 * Marks the image as used in the current frame, it is not evicted
+	 */
+	void touch(handle h) { entries[h].last_used = frame; }
+	void next_frame() { frame++; }
+	/**
+	 * Repacks all images into fresh pages of a new texture
+	 * @return false if they do not fit into fewer pages
+	 */
+	bool defragment();
+	/**
+	 * Limits the number of pages, evicting the least recently used images if
+	 * the atlas already uses more
+	 */
+	void set_max_pages(unsigned count);
+	int get_page_size() const { return page_size; }
+	AtlasRegion region(handle h) const;
+	GLuint get_texture() const { return texture; }
+	/**
+	 * Changes whenever the texture was replaced or the regions moved
+	 */
+	uint32_t get_generation() const { return generation; }
+	size_t bytes() const {
+		return pages.size() * page_size * page_size * texel_size;
+	}
+	/**
+	 * Replaces Destructor, cleans up all OpenGL related data.
+	 */
+	void clean_up();
+};
+#endif
@@ -0,0 +1,379 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "memory.hpp"
+#include "render_queue.hpp"
+#include "shader.hpp"
+#include "vao.hpp"
+#include "vertex_layout.hpp"
+// granularity of the dirty tracking of instance data
+#define MAX_BATCH_ELEMENTS 1024
+// unit quad spanning from (0, 0) to (1, -1), every primitive is an instance
+// of it, its corner is passed to the vertex shader at location 0
+inline constexpr float quad_vertices[] = {0, 0, 0, -1, 1, 0, 1, -1};
+inline constexpr unsigned int quad_indices[] = {0, 1, 2, 2, 1, 3};
+/**
+ * Has to be specialized for every instance struct drawn by a BatchRenderer:
+ *   template <> struct primitive_traits<MyInstance> {
+ *     // instance attributes, bound from location 1 on
+ *     using layout = VertexLayout<MyInstance, CEL_ATTRIB(...), ...>;
+ *     static const std::string vertex_src;
+ *     static const std::string fragment_src;
+ *   };
+ */
+template <typename InstanceT>
+struct primitive_traits;
+/**
+ * Draws all instances of one primitive type with instanced rendering of a
+ * quad. Owns the interleaved instance storage, tracks which batches of it
+ * changed and only uploads those. Instances are addressed by stable handles,
+ * internally they are kept dense and partitioned into contiguous groups
+ * (see batch_group) ordered by group, so every group is one range of slots.
+ */
+template <typename InstanceT>
+class BatchRenderer {
+	using traits = primitive_traits<InstanceT>;
+	using layout = typename traits::layout;
+	static_assert(std::is_same<typename layout::vertex, InstanceT>(),
+				  "The layout has to describe the instance struct!");
+	Vao vao;
+	ShaderProgram *program;
+	// false if the program is shared with other renderers of the context
+	bool owns_program;
+	unsigned int instance_vbo;
+	unsigned int capacity = MAX_BATCH_ELEMENTS;
+	// dense instance data, uploaded as is
+	std::vector<InstanceT> instances;
+	// handle -> slot in instances and slot -> handle
+	std::vector<uint32_t> slots;
+	std::vector<uint32_t> handles;
+	std::vector<uint32_t> free_handles;
+	// sorted group keys and the first slot of each group
+	std::vector<int> groups;
+	std::vector<uint32_t> group_starts;
+	// group index of each handle
+	std::vector<uint32_t> group_of;
+	// one flag per MAX_BATCH_ELEMENTS slots
+	std::vector<bool> dirty;
+	bool reallocate = false;
+	std::vector<DrawElementsIndirectCommand> commands;
+	// scratch memory of commands_of
+	std::vector<uint32_t> run_slots;
+	// counts the changes of the slot layout, see get_slot_version
+	uint64_t slot_version = 0;
+	// instance capacity reported to the memory accounting
+	size_t tracked_capacity = 0;
+
+	void mark_dirty(uint32_t slot) {
+		const size_t batch = slot / MAX_BATCH_ELEMENTS;
+		if (batch >= dirty.size())
+			dirty.resize(batch + 1, false);
+		dirty[batch] = true;
+	}
+	void upload() {
+		if (instances.capacity() != tracked_capacity) {
+			tracked_capacity = instances.capacity();
+			track_memory(CEL_MEMORY_HOST, (uintptr_t)this,
+						 tracked_capacity * sizeof(InstanceT));
+		}
+		if (instances.size() > capacity) {
+			while (capacity < instances.size())
+				capacity *= 2;
+			vao.reserve_interleaved_buffer<InstanceT>(instance_vbo, capacity);
+			reallocate = true;
+		}
+		if (reallocate) {
+			vao.update_interleaved_buffer(instance_vbo, instances.data(), 0,
+										  instances.size());
+			std::fill(dirty.begin(), dirty.end(), false);
+			reallocate = false;
+			return;
+		}
+		// coalesce neighbouring dirty batches into one upload
+		for (size_t b = 0; b < dirty.size(); b++) {
+			if (!dirty[b])
+				continue;
+			size_t e = b;
+			while (e < dirty.size() && dirty[e])
+				dirty[e++] = false;
+			const size_t first = b * MAX_BATCH_ELEMENTS;
+			const size_t last =
+				std::min(e * MAX_BATCH_ELEMENTS, instances.size());
+			if (first < last)
+				vao.update_interleaved_buffer(instance_vbo,
+											  instances.data() + first, first,
+											  last - first);
+			b = e;
+		}
+	}
+	uint32_t group_end(size_t g) const {
+		return g + 1 < group_starts.size() ? group_starts[g + 1]
+										   : instances.size();
+	}
+	void move(uint32_t from, uint32_t to) {
+		instances[to] = instances[from];
+		handles[to] = handles[from];
+		slots[handles[to]] = to;
+		mark_dirty(to);
+	}
+	// inserts the instance at the end of its group by moving the first
+	// instance of every following group to the end of that group
+	void attach(uint32_t h, const InstanceT &instance, int group) {
+		auto it = std::lower_bound(groups.begin(), groups.end(), group);
+		const size_t g = it - groups.begin();
+		if (it == groups.end() || *it != group) {
+			groups.insert(it, group);
+			group_starts.insert(group_starts.begin() + g,
+								g < group_starts.size() ? group_starts[g]
+														: instances.size());
+			for (uint32_t &gi : group_of)
+				if (gi >= g && gi != UINT32_MAX)
+					gi++;
+		}
+		slot_version++;
+		uint32_t hole = instances.size();
+		instances.push_back(instance);
+		handles.push_back(h);
+		for (size_t k = groups.size() - 1; k > g; k--) {
+			if (group_starts[k] != hole)
+				move(group_starts[k], hole);
+			hole = group_starts[k]++;
+		}
+		instances[hole] = instance;
+		handles[hole] = h;
+		slots[h] = hole;
+		group_of[h] = g;
+		mark_dirty(hole);
+	}
+	// removes the instance by moving the last instance of its group and of
+	// every following group into the hole
+	void detach(uint32_t h) {
+		slot_version++;
+		const size_t g = group_of[h];
+		uint32_t hole = slots[h];
+		for (size_t k = g; k < groups.size(); k++) {
+			const uint32_t last = group_end(k) - 1;
+			if (last != hole)
+				move(last, hole);
+			hole = last;
+			if (k > g)
+				group_starts[k]--;
+		}
+		instances.pop_back();
+		handles.pop_back();
+		group_of[h] = UINT32_MAX;
+	}
+	DrawElementsIndirectCommand command(uint32_t first, uint32_t count) {
+		return {(GLuint)vao.get_items_count(), count, 0, 0, first};
+	}
+	void init() {
+		vao.add_index_buffer(quad_indices, 6);
+		vao.add_vertex_buffer(2, quad_vertices, 8);
+		instance_vbo = vao.add_interleaved_buffer<layout>(nullptr, capacity, 1);
+	}
+	void submit() {
+		if (instances.empty() || commands.empty())
+			return;
+		upload();
+		program->start();
+		vao.bind();
+		vao.draw_indirect(commands);
+		program->stop();
+	}
+
+   public:
+	using handle = uint32_t;
+	BatchRenderer()
+		: program(new ShaderProgram(traits::vertex_src, traits::fragment_src)),
+		  owns_program(true) {
+		init();
+	}
+	/**
+	 * Draws with a program of the primitive type owned by someone else, it
+	 * has to be created on the same context and outlive the renderer
+	 */
+	explicit BatchRenderer(ShaderProgram &shared)
+		: program(&shared), owns_program(false) {
+		init();
+	}
+	BatchRenderer(const BatchRenderer &) = delete;
+	BatchRenderer &operator=(const BatchRenderer &) = delete;
+	/**
+	 * Adds an instance and returns its handle
+	 * @param group see batch_group
+	 */
+	handle add(const InstanceT &instance, int group = 0) {
+		handle h;
+		if (free_handles.empty()) {
+			h = slots.size();
+			slots.push_back(0);
+			group_of.push_back(UINT32_MAX);
+		} else {
+			h = free_handles.back();
+			free_handles.pop_back();
+		}
+		attach(h, instance, group);
+		return h;
+	}
+	/**
+	 * Removes an instance, its handle may be reused by the next `add`
+	 */
+	void remove(handle h) {
+		detach(h);
+		free_handles.push_back(h);
+	}
+	/**
+	 * Moves an instance to another group, the handle stays valid
+	 */
+	void set_group(handle h, int group) {
+		if (groups[group_of[h]] == group)
+			return;
+		const InstanceT instance = instances[slots[h]];
+		detach(h);
+		attach(h, instance, group);
+	}
+	int get_group(handle h) const { return groups[group_of[h]]; }
+	const InstanceT &get(handle h) const { return instances[slots[h]]; }
+	/**
+	 * Returns the instance for modification and marks it dirty
+	 */
+	InstanceT &edit(handle h) {
+		mark_dirty(slots[h]);
+		return instances[slots[h]];
+	}
+	/**
+	 * Replaces an instance, it is only uploaded again if it changed
+	 * @return true if the instance changed
+	 */
+	bool set(handle h, const InstanceT &instance) {
+		InstanceT &old = instances[slots[h]];
+		if (std::memcmp(&old, &instance, sizeof(InstanceT)) == 0)
+			return false;
+		old = instance;
+		mark_dirty(slots[h]);
+		return true;
+	}
+	size_t size() const { return instances.size(); }
+	/**
+	 * Changes whenever instances are added, removed or moved to another
+	 * slot, commands built by commands_of stay valid until then
+	 */
+	uint64_t get_slot_version() const { return slot_version; }
+	/**
+	 * Buffer holding the instances in the order of data(), valid after the
+	 * renderer was enqueued in this frame
+	 */
+	GLuint get_instance_buffer() const {
+		return vao.get_vbo_id(instance_vbo);
+	}
+	const std::vector<InstanceT> &data() const { return instances; }
+	ShaderProgram &get_program() { return *program; }
+	/**
+	 * Uploads the changed batches and draws all instances, every batch is one
+	 * indirect command and all of them are submitted at once
+	 */
+	void render() {
+		commands.clear();
+		for (size_t first = 0; first < instances.size();
+			 first += MAX_BATCH_ELEMENTS)
+			commands.push_back(command(
+				first, std::min<size_t>(MAX_BATCH_ELEMENTS,
+										instances.size() - first)));
+		submit();
+	}
+	/**
+	 * Uploads the changed batches and draws the given ranges of slots
+	 * @param ranges pairs of first slot and number of instances
+	 */
+	void render(const std::vector<std::pair<uint32_t, uint32_t>> &ranges) {
+		commands.clear();
+		for (const auto &[first, count] : ranges)
+			commands.push_back(command(first, count));
+		submit();
+	}
+	/**
+	 * Uploads the changed batches and adds one draw item per non empty group
+	 * to the queue, keyed by the layer and translucency of the group and
+	 * clipped by its stencil clip
+	 * @param depth the depth bits of the sort keys
+	 */
+	void enqueue(RenderQueue &queue, uint32_t depth = 0,
+				 GLuint texture = 0, GLenum texture_target = GL_TEXTURE_2D) {
+		if (instances.empty())
+			return;
+		upload();
+		for (size_t g = 0; g < groups.size(); g++) {
+			const uint32_t first = group_starts[g], last = group_end(g);
+			if (first == last)
+				continue;
+			const DrawElementsIndirectCommand cmd = command(first, last - first);
+			queue.push(make_sort_key(group_layer(groups[g]),
+									 group_translucent(groups[g]), program->id,
+									 texture, depth),
+					   program, &vao, &cmd, 1, texture, texture_target,
+					   group_clip(groups[g]));
+		}
+	}
+	/**
+	 * Appends the commands drawing the given instances, runs of consecutive
+	 * slots become one command
+	 */
+	void commands_of(const std::vector<handle> &hs,
+					 std::vector<DrawElementsIndirectCommand> &out) {
+		run_slots.clear();
+		for (handle h : hs)
+			run_slots.push_back(slots[h]);
+		std::sort(run_slots.begin(), run_slots.end());
+		for (size_t i = 0; i < run_slots.size();) {
+			size_t j = i + 1;
+			while (j < run_slots.size() && run_slots[j] == run_slots[j - 1] + 1)
+				j++;
+			out.push_back(command(run_slots[i], j - i));
+			i = j;
+		}
+	}
+	/**
+	 * Uploads the changed batches and adds one draw item with the given
+	 * commands to the queue
+	 */
+	void enqueue_commands(RenderQueue &queue,
+						  const std::vector<DrawElementsIndirectCommand> &cmds,
+						  int layer, bool translucent, uint32_t depth = 0,
+						  uint16_t clip = 0) {
+		if (cmds.empty())
+			return;
+		upload();
+		queue.push(make_sort_key(layer, translucent, program->id, 0, depth),
+				   program, &vao, cmds.data(), cmds.size(), 0, GL_TEXTURE_2D,
+				   clip);
+	}
+	/**
+	 * Uploads the changed batches and adds a draw item for a single instance
+	 * with its own texture to the queue
+	 */
+	void enqueue_instance(RenderQueue &queue, handle h, int layer,
+						  bool translucent, GLuint texture,
+						  GLenum texture_target = GL_TEXTURE_2D,
+						  uint32_t depth = 0) {
+		upload();
+		const DrawElementsIndirectCommand cmd = command(slots[h], 1);
+		queue.push(make_sort_key(layer, translucent, program->id, texture,
+								 depth),
+				   program, &vao, &cmd, 1, texture, texture_target);
+	}
+	/**
+	 * Replaces Destructor, cleans up all OpenGL related data.
+	 */
+	void clean_up() {
+		vao.clean_up();
+		if (owns_program) {
+			program->clean_up();
+			delete program;
+		}
+		untrack_memory(CEL_MEMORY_HOST, (uintptr_t)this);
+	}
+};
+#endif
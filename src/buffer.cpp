@@ -0,0 +1,73 @@
+#include "buffer.hpp"
+#include "memory.hpp"
+RingBuffer::RingBuffer(GLenum target, size_t region_size, unsigned int regions)
+	: target(target),
+	  region_size(region_size),
+	  regions(regions),
+	  fences(regions, nullptr) {
+	glGenBuffers(1, &id);
+	glBindBuffer(target, id);
+	const size_t size = region_size * regions;
+	if (GLEW_ARB_buffer_storage) {
+		const GLbitfield flags =
+			GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(target, size, nullptr, flags);
+		mapped = (char *)glMapBufferRange(target, 0, size, flags);
+	} else {
+		glBufferData(target, size, nullptr, GL_DYNAMIC_DRAW);
+		staging.resize(region_size);
+		track_memory(CEL_MEMORY_HOST, id, region_size);
+	}
+	track_memory(CEL_MEMORY_STREAMING_BUFFERS, id, size);
+	glBindBuffer(target, 0);
+}
+char *RingBuffer::begin_region() {
+	GLsync &fence = fences[current];
+	if (fence) {
+		GLenum res = glClientWaitSync(fence, 0, 0);
+		while (res != GL_ALREADY_SIGNALED && res != GL_CONDITION_SATISFIED &&
+			   res != GL_WAIT_FAILED)
+			res = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+								   1000000);
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+	if (mapped)
+		return mapped + region_offset();
+	return staging.data();
+}
+void RingBuffer::flush(size_t used) {
+	if (mapped || used == 0)
+		return;
+	glBindBuffer(target, id);
+	glBufferSubData(target, region_offset(), used, staging.data());
+	glBindBuffer(target, 0);
+}
+void RingBuffer::flush(size_t start, size_t bytes) {
+	if (mapped || bytes == 0)
+		return;
+	glBindBuffer(target, id);
+	glBufferSubData(target, region_offset() + start, bytes,
+					staging.data() + start);
+	glBindBuffer(target, 0);
+}
+void RingBuffer::end_region() {
+	fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	current = (current + 1) % regions;
+}
+void RingBuffer::clean_up() {
+	for (GLsync &fence : fences) {
+		if (fence)
+			glDeleteSync(fence);
+		fence = nullptr;
+	}
+	if (mapped) {
+		glBindBuffer(target, id);
+		glUnmapBuffer(target);
+		glBindBuffer(target, 0);
+		mapped = nullptr;
+	}
+	glDeleteBuffers(1, &id);
+	untrack_memory(CEL_MEMORY_STREAMING_BUFFERS, id);
+	untrack_memory(CEL_MEMORY_HOST, id);
+}
@@ -0,0 +1,69 @@
+#ifndef BUFFER_HPP
+#define BUFFER_HPP
+#include <GL/glew.h>
+#include <cstddef>
+#include <vector>
+/**
+ * A GPU buffer split into several equally sized regions that are written by
+ * the CPU in round robin order. Each region is guarded by a fence, so a region
+ * is only rewritten once the GPU finished all commands reading from it.
+ * If ARB_buffer_storage is available the buffer is persistently and coherently
+ * mapped and the CPU writes directly into GPU visible memory, else a CPU side
+ * staging region is uploaded with glBufferSubData.
+ */
+class RingBuffer {
+	GLuint id = 0;
+	GLenum target;
+	size_t region_size;
+	unsigned int regions;
+	unsigned int current = 0;
+	std::vector<GLsync> fences;
+	char *mapped = nullptr;
+	std::vector<char> staging;
+
+   public:
+	/**
+	 * Allocates the buffer storage, needs a current OpenGL context.
+	 * @param target      the buffer binding target (e.g. GL_UNIFORM_BUFFER)
+	 * @param region_size size in bytes of one region
+	 * @param regions     number of regions, 3 allows the CPU to write one
+	 * frame while the GPU may still read the two frames before
+	 */
+	RingBuffer(GLenum target, size_t region_size, unsigned int regions = 3);
+	/**
+	 * Returns true if the buffer is persistently mapped
+	 */
+	inline bool persistent() const { return mapped != nullptr; }
+	inline GLuint get_id() const { return id; }
+	inline size_t get_region_size() const { return region_size; }
+	/**
+	 * Byte offset of the current region from the start of the buffer
+	 */
+	inline size_t region_offset() const { return current * region_size; }
+	/**
+	 * Waits until the GPU released the current region and returns a pointer
+	 * to it. The pointer is only valid until `end_region`.
+	 */
+	char *begin_region();
+	/**
+	 * Makes the first `used` bytes of the current region visible to the GPU.
+	 * Has to be called before any draw call reads from the region.
+	 */
+	void flush(size_t used);
+	/**
+	 * Makes `bytes` bytes starting at `start` of the current region visible
+	 * to the GPU, for regions that are filled in several steps
+	 */
+	void flush(size_t start, size_t bytes);
+	/**
+	 * Fences the current region after the last command reading it has been
+	 * issued and advances to the next region.
+	 */
+	void end_region();
+	/**
+	 * Replaces Destructor, so you can safely copy a buffer.
+	 * Cleans up all OpenGL related data.
+	 */
+	void clean_up();
+};
+#endif
@@ -18,6 +18,7 @@
 #define CELERITYUI
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <stddef.h>
 /* Color Definitions */
 typedef struct CelWin {
 	const char *name;
@@ -37,12 +38,118 @@ typedef struct CelPaint {
 	CelColorRGBA color;
 	float blur;
 } CelPaint;
+typedef enum CelShape {
+	CEL_SHAPE_RECT = 0,
+	CEL_SHAPE_ELLIPSE = 1
+} CelShape;
+typedef enum CelEasing {
+	CEL_EASE_LINEAR = 0,
+	CEL_EASE_IN = 1,
+	CEL_EASE_OUT = 2,
+	CEL_EASE_IN_OUT = 3
+} CelEasing;
+/* animated properties, index into CelRect.animations */
+typedef enum CelAnimatedProperty {
+	CEL_ANIMATE_POSITION = 0,
+	CEL_ANIMATE_SIZE = 1,
+	CEL_ANIMATE_ROTATION = 2,
+	CEL_ANIMATE_COLOR = 3
+} CelAnimatedProperty;
+typedef struct CelAnimation {
+	/* value the property starts at: x, y resp. width, height resp. rotation
+	 * resp. r, g, b, a */
+	float from[4];
+	/* in seconds, on the clock of glfwGetTime. Not animated if duration is 0 */
+	float start, duration;
+	CelEasing easing;
+} CelAnimation;
+typedef struct CelNode CelNode;
+typedef struct CelBox CelBox;
 typedef struct CelRect {
 	CelPaint color;
 	float x, y, width, height, rotation;
+	/* radius of the rounded corners in pixels, ignored for ellipses */
+	float corner_radius;
+	CelShape shape;
+	/* rectangles of higher layers are drawn above those of lower layers */
+	int layer;
+	/* node the rectangle is placed in, x, y and rotation are relative to it.
+	 * Set through cel_node_attach_rectangle */
+	CelNode *node;
+	/* box the rectangle follows, set through cel_box_attach_rectangle */
+	CelBox *box;
+	/* set through cel_animate_*, the properties above hold the end values */
+	CelAnimation animations[4];
 	CelWin *origin;
 } CelRect;
+/* Memory accounting
+ * GPU memory of buffers, textures and programs and the CPU side copies of
+ * instance data are recorded per window. */
+typedef enum CelMemoryCategory {
+	CEL_MEMORY_VERTEX_BUFFERS,
+	CEL_MEMORY_INDEX_BUFFERS,
+	/* fenced ring buffers for instances, uniforms, commands and uploads */
+	CEL_MEMORY_STREAMING_BUFFERS,
+	CEL_MEMORY_STORAGE_BUFFERS,
+	CEL_MEMORY_TEXTURES,
+	/* size of the program binaries as reported by the driver */
+	CEL_MEMORY_PROGRAMS,
+	CEL_MEMORY_HOST,
+	CEL_MEMORY_CATEGORIES
+} CelMemoryCategory;
+typedef struct CelMemoryStats {
+	size_t bytes[CEL_MEMORY_CATEGORIES];
+	size_t count[CEL_MEMORY_CATEGORIES];
+	/* all categories but CEL_MEMORY_HOST resp. only it */
+	size_t gpu_total, host_total;
+} CelMemoryStats;
+/* the stats of the window, of all windows if it is NULL */
+void cel_get_memory_stats(CelWin *, CelMemoryStats *);
+/* the callback is called by the render thread of the window once its GPU
+ * memory exceeds the budget, again only after it fell below it in between.
+ * A budget of 0 disables it */
+void cel_set_memory_budget(CelWin *, size_t bytes,
+						   void (*callback)(CelWin *, const CelMemoryStats *));
+/* Frame statistics
+ * Opaque rectangles that are completely covered by larger opaque rectangles
+ * of higher layers are culled on the CPU and not drawn. */
+typedef struct CelFrameStats {
+	/* rectangles drawn resp. culled in the last frame of the window,
+	 * rectangles of cached layers are not counted */
+	size_t rectangles_drawn, rectangles_culled;
+	/* rectangles that were used to cull the ones below them */
+	size_t occluders;
+	/* summed area of the rectangles divided by the area of the window,
+	 * without and with culling */
+	float overdraw, overdraw_culled;
+	/* frames rendered by the window and the CPU time the last one took to
+	 * be built and submitted in seconds, without waiting for the swap */
+	unsigned long long frames;
+	double frame_time;
+} CelFrameStats;
+void cel_get_frame_stats(CelWin *, CelFrameStats *);
+/* enabled by default */
+void cel_set_occlusion_culling(CelWin *, int enabled);
+/* Tracing
+ * Records the window, rectangle and scene graph API calls, fired events and
+ * rendered frames with timestamps into a compact binary trace, which the
+ * celerityui_replay tool executes again. Direct changes of rectangle fields
+ * are recorded once per frame. Objects created before the trace was started
+ * are not known to the replay. Returns 0 if the file could not be created */
+int cel_start_trace(const char *path);
+void cel_stop_trace(void);
 /* Window Management Functions */
+/* By default every window is rendered by its own thread. With count > 0 all
+ * windows are rendered by a pool of `count` threads instead, windows are
+ * assigned round-robin and only redrawn when they are damaged by events or
+ * API calls. Has to be called before the first window is created, the pool
+ * is stopped once its last window was destroyed. */
+void cel_set_render_threads(int count);
+/* windows created afterwards are not shown, e.g. for benchmarks */
+void cel_set_hidden_windows(int hidden);
+/* marks the window damaged, e.g. after rectangle fields were changed
+ * directly */
+void cel_request_redraw(CelWin *);
 CelWin *cel_create_window(const char *title, int width, int height);
 void cel_destroy_window(CelWin *);
 void cel_wait_for_window(CelWin *);
@@ -65,6 +172,241 @@ void cel_remove_scroll_callback(CelWin *, void (*)(CelWin *, double, double));
 /* Rectangles */
 CelRect *cel_create_rectangle(CelWin *, float x, float y, float width,
 							  float height, CelPaint color);
+/* Rounded rectangles and ellipses are evaluated as signed distances in the
+ * shader and drawn in the same draw call as plain rectangles */
+CelRect *cel_create_rounded_rectangle(CelWin *, float x, float y, float width,
+									  float height, float corner_radius,
+									  CelPaint color);
+CelRect *cel_create_ellipse(CelWin *, float x, float y, float width,
+							float height, CelPaint color);
 void cel_delete_rectangle(CelWin *, CelRect *);
+/* Rectangle sets
+ * Many rectangles whose properties live in arrays owned by the caller, e.g.
+ * the points of a plot. A set is drawn with a single draw call and is not
+ * part of the scene graph, coordinates are the same as of rectangles. */
+typedef struct CelRectSet CelRectSet;
+/* one rectangle as it is stored on the GPU, see cel_map_rectangles */
+typedef struct CelRectSetInstance {
+	float x, y, width, height;
+	/* in radians */
+	float rotation;
+	/* RGBA8 */
+	unsigned char color[4];
+} CelRectSetInstance;
+/* arrays of the properties, element i of each array describes rectangle i.
+ * A stride is the distance in bytes between two elements, 0 for tightly
+ * packed arrays */
+typedef struct CelRectArrays {
+	const float *x, *y, *width, *height;
+	/* NULL for unrotated rectangles */
+	const float *rotation;
+	/* RGBA8, NULL to draw all rectangles in uniform_color */
+	const unsigned char *color;
+	size_t x_stride, y_stride, width_stride, height_stride, rotation_stride,
+		color_stride;
+	CelColorRGBA uniform_color;
+} CelRectArrays;
+/* translucent sets are blended with the content below them, they have to be
+ * if any rectangle is transparent or rotated */
+CelRectSet *cel_create_rectangle_set(CelWin *, int layer, int translucent);
+void cel_delete_rectangle_set(CelWin *, CelRectSet *);
+/* binds `count` rectangles read from the arrays, which are not copied. They
+ * are read by the render thread of the window when the next frame is drawn
+ * and again after every cel_rectangle_set_changed, so they have to stay
+ * valid until other arrays are bound or the set is deleted */
+void cel_rectangle_set_bind(CelRectSet *, const CelRectArrays *, size_t count);
+/* the bound arrays were modified */
+void cel_rectangle_set_changed(CelRectSet *);
+/* unbinds the arrays and returns write only storage for `count` rectangles,
+ * which may be GPU memory. The previous rectangles are drawn until
+ * cel_unmap_rectangles is called, the storage is invalid afterwards */
+CelRectSetInstance *cel_map_rectangles(CelRectSet *, size_t count);
+void cel_unmap_rectangles(CelRectSet *);
+/* Scene files
+ * A snapshot of the rectangles of a window in a versioned little-endian file
+ * whose instance array has the layout of the GPU instances. Loading maps the
+ * file and uploads the array as is, without parsing or allocating per
+ * rectangle. Loaded rectangles are drawn like rectangles but can not be
+ * changed. */
+typedef struct CelSceneFile CelSceneFile;
+/* animations are saved at their end values and rotated clips at their
+ * bounds. Returns 0 on failure */
+int cel_save_scene(CelWin *, const char *path);
+/* NULL if the file can not be read or was written by an incompatible
+ * version */
+CelSceneFile *cel_load_scene(CelWin *, const char *path);
+void cel_unload_scene(CelWin *, CelSceneFile *);
+/* Images
+ * Images are decoded by a pool of worker threads and uploaded by a context
+ * shared with the window, the placeholder color is drawn until the upload
+ * completed. Small images are packed into one texture atlas per window and
+ * drawn together. Coordinates are in the same space as rectangles. */
+typedef struct CelImage {
+	float x, y, width, height;
+	int layer;
+	CelColorRGBA placeholder;
+	/* set once the texture is uploaded resp. decoding or uploading failed */
+	int ready, failed;
+	CelWin *origin;
+} CelImage;
+/* decodes the file to rows of RGBA8 pixels from top to bottom, allocated with
+ * malloc. Called by the decode threads concurrently, NULL on failure */
+typedef unsigned char *(*CelImageDecoder)(const char *path, int *width,
+										  int *height);
+/* replaces the built-in decoder, which only reads binary PPM files. NULL
+ * restores it */
+void cel_set_image_decoder(CelImageDecoder);
+CelImage *cel_create_image(CelWin *, const char *path, float x, float y,
+						   float width, float height);
+void cel_delete_image(CelWin *, CelImage *);
+/* Text
+ * Glyphs are rasterized once as signed distance fields and drawn at any size.
+ * Every window keeps the glyphs it shows in an atlas limited by a byte budget
+ * (16 MiB by default), the least recently used glyphs are evicted first.
+ * Generated fields are persisted per font in the glyph cache directory, so
+ * they are not rasterized again on the next start. */
+typedef struct CelFont CelFont;
+typedef struct CelText CelText;
+/* defaults to $XDG_CACHE_HOME/celerityui resp. ~/.cache/celerityui, NULL
+ * disables the persistent cache. Applies to fonts loaded afterwards */
+void cel_set_glyph_cache_dir(const char *path);
+CelFont *cel_load_font(const char *path);
+/* the texts using the font have to be deleted first */
+void cel_delete_font(CelFont *);
+void cel_set_glyph_cache_budget(CelWin *, size_t bytes);
+/* x, y is the start of the baseline in the same space as rectangles, size is
+ * the em size in pixels */
+CelText *cel_create_text(CelWin *, CelFont *, const char *utf8, float x,
+						 float y, float size, CelColorRGBA color);
+void cel_delete_text(CelWin *, CelText *);
+void cel_text_set_string(CelText *, const char *utf8);
+void cel_text_set_position(CelText *, float x, float y);
+void cel_text_set_style(CelText *, float size, CelColorRGBA color);
+void cel_text_set_layer(CelText *, int layer);
+/* Animations
+ * The property is interpolated from its current value to the given one on the
+ * GPU, starting `delay` seconds from now. The rectangle holds the end value
+ * immediately, animating a property that is still animated continues from its
+ * current value. Running animations cost no uploads. */
+void cel_animate_position(CelRect *, float x, float y, float delay,
+						  float duration, CelEasing easing);
+void cel_animate_size(CelRect *, float width, float height, float delay,
+					  float duration, CelEasing easing);
+void cel_animate_rotation(CelRect *, float rotation, float delay,
+						  float duration, CelEasing easing);
+void cel_animate_color(CelRect *, CelColorRGBA color, float delay,
+					   float duration, CelEasing easing);
 void cel_render_rectangles(CelWin * win);
+/* Compute Kernels
+ * A kernel is the body of a GLSL compute shader that runs over the rectangle
+ * instances of the window every frame before they are drawn, e.g. for physics
+ * or to map large data sets to rectangles. It is compiled after a prelude
+ * that declares `rects[]` (see RectInstance in src/rects.hpp), `rect_count`,
+ * the Frame block with `time` and a work group size of 64:
+ *   void main() {
+ *     uint i = gl_GlobalInvocationID.x;
+ *     if (i >= rect_count) return;
+ *     rects[i].rotation = time;
+ *   }
+ * Instances are in no particular order and move when rectangles change,
+ * rects[i].index is the stable index of the rectangle returned by
+ * cel_kernel_rect_index, e.g. to look up its data:
+ *   rects[i].pos[0] = data[rects[i].index];
+ * Written values persist until a rectangle of the same batch is changed on
+ * the CPU, rectangles of cached nodes are not included. */
+typedef struct CelKernel CelKernel;
+/* returns NULL if the kernel does not compile or compute shaders are not
+ * supported */
+CelKernel *cel_create_kernel(CelWin *, const char *source);
+void cel_delete_kernel(CelKernel *);
+/* sets a uniform of the kernel before its next dispatch */
+void cel_kernel_set_float(CelKernel *, const char *name, float value);
+void cel_kernel_set_int(CelKernel *, const char *name, int value);
+/* copies the data into a shader storage buffer bound to `binding`, e.g.
+ *   layout (std430, binding = 1) buffer Data { float data[]; };
+ * binding 0 is reserved for the rectangles, returns 0 then */
+int cel_kernel_set_buffer(CelKernel *, unsigned int binding, const void *data,
+						  size_t bytes);
+/* the index of the rectangle in rects[].index, it stays the same until the
+ * rectangle is deleted, indices of deleted rectangles are reused */
+unsigned int cel_kernel_rect_index(CelRect *);
+/* Scene Graph
+ * Nodes carry a transform relative to their parent node. Moving a node moves
+ * its whole subtree, world transforms are only recomputed for changed
+ * subtrees. */
+CelNode *cel_create_node(CelWin *, CelNode *parent);
+/* deletes the node and its subtree, attached rectangles are detached */
+void cel_delete_node(CelNode *);
+void cel_node_set_transform(CelNode *, float x, float y, float rotation,
+							float scale);
+/* attaches the rectangle to the node, detaches it if node is NULL */
+void cel_node_attach_rectangle(CelNode *, CelRect *);
+/* clips the attached rectangles and the subtree of the node to a rectangle
+ * in the coordinates of the node, nested clips intersect. Clips that are axis
+ * aligned in the window are evaluated per instance and keep the rectangles in
+ * their batches; rotated clips are written into the stencil buffer, which
+ * costs a draw call per clip. Cached subtrees are only clipped to the bounds
+ * of rotated clips. */
+void cel_node_set_clip(CelNode *, float x, float y, float width, float height);
+void cel_node_clear_clip(CelNode *);
+/* marks the subtree of the node as static: its rectangles are rendered once
+ * into a texture that is composited as a single quad until one of them
+ * changes. Layers that change every frame are drawn directly. */
+void cel_node_set_cached(CelNode *, int cached);
+/* maximum number of bytes used by the cached layers of the window, the least
+ * recently used layers are evicted first. Defaults to 64 MiB */
+void cel_set_layer_cache_budget(CelWin *, size_t bytes);
+/* Layout
+ * Boxes are laid out in rows or columns like a single line flexbox, sizes are
+ * in pixels. Top level boxes fill the window. Results are cached and only the
+ * boxes affected by a change are laid out again. Attached rectangles are
+ * moved to the bounds of their box. */
+typedef enum CelDirection {
+	CEL_DIRECTION_ROW = 0,
+	CEL_DIRECTION_COLUMN = 1
+} CelDirection;
+typedef enum CelAlign {
+	CEL_ALIGN_START = 0,
+	CEL_ALIGN_CENTER = 1,
+	CEL_ALIGN_END = 2,
+	/* stretches along the cross axis, spaces the children evenly along the
+	 * main axis when used for justification */
+	CEL_ALIGN_STRETCH = 3
+} CelAlign;
+CelBox *cel_create_box(CelWin *, CelBox *parent);
+/* deletes the box and all its children */
+void cel_delete_box(CelBox *);
+void cel_box_set_direction(CelBox *, CelDirection);
+/* a negative size is derived from the children */
+void cel_box_set_size(CelBox *, float width, float height);
+void cel_box_set_flex(CelBox *, float grow, float shrink);
+void cel_box_set_padding(CelBox *, float left, float top, float right,
+						 float bottom);
+void cel_box_set_align(CelBox *, CelAlign justify, CelAlign align);
+/* a rectangle follows one box, attaching it again moves it to the new box.
+ * Deleting the box or the rectangle detaches it */
+void cel_box_attach_rectangle(CelBox *, CelRect *);
+void cel_box_get_bounds(CelBox *, float *x, float *y, float *width,
+						float *height);
+/* Paths
+ * Coordinates are in the same space as rectangles, stroke widths in pixels.
+ * Curves are flattened when they are added, the tessellation of a path is
+ * cached and points appended to its last subpath only add new segments. */
+typedef struct CelPath CelPath;
+CelPath *cel_create_path(CelWin *, float stroke_width, CelColorRGBA stroke);
+void cel_delete_path(CelWin *, CelPath *);
+void cel_path_move_to(CelPath *, float x, float y);
+void cel_path_line_to(CelPath *, float x, float y);
+void cel_path_quad_to(CelPath *, float cx, float cy, float x, float y);
+void cel_path_cubic_to(CelPath *, float c1x, float c1y, float c2x, float c2y,
+					   float x, float y);
+void cel_path_close(CelPath *);
+/* appends count points given as interleaved x, y coordinates */
+void cel_path_append_points(CelPath *, const float *xy, int count);
+void cel_path_clear(CelPath *);
+void cel_path_set_stroke(CelPath *, float stroke_width, CelColorRGBA stroke);
+/* subpaths are implicitly closed when filled */
+void cel_path_set_fill(CelPath *, int filled, CelColorRGBA fill);
+void cel_path_set_layer(CelPath *, int layer);
+void cel_render_paths(CelWin *win);
 #endif
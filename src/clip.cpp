@@ -0,0 +1,80 @@
+#include "clip.hpp"
+#include <unordered_map>
+#include "src/ubo.hpp"
+static std::unordered_map<CelWin *, StencilClips *> stencil_clips;
+static const std::string clip_vertex_src = R"(
+#version 400
+)" FRAME_UBO_GLSL R"(
+layout (location = 0) in vec2 pos;
+void main() {
+  gl_Position = view * vec4(pos, 0.0, 1.0);
+}
+)";
+static const std::string clip_fragment_src = R"(
+#version 400
+out vec4 final_color;
+void main() {
+  final_color = vec4(0);
+}
+)";
+StencilClips::StencilClips(SceneGraph *scene)
+	: program(clip_vertex_src, clip_fragment_src), scene(scene),
+	  triangles(12, 0.0f) {
+	program.bind_uniform_block("Frame", FRAME_UBO_BINDING);
+	vao.add_vertex_buffer(2, triangles.data(), triangles.size());
+}
+void StencilClips::write(uint16_t stencil) {
+	const std::vector<float> *region = scene->stencil_region(stencil);
+	if (!region || region->empty()) {
+		glDisable(GL_STENCIL_TEST);
+		return;
+	}
+	const size_t quads = region->size() / 8;
+	triangles.clear();
+	for (size_t q = 0; q < quads; q++) {
+		const float *c = region->data() + q * 8;
+		for (int v : {0, 1, 2, 0, 2, 3}) {
+			triangles.push_back(c[v * 2]);
+			triangles.push_back(c[v * 2 + 1]);
+		}
+	}
+	vao.update_vbo(0, triangles.data(), triangles.size());
+	glEnable(GL_STENCIL_TEST);
+	glStencilMask(0xff);
+	glClearStencil(0);
+	glClear(GL_STENCIL_BUFFER_BIT);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+	program.start();
+	vao.bind();
+	for (size_t q = 0; q < quads; q++) {
+		glStencilFunc(GL_EQUAL, (GLint)q, 0xff);
+		glDrawArrays(GL_TRIANGLES, (GLint)q * 6, 6);
+	}
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+	glStencilFunc(GL_EQUAL, (GLint)quads, 0xff);
+}
+void StencilClips::clean_up() {
+	vao.clean_up();
+	program.clean_up();
+}
+void prepare_clips(CelWin *win, RenderQueue &queue) {
+	auto it = stencil_clips.find(win);
+	if (it == stencil_clips.end()) {
+		// windows without rotated clips never need the stencil buffer
+		SceneGraph *scene = get_scene(win);
+		if (!scene->stencil_region(1))
+			return;
+		it = stencil_clips.insert({win, new StencilClips(scene)}).first;
+	}
+	queue.set_stencil_clips(it->second);
+}
+void destroy_clips(CelWin *win) {
+	auto it = stencil_clips.find(win);
+	if (it == stencil_clips.end())
+		return;
+	it->second->clean_up();
+	delete it->second;
+	stencil_clips.erase(it);
+}
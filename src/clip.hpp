@@ -0,0 +1,47 @@
+#ifndef CLIP_HPP
+#define CLIP_HPP
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "celerityui.h"
+#include "render_queue.hpp"
+#include "scene.hpp"
+#include "shader.hpp"
+#include "vao.hpp"
+/**
+ * Writes the rotated clips of a scene into the stencil buffer. The quads of a
+ * clip are drawn one after another, each only incrementing the stencil where
+ * all previous ones did, so only their intersection reaches the count of
+ * quads, which is the reference value the clipped items are tested against.
+ */
+class StencilClips {
+	ShaderProgram program;
+	Vao vao;
+	SceneGraph *scene;
+	// two triangles per quad
+	std::vector<float> triangles;
+
+   public:
+	StencilClips(SceneGraph *scene);
+	/**
+	 * Clears the stencil buffer, writes the clip and leaves the stencil test
+	 * enabled so following draws are clipped by it. Binds its own program
+	 * and vao.
+	 */
+	void write(uint16_t stencil);
+	/**
+	 * Replaces Destructor, cleans up all OpenGL related data.
+	 */
+	void clean_up();
+};
+/**
+ * Hands the stencil clips of the window to the render queue of the frame,
+ * after the scene was updated
+ */
+void prepare_clips(CelWin *win, RenderQueue &queue);
+/**
+ * Releases the stencil clips of a window before it is destroyed, its context
+ * has to be current
+ */
+void destroy_clips(CelWin *win);
+#endif
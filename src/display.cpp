@@ -16,6 +16,9 @@
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <iostream>
 #include <ostream>
 #include <thread>
@@ -23,21 +26,147 @@
 #include <vector>
 #include <semaphore>
 #include "celerityui.h"
+#include "clip.hpp"
 
+#include "glyphs.hpp"
+#include "images.hpp"
 #include "internal.hpp"
+#include "kernel.hpp"
+#include "layer_cache.hpp"
+#include "layout.hpp"
+#include "memory.hpp"
+#include "paths.hpp"
+#include "rect_sets.hpp"
+#include "rects.hpp"
+#include "render_queue.hpp"
+#include "scene.hpp"
+#include "scene_file.hpp"
+#include "trace.hpp"
+#include "ubo.hpp"
 
 using namespace std;
 static bool glfw_initialized = false;
+static atomic<bool> hidden_windows = false;
 static volatile atomic<bool> glew_initialized = false;
 static unordered_map<GLFWwindow *, CelWin *> assoc_wins;
 static unordered_map<CelWin *, thread *> assoc_threads;
 static unordered_map<CelWin *, binary_semaphore*> wait_for_create;
+// the window hints are global state of GLFW, shared by all render threads
+static mutex create_lock;
+/**
+ * Render state of one window, only touched by the thread rendering it
+ */
+struct WindowState {
+	CelWin *win;
+	// hidden, used by the image uploader of the window
+	GLFWwindow *upload_context = nullptr;
+	UniformRing *frame_ring = nullptr;
+	// indirect commands of all draws of a frame
+	CommandRing *command_ring = nullptr;
+	RenderQueue queue;
+	int oldwidth, oldheight;
+	// set by events and API calls, cleared when a frame is rendered
+	atomic<bool> damaged = true;
+	// animations or kernels are running, redrawn every frame
+	bool continuous = false;
+	// glfwGetTime at which a pending animation starts, INFINITY if none
+	double wake_at = INFINITY;
+	// render thread of the pool, -1 if the window has its own thread
+	int worker = -1;
+	// rendered frames and the CPU time of the last one in seconds
+	uint64_t frames = 0;
+	double frame_time = 0;
+	mutex closed_lock;
+	condition_variable closed_cv;
+	bool closed = false;
+};
+/**
+ * Thread of the render pool, renders the damaged windows assigned to it
+ * round-robin. Only the first one polls events, the others sleep until one
+ * of their windows is damaged.
+ */
+struct RenderWorker {
+	thread *routine = nullptr;
+	vector<WindowState *> windows;
+	// windows to be opened by this worker
+	vector<WindowState *> pending;
+	mutex lock;
+	condition_variable wake;
+	bool woken = false;
+	// set once the last window of the pool was destroyed
+	bool stopping = false;
+};
+static int render_thread_count = 0;
+static vector<RenderWorker *> workers;
+static unsigned int next_worker = 0;
+// guards window_states and the pool
+static mutex sched_lock;
+static unordered_map<CelWin *, WindowState *> window_states;
+static void wake_worker(RenderWorker *worker) {
+	{
+		const lock_guard<mutex> lk(worker->lock);
+		worker->woken = true;
+	}
+	worker->wake.notify_one();
+}
+// marks the window damaged, `post` wakes the thread waiting for events
+static void damage(CelWin *win, bool post) {
+	// the state is deleted under the lock by cel_destroy_window
+	const lock_guard<mutex> lk(sched_lock);
+	auto it = window_states.find(win);
+	if (it == window_states.end())
+		return;
+	WindowState *state = it->second;
+	state->damaged = true;
+	if (state->worker > 0)
+		wake_worker(workers[state->worker]);
+	else if (post)
+		glfwPostEmptyEvent();
+}
+void Internal::damage(CelWin *win) { ::damage(win, true); }
+GLFWwindow *Internal::upload_context(CelWin *win) {
+	const lock_guard<mutex> lk(sched_lock);
+	auto it = window_states.find(win);
+	return it == window_states.end() ? nullptr : it->second->upload_context;
+}
+void cel_request_redraw(CelWin *win) { ::damage(win, true); }
+void cel_set_hidden_windows(int hidden) { hidden_windows = hidden; }
+void cel_get_frame_stats(CelWin *win, CelFrameStats *stats) {
+	WindowState *state;
+	{
+		const lock_guard<mutex> lk(sched_lock);
+		auto it = window_states.find(win);
+		state = it == window_states.end() ? nullptr : it->second;
+	}
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	get_rect_stats(win, stats);
+	if (state) {
+		stats->frames = state->frames;
+		stats->frame_time = state->frame_time;
+	}
+}
+void cel_set_render_threads(int count) {
+	const lock_guard<mutex> lk(sched_lock);
+	if (workers.empty())
+		render_thread_count = max(0, count);
+}
 static void error_callback(int, const char *error) {
 	std::cout << error << std::endl;
 }
+static void window_refresh_callback(GLFWwindow *win) {
+	damage(assoc_wins[win], false);
+}
+// the events of pool windows are handled by the first worker, the worker
+// owning the window has to be woken to close it
+static void window_close_callback(GLFWwindow *win) {
+	damage(assoc_wins[win], false);
+}
 static unordered_map<CelWin *, vector<void (*)(CelWin *)>> resize_callbacks;
 static void window_size_callback(GLFWwindow *win, int width, int height) {
 	CelWin *cw = assoc_wins[win];
+	damage(cw, false);
+	trace(TRACE_EVENT, trace_id(cw), TRACE_EVENT_RESIZE, (double)width,
+		  (double)height, 0.0);
 	cw->width = width;
 	cw->height = height;
 	for (const auto cb : resize_callbacks[cw])
@@ -62,6 +191,9 @@ void cel_remove_resize_callback(CelWin *win, void (*cb)(CelWin *)) {
 static unordered_map<CelWin *, vector<void (*)(CelWin *)>> position_callbacks;
 static void window_pos_callback(GLFWwindow *win, int x, int y) {
 	CelWin *cw = assoc_wins[win];
+	damage(cw, false);
+	trace(TRACE_EVENT, trace_id(cw), TRACE_EVENT_POSITION, (double)x,
+		  (double)y, 0.0);
 	cw->x = x;
 	cw->y = y;
 	for (const auto cb : position_callbacks[cw])
@@ -87,6 +219,9 @@ static unordered_map<CelWin *, vector<void (*)(CelWin *, int focus)>>
 	focus_callbacks;
 static void window_focus_callback(GLFWwindow *win, int focus) {
 	CelWin *cw = assoc_wins[win];
+	damage(cw, false);
+	trace(TRACE_EVENT, trace_id(cw), TRACE_EVENT_FOCUS, (double)focus, 0.0,
+		  0.0);
 	for (const auto cb : focus_callbacks[cw])
 		cb(cw, focus);
 }
@@ -110,6 +245,8 @@ static unordered_map<CelWin *, vector<void (*)(CelWin *, double x, double y)>>
 	cursor_callbacks;
 static void window_cursor_callback(GLFWwindow *win, double x, double y) {
 	CelWin *cw = assoc_wins[win];
+	damage(cw, false);
+	trace(TRACE_EVENT, trace_id(cw), TRACE_EVENT_CURSOR, x, y, 0.0);
 	for (const auto cb : cursor_callbacks[cw])
 		cb(cw, x, y);
 }
@@ -136,6 +273,9 @@ static unordered_map<CelWin *, vector<void (*)(CelWin *, int, int, int)>>
 static void window_mouse_callback(GLFWwindow *win, int button, int action,
 								  int mods) {
 	CelWin *cw = assoc_wins[win];
+	damage(cw, false);
+	trace(TRACE_EVENT, trace_id(cw), TRACE_EVENT_MOUSE, (double)button,
+		  (double)action, (double)mods);
 	for (const auto cb : mouse_callbacks[cw])
 		cb(cw, button, action, mods);
 }
@@ -160,6 +300,8 @@ static unordered_map<CelWin *, vector<void (*)(CelWin *, double, double)>>
 	scroll_callbacks;
 static void window_scroll_callback(GLFWwindow *win, double x, double y) {
 	CelWin *cw = assoc_wins[win];
+	damage(cw, false);
+	trace(TRACE_EVENT, trace_id(cw), TRACE_EVENT_SCROLL, x, y, 0.0);
 	for (const auto cb : scroll_callbacks[cw])
 		cb(cw, x, y);
 }
@@ -181,17 +323,34 @@ void cel_remove_scroll_callback(CelWin *win,
 		}
 	}
 }
-static void window_routine(CelWin *win) {
-	GLFWwindow *window =
-		glfwCreateWindow(win->width, win->height, win->name, nullptr, nullptr);
+// creates the window and its context on the calling thread
+static bool open_window(WindowState *state) {
+	CelWin *win = state->win;
+	GLFWwindow *window;
+	{
+		const lock_guard<mutex> lk(create_lock);
+		glfwWindowHint(GLFW_VISIBLE, hidden_windows ? GLFW_FALSE : GLFW_TRUE);
+		window = glfwCreateWindow(win->width, win->height, win->name, nullptr,
+								  nullptr);
+		if (!window)
+			return false;
+		// created while the context of the window is not current anywhere
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		state->upload_context = glfwCreateWindow(1, 1, "", nullptr, window);
+	}
 	win->window = window;
 	assoc_wins.insert({window, win});
+	register_context(window, win);
+	if (state->upload_context)
+		register_context(state->upload_context, win);
 	glfwSetWindowSizeCallback(window, window_size_callback);
 	glfwSetWindowPosCallback(window, window_pos_callback);
 	glfwSetWindowFocusCallback(window, window_focus_callback);
 	glfwSetCursorPosCallback(window, window_cursor_callback);
 	glfwSetMouseButtonCallback(window, window_mouse_callback);
 	glfwSetScrollCallback(window, window_scroll_callback);
+	glfwSetWindowRefreshCallback(window, window_refresh_callback);
+	glfwSetWindowCloseCallback(window, window_close_callback);
 	{
 		const lock_guard<mutex> lk(Internal::gl_lock);
 		glfwMakeContextCurrent(window);
@@ -199,40 +358,205 @@ static void window_routine(CelWin *win) {
 			int glew_stat = glewInit();
 			if (glew_stat != GLEW_OK) {
         std::cerr << "GLEW error!" << std::endl;
-				return;
+				glfwMakeContextCurrent(nullptr);
+				if (state->upload_context) {
+					unregister_context(state->upload_context);
+					glfwDestroyWindow(state->upload_context);
+					state->upload_context = nullptr;
+				}
+				unregister_context(window);
+				assoc_wins.erase(window);
+				glfwDestroyWindow(window);
+				win->window = nullptr;
+				return false;
 			}
       std::cout << "glew init" << std::endl;
 		}
 		glClearColor(1, 1, 1, 1);
 		glViewport(0, 0, win->width, win->height);
+		state->frame_ring = new UniformRing();
+		state->command_ring = new CommandRing();
+		glfwMakeContextCurrent(nullptr);
+	}
+	state->oldwidth = win->width;
+	state->oldheight = win->height;
+	return true;
+}
+// `damaged` is false for frames only drawn for running animations or kernels
+static void render_frame(WindowState *state, bool damaged) {
+	CelWin *win = state->win;
+	GLFWwindow *window = win->window;
+	UniformRing *frame_ring = state->frame_ring;
+	RenderQueue &queue = state->queue;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	const double frame_start = glfwGetTime();
+	if (glfwGetCurrentContext() != window)
+		glfwMakeContextCurrent(window);
+	if (win->width != state->oldwidth || win->height != state->oldheight) {
+		state->oldwidth = win->width;
+		state->oldheight = win->height;
+		glViewport(0, 0, state->oldwidth, state->oldheight);
+	}
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	// per frame constants are uploaded once and shared by all programs
+	frame_ring->begin_frame();
+	FrameUniforms frame;
+	frame.view = glm::mat4(1.0f);
+	frame.window_size = glm::vec2(state->oldwidth, state->oldheight);
+	frame.time = (float)glfwGetTime();
+	const size_t frame_offset = frame_ring->push(frame);
+	state->command_ring->begin_frame();
+	Vao::set_command_ring(state->command_ring);
+	update_layout(win);
+	update_scene(win);
+	// rotated clips are written into the stencil buffer during the submit
+	prepare_clips(win, queue);
+	enqueue_rectangles(win, queue, damaged);
+	enqueue_rect_sets(win, queue);
+	enqueue_scene_files(win, queue);
+	// running animations are evaluated on the GPU every frame, the render
+	// thread sleeps until pending ones start
+	state->wake_at = rectangles_next_frame(win, frame.time);
+	state->continuous = state->wake_at <= frame.time || kernels_running(win);
+	enqueue_paths(win, queue);
+	// images still loading are drawn as placeholders
+	enqueue_images(win, queue);
+	enqueue_texts(win, queue);
+	// renders stale cached layers into their textures first
+	enqueue_layers(win, queue, frame_ring, frame);
+	frame_ring->flush();
+	frame_ring->bind(FRAME_UBO_BINDING, frame_offset, sizeof(frame));
+	// kernels update the uploaded instances before they are drawn
+	run_kernels(win);
+	queue.submit();
+	frame_ring->end_frame();
+	Vao::set_command_ring(nullptr);
+	state->command_ring->end_frame();
+	state->frames++;
+	state->frame_time = glfwGetTime() - frame_start;
+	trace(TRACE_FRAME, trace_id(win), state->frame_time);
+	glfwSwapBuffers(window);
+	glfwMakeContextCurrent(nullptr);
+}
+// wakes the threads waiting for the window in wait_for_close
+static void mark_closed(WindowState *state) {
+	{
+		const lock_guard<mutex> lk(state->closed_lock);
+		state->closed = true;
+	}
+	state->closed_cv.notify_all();
+}
+static void close_window(WindowState *state) {
+	{
+		const lock_guard<mutex> lk(Internal::gl_lock);
+		CelWin *win = state->win;
+		glfwMakeContextCurrent(win->window);
+		destroy_kernels(win);
+		destroy_texts(win);
+		destroy_images(win);
+		destroy_layer_cache(win);
+		destroy_paths(win);
+		destroy_clips(win);
+		destroy_scene_files(win);
+		destroy_rect_sets(win);
+		destroy_rectangles(win);
+		state->frame_ring->clean_up();
+		delete state->frame_ring;
+		state->command_ring->clean_up();
+		delete state->command_ring;
 		glfwMakeContextCurrent(nullptr);
+		// everything still accounted to the window leaked
+		release_memory_stats(win);
+		if (state->upload_context)
+			unregister_context(state->upload_context);
+		unregister_context(win->window);
 	}
+	// the uploader using it was stopped by destroy_images
+	if (state->upload_context)
+		glfwDestroyWindow(state->upload_context);
+	glfwHideWindow(state->win->window);
+	glfwDestroyWindow(state->win->window);
+	mark_closed(state);
+}
+static void window_routine(WindowState *state) {
+	CelWin *win = state->win;
+	const bool opened = open_window(state);
   wait_for_create[win]->release();
-	int oldwidth = win->width;
-	int oldheight = win->height;
-	while (!glfwWindowShouldClose(window)) {
-		bool dont_sleep = false;
+	if (!opened) {
+		mark_closed(state);
+		return;
+	}
+	while (!glfwWindowShouldClose(win->window)) {
+		render_frame(state, state->damaged.exchange(false));
+		check_memory_budget(win);
+		if (state->continuous) {
+			glfwPollEvents();
+		} else if (state->wake_at < INFINITY) {
+			glfwWaitEventsTimeout(max(0.0, state->wake_at - glfwGetTime()));
+			glfwPollEvents();
+		} else {
+			glfwWaitEvents();
+			glfwPollEvents();
+		}
+	}
+	close_window(state);
+}
+static void worker_routine(RenderWorker *worker, bool polls_events) {
+	while (true) {
+		vector<WindowState *> opening;
 		{
-			const lock_guard<mutex> lk(Internal::gl_lock);
-			if (glfwGetCurrentContext() != window)
-				glfwMakeContextCurrent(window);
-			if (win->width != oldwidth || win->height != oldheight) {
-				oldwidth = win->width;
-				oldheight = win->height;
-				glViewport(0, 0, oldwidth, oldheight);
+			const lock_guard<mutex> lk(worker->lock);
+			// only stopped once it has no windows left
+			if (worker->stopping)
+				return;
+			opening.swap(worker->pending);
+		}
+		for (WindowState *state : opening) {
+			if (open_window(state))
+				worker->windows.push_back(state);
+			else
+				mark_closed(state);
+			wait_for_create[state->win]->release();
+		}
+		bool continuous = false;
+		double wake_at = INFINITY;
+		for (size_t i = 0; i < worker->windows.size();) {
+			WindowState *state = worker->windows[i];
+			if (glfwWindowShouldClose(state->win->window)) {
+				close_window(state);
+				worker->windows.erase(worker->windows.begin() + i);
+				continue;
+			}
+			// undamaged windows keep their last frame
+			const bool damaged = state->damaged.exchange(false);
+			if (damaged || state->continuous ||
+				state->wake_at <= glfwGetTime()) {
+				render_frame(state, damaged);
+				check_memory_budget(state->win);
 			}
-			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-			cel_render_rectangles(win);
-			glfwSwapBuffers(window);
-			glfwMakeContextCurrent(nullptr);
+			continuous = continuous || state->continuous;
+			wake_at = min(wake_at, state->wake_at);
+			i++;
 		}
-		if (!dont_sleep) {
-			glfwWaitEvents();
-			glfwPollEvents();
+		// sleep until a window is damaged or a pending animation starts
+		const double timeout = max(0.0, wake_at - glfwGetTime());
+		if (polls_events) {
+			if (continuous)
+				glfwPollEvents();
+			else if (wake_at < INFINITY)
+				glfwWaitEventsTimeout(timeout);
+			else
+				glfwWaitEvents();
+		} else if (!continuous) {
+			unique_lock<mutex> lk(worker->lock);
+			if (wake_at < INFINITY)
+				worker->wake.wait_for(lk, chrono::duration<double>(timeout),
+									  [worker] { return worker->woken; });
+			else
+				worker->wake.wait(lk, [worker] { return worker->woken; });
+			worker->woken = false;
 		}
 	}
-	glfwHideWindow(window);
-	glfwDestroyWindow(window);
 }
 
 CelWin *cel_create_window(const char *title, int width, int height) {
@@ -245,35 +569,129 @@ CelWin *cel_create_window(const char *title, int width, int height) {
 	res->name = title;
 	res->width = width;
 	res->height = height;
+	WindowState *state = new WindowState();
+	state->win = res;
   wait_for_create.insert({res, new std::binary_semaphore(0)});
-	assoc_threads.insert({res, new thread(window_routine, res)});
+	{
+		const lock_guard<mutex> lk(sched_lock);
+		window_states.insert({res, state});
+		if (render_thread_count > 0) {
+			if (workers.empty()) {
+				for (int i = 0; i < render_thread_count; i++)
+					workers.push_back(new RenderWorker());
+				for (int i = 0; i < render_thread_count; i++)
+					workers[i]->routine =
+						new thread(worker_routine, workers[i], i == 0);
+			}
+			state->worker = next_worker++ % workers.size();
+		}
+	}
+	if (state->worker >= 0) {
+		RenderWorker *worker = workers[state->worker];
+		{
+			const lock_guard<mutex> lk(worker->lock);
+			worker->pending.push_back(state);
+		}
+		if (state->worker == 0)
+			glfwPostEmptyEvent();
+		else
+			wake_worker(worker);
+	} else {
+		assoc_threads.insert({res, new thread(window_routine, state)});
+	}
   wait_for_create[res]->acquire();
   delete wait_for_create[res];
   wait_for_create.erase(res);
+	trace_create_window(res);
 	return res;
 }
+// stops and joins the render pool once its last window was destroyed, the
+// next window starts a new one
+static void stop_pool() {
+	vector<RenderWorker *> stopped;
+	{
+		const lock_guard<mutex> lk(sched_lock);
+		if (workers.empty())
+			return;
+		for (const auto &[win, state] : window_states)
+			if (state->worker >= 0)
+				return;
+		// a callback running on a worker can not join it
+		for (RenderWorker *worker : workers)
+			if (worker->routine->get_id() == this_thread::get_id())
+				return;
+		stopped.swap(workers);
+		next_worker = 0;
+	}
+	for (RenderWorker *worker : stopped) {
+		{
+			const lock_guard<mutex> lk(worker->lock);
+			worker->stopping = true;
+			worker->woken = true;
+		}
+		worker->wake.notify_one();
+	}
+	// the first worker waits for events
+	glfwPostEmptyEvent();
+	for (RenderWorker *worker : stopped) {
+		worker->routine->join();
+		delete worker->routine;
+		delete worker;
+	}
+}
+// blocks until the render thread closed the window
+static void wait_for_close(CelWin *win) {
+	WindowState *state;
+	{
+		const lock_guard<mutex> lk(sched_lock);
+		state = window_states[win];
+	}
+	unique_lock<mutex> lk(state->closed_lock);
+	state->closed_cv.wait(lk, [state] { return state->closed; });
+}
 void cel_wait_for_window(CelWin *win) {
-	assoc_threads[win]->join();
+	if (assoc_threads.contains(win))
+		assoc_threads[win]->join();
+	else
+		wait_for_close(win);
 }
 void cel_destroy_window(CelWin *win) {
-	glfwSetWindowShouldClose(win->window, 1);
-	glfwPostEmptyEvent();
-	assoc_threads[win]->join();
+	trace(TRACE_DESTROY_WINDOW, trace_id(win));
+	// the window is null if it could not be opened
+	if (win->window) {
+		glfwSetWindowShouldClose(win->window, 1);
+		damage(win, true);
+	}
+	if (assoc_threads.contains(win)) {
+		if (assoc_threads[win]->joinable())
+			assoc_threads[win]->join();
+		delete assoc_threads[win];
+		assoc_threads.erase(win);
+	} else {
+		wait_for_close(win);
+	}
 	assoc_wins.erase(win->window);
-	delete assoc_threads[win];
-	assoc_threads.erase(win);
+	{
+		const lock_guard<mutex> lk(sched_lock);
+		delete window_states[win];
+		window_states.erase(win);
+	}
 	scroll_callbacks.erase(win);
 	mouse_callbacks.erase(win);
 	cursor_callbacks.erase(win);
 	resize_callbacks.erase(win);
 	position_callbacks.erase(win);
 	focus_callbacks.erase(win);
+	trace_forget(win);
 	delete win;
+	stop_pool();
 }
 void cel_resize_window(CelWin *win, int x, int y) {
+	trace(TRACE_RESIZE_WINDOW, trace_id(win), x, y);
 	glfwSetWindowSize(win->window, x, y);
 }
 void cel_move_window(CelWin *win, int x, int y) {
+	trace(TRACE_MOVE_WINDOW, trace_id(win), x, y);
 	glfwSetWindowPos(win->window, x, y);
 }
 void cel_rename_window(CelWin *win, const char *title) {
@@ -0,0 +1,587 @@
+#include "glyphs.hpp"
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include "src/internal.hpp"
+#include "src/logger.hpp"
+#include "src/ubo.hpp"
+#define GLYPH_FILE_VERSION 1
+/**
+ * Start of a glyph cache file, a file whose header does not match the font
+ * and the field parameters is rebuilt
+ */
+struct GlyphFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t base_size;
+	uint32_t spread;
+	uint32_t reserved;
+	uint64_t font_hash;
+};
+/**
+ * Followed by the width x height bytes of the field, padded to 4 bytes
+ */
+struct GlyphRecord {
+	uint32_t codepoint;
+	GlyphMetrics metrics;
+};
+static std::mutex font_lock;
+static FT_Library library = nullptr;
+static std::string cache_dir;
+static bool cache_dir_set = false;
+static std::unordered_map<CelWin *, TextRenderer *> text_renderer;
+static std::string default_cache_dir() {
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	std::string res;
+	if (xdg && *xdg)
+		res = xdg;
+	else if (home && *home)
+		res = std::string(home) + "/.cache";
+	else
+		return "";
+	mkdir(res.c_str(), 0755);
+	return res + "/celerityui";
+}
+static uint64_t fnv1a(const std::vector<unsigned char> &data) {
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (unsigned char c : data) {
+		hash ^= c;
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+static size_t record_size(const GlyphRecord &record) {
+	const size_t pixels =
+		(size_t)record.metrics.width * (size_t)record.metrics.height;
+	return sizeof(GlyphRecord) + ((pixels + 3) & ~(size_t)3);
+}
+static GlyphFileHeader expected_header(const CelFont *font) {
+	GlyphFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "CELSDF", 6);
+	header.version = GLYPH_FILE_VERSION;
+	header.base_size = SDF_BASE_SIZE;
+	header.spread = SDF_SPREAD;
+	header.font_hash = font->hash;
+	return header;
+}
+static void remap(CelFont *font) {
+	if (font->mapped)
+		munmap((void *)font->mapped, font->mapped_size);
+	font->mapped = nullptr;
+	font->mapped_size = 0;
+	if (font->file_size == 0)
+		return;
+	void *res =
+		mmap(nullptr, font->file_size, PROT_READ, MAP_SHARED, font->fd, 0);
+	if (res == MAP_FAILED)
+		return;
+	font->mapped = (const char *)res;
+	font->mapped_size = font->file_size;
+}
+/**
+ * Opens or creates the cache file of the font and indexes its glyphs
+ */
+static void open_cache(CelFont *font, const std::string &dir) {
+	if (dir.empty())
+		return;
+	mkdir(dir.c_str(), 0755);
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.sdf",
+			 (unsigned long long)font->hash);
+	const std::string path = dir + name;
+	font->fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (font->fd < 0) {
+		CEL_LOG(WARNING, "Could not open the glyph cache \"{}\"!", path);
+		return;
+	}
+	// other processes using the same font append to the same file
+	flock(font->fd, LOCK_EX);
+	struct stat st;
+	fstat(font->fd, &st);
+	const GlyphFileHeader expected = expected_header(font);
+	GlyphFileHeader header;
+	if ((size_t)st.st_size < sizeof(header) ||
+		pread(font->fd, &header, sizeof(header), 0) != sizeof(header) ||
+		memcmp(&header, &expected, sizeof(header)) != 0) {
+		// other processes may have the file mapped and would crash reading
+		// behind its end if it shrank, so a new file replaces it
+		const std::string tmp = path + "." + std::to_string(getpid());
+		const int fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd >= 0)
+			flock(fd, LOCK_EX);
+		if (fd < 0 ||
+			pwrite(fd, &expected, sizeof(expected), 0) != sizeof(expected) ||
+			rename(tmp.c_str(), path.c_str()) != 0) {
+			if (fd >= 0) {
+				close(fd);
+				unlink(tmp.c_str());
+			}
+			flock(font->fd, LOCK_UN);
+			close(font->fd);
+			font->fd = -1;
+			return;
+		}
+		flock(font->fd, LOCK_UN);
+		close(font->fd);
+		font->fd = fd;
+		st.st_size = sizeof(expected);
+	}
+	font->file_size = st.st_size;
+	remap(font);
+	size_t offset = sizeof(GlyphFileHeader);
+	while (font->mapped && offset + sizeof(GlyphRecord) <= font->file_size) {
+		GlyphRecord record;
+		memcpy(&record, font->mapped + offset, sizeof(record));
+		if (record.metrics.width < 0 || record.metrics.height < 0 ||
+			offset + record_size(record) > font->file_size)
+			break;
+		font->index[record.codepoint] = offset;
+		offset += record_size(record);
+	}
+	// a record cut off by a crash ends the file
+	if (offset < font->file_size && ftruncate(font->fd, offset) == 0) {
+		font->file_size = offset;
+		remap(font);
+	}
+	flock(font->fd, LOCK_UN);
+	CEL_LOG(VERBOSE, "Loaded {} cached glyphs from \"{}\"", font->index.size(),
+		path);
+}
+static bool read_record(CelFont *font, size_t offset, GlyphMetrics &metrics,
+						std::vector<uint8_t> &pixels) {
+	if (offset + sizeof(GlyphRecord) > font->mapped_size)
+		remap(font);
+	if (!font->mapped || offset + sizeof(GlyphRecord) > font->mapped_size)
+		return false;
+	GlyphRecord record;
+	memcpy(&record, font->mapped + offset, sizeof(record));
+	if (offset + record_size(record) > font->mapped_size)
+		return false;
+	metrics = record.metrics;
+	const uint8_t *src =
+		(const uint8_t *)font->mapped + offset + sizeof(GlyphRecord);
+	pixels.assign(src, src + (size_t)metrics.width * metrics.height);
+	return true;
+}
+static void append_record(CelFont *font, uint32_t codepoint,
+						  const GlyphMetrics &metrics,
+						  const std::vector<uint8_t> &pixels) {
+	if (font->fd < 0)
+		return;
+	const GlyphRecord record{codepoint, metrics};
+	std::vector<char> buffer(record_size(record), 0);
+	memcpy(buffer.data(), &record, sizeof(record));
+	memcpy(buffer.data() + sizeof(record), pixels.data(), pixels.size());
+	flock(font->fd, LOCK_EX);
+	// the file may have grown by other processes, their glyphs are indexed
+	// on the next start
+	struct stat st;
+	fstat(font->fd, &st);
+	if (pwrite(font->fd, buffer.data(), buffer.size(), st.st_size) ==
+		(ssize_t)buffer.size()) {
+		font->index[codepoint] = st.st_size;
+		font->file_size = st.st_size + buffer.size();
+	}
+	flock(font->fd, LOCK_UN);
+}
+/**
+ * Squared euclidean distance transform of one row or column (Felzenszwalb and
+ * Huttenlocher), f holds 0 for feature pixels and a large value elsewhere
+ */
+static void edt(float *f, int n, int stride, std::vector<float> &d,
+				std::vector<int> &v, std::vector<float> &z) {
+	v[0] = 0;
+	z[0] = -1e20f;
+	z[1] = 1e20f;
+	int k = 0;
+	for (int q = 1; q < n; q++) {
+		float s;
+		while (true) {
+			const int p = v[k];
+			s = ((f[q * stride] + q * q) - (f[p * stride] + p * p)) /
+				(2.0f * (q - p));
+			if (s > z[k])
+				break;
+			k--;
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = 1e20f;
+	}
+	k = 0;
+	for (int q = 0; q < n; q++) {
+		while (z[k + 1] < q)
+			k++;
+		const float dq = q - v[k];
+		d[q] = dq * dq + f[v[k] * stride];
+	}
+	for (int q = 0; q < n; q++)
+		f[q * stride] = d[q];
+}
+static void edt(std::vector<float> &grid, int width, int height) {
+	const int n = std::max(width, height);
+	std::vector<float> d(n), z(n + 1);
+	std::vector<int> v(n);
+	for (int x = 0; x < width; x++)
+		edt(grid.data() + x, height, width, d, v, z);
+	for (int y = 0; y < height; y++)
+		edt(grid.data() + y * width, width, 1, d, v, z);
+}
+/**
+ * Renders the coverage of the glyph at the base size and converts it to a
+ * signed distance field
+ */
+static void rasterize(CelFont *font, uint32_t codepoint, GlyphMetrics &metrics,
+					  std::vector<uint8_t> &pixels) {
+	metrics = {0, 0, 0, 0, 0};
+	pixels.clear();
+	if (FT_Load_Char(font->face, codepoint, FT_LOAD_RENDER))
+		return;
+	const FT_GlyphSlot slot = font->face->glyph;
+	const FT_Bitmap &bitmap = slot->bitmap;
+	metrics.advance = slot->advance.x / 64.0f;
+	if (bitmap.width == 0 || bitmap.rows == 0 ||
+		bitmap.pixel_mode != FT_PIXEL_MODE_GRAY)
+		return;
+	const int width = bitmap.width + 2 * SDF_SPREAD;
+	const int height = bitmap.rows + 2 * SDF_SPREAD;
+	metrics.width = width;
+	metrics.height = height;
+	metrics.bearing_x = slot->bitmap_left - SDF_SPREAD;
+	metrics.bearing_y = slot->bitmap_top + SDF_SPREAD;
+	std::vector<bool> inside(width * height, false);
+	for (unsigned y = 0; y < bitmap.rows; y++)
+		for (unsigned x = 0; x < bitmap.width; x++)
+			inside[(y + SDF_SPREAD) * width + x + SDF_SPREAD] =
+				bitmap.buffer[y * bitmap.pitch + x] >= 128;
+	std::vector<float> to_inside(width * height), to_outside(width * height);
+	for (int i = 0; i < width * height; i++) {
+		to_inside[i] = inside[i] ? 0 : 1e20f;
+		to_outside[i] = inside[i] ? 1e20f : 0;
+	}
+	edt(to_inside, width, height);
+	edt(to_outside, width, height);
+	pixels.resize(width * height);
+	for (int i = 0; i < width * height; i++) {
+		// distances are measured between pixel centers, the outline lies
+		// half a pixel between them
+		const float dist = inside[i] ? std::sqrt(to_outside[i]) - 0.5f
+									 : 0.5f - std::sqrt(to_inside[i]);
+		pixels[i] = (uint8_t)std::clamp(
+			128.0f + dist * 127.0f / SDF_SPREAD + 0.5f, 0.0f, 255.0f);
+	}
+}
+void glyph_sdf(CelFont *font, uint32_t codepoint, GlyphMetrics &metrics,
+			   std::vector<uint8_t> &pixels) {
+	const std::lock_guard<std::mutex> lk(font->lock);
+	auto it = font->index.find(codepoint);
+	if (it != font->index.end() &&
+		read_record(font, it->second, metrics, pixels))
+		return;
+	rasterize(font, codepoint, metrics, pixels);
+	append_record(font, codepoint, metrics, pixels);
+}
+GlyphCache::GlyphCache() : atlas(GL_R8, GL_RED, 1024, 16) {
+	atlas.on_evict = [this](TextureAtlas::handle h) {
+		auto it = owner.find(h);
+		if (it == owner.end())
+			return;
+		glyphs.erase(it->second);
+		owner.erase(it);
+		evictions++;
+	};
+}
+const GlyphCache::Glyph *GlyphCache::get(CelFont *font, uint32_t codepoint) {
+	const Key key{font, codepoint};
+	auto it = glyphs.find(key);
+	if (it != glyphs.end()) {
+		if (it->second.handle != TextureAtlas::invalid)
+			atlas.touch(it->second.handle);
+		return &it->second;
+	}
+	Glyph glyph{{}, TextureAtlas::invalid};
+	std::vector<uint8_t> pixels;
+	glyph_sdf(font, codepoint, glyph.metrics, pixels);
+	if (glyph.metrics.width > 0 && glyph.metrics.height > 0) {
+		glyph.handle =
+			atlas.insert(glyph.metrics.width, glyph.metrics.height,
+						 pixels.data());
+		if (glyph.handle == TextureAtlas::invalid) {
+			CEL_LOG(WARNING, "Glyph {} does not fit into the glyph cache budget!",
+				codepoint);
+			// not cached, so it is tried again the next time it is used
+			unplaced = glyph;
+			return &unplaced;
+		}
+		owner[glyph.handle] = key;
+	}
+	return &glyphs.insert({key, glyph}).first->second;
+}
+void GlyphCache::set_budget(size_t bytes) {
+	const size_t page = (size_t)atlas.get_page_size() * atlas.get_page_size();
+	atlas.set_max_pages(std::max<size_t>(1, bytes / page));
+}
+static std::u32string decode_utf8(const char *str) {
+	std::u32string res;
+	const unsigned char *s = (const unsigned char *)str;
+	while (*s) {
+		uint32_t c = *s++;
+		int extra = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : 0;
+		if (extra)
+			c &= 0x3f >> extra;
+		for (; extra > 0 && (*s & 0xc0) == 0x80; extra--)
+			c = c << 6 | (*s++ & 0x3f);
+		res.push_back(extra ? 0xfffd : c);
+	}
+	return res;
+}
+TextRenderer::TextRenderer() {
+	ShaderProgram &program = batch.get_program();
+	program.bind_uniform_block("Frame", FRAME_UBO_BINDING);
+	program.start();
+	program.load("atlas", 0);
+	program.stop();
+}
+void TextRenderer::build(CelText *text) {
+	for (auto h : text->instances)
+		batch.remove(h);
+	text->instances.clear();
+	text->dirty = false;
+	const float scale = text->size / SDF_BASE_SIZE;
+	const CelColorRGBA &c = text->color;
+	const int group = batch_group(text->layer, true);
+	float pen_x = 0, pen_y = 0;
+	for (char32_t codepoint : text->text) {
+		if (codepoint == '\n') {
+			pen_x = 0;
+			pen_y += text->font->line_height * scale;
+			continue;
+		}
+		const GlyphCache::Glyph *glyph = glyphs.get(text->font, codepoint);
+		const GlyphMetrics &m = glyph->metrics;
+		if (glyph->handle != TextureAtlas::invalid) {
+			const AtlasRegion region = glyphs.region(glyph);
+			GlyphInstance instance = {
+				{text->x, text->y},
+				{pen_x + m.bearing_x * scale, pen_y - m.bearing_y * scale},
+				{m.width * scale, m.height * scale},
+				{region.uv[0], region.uv[1], region.uv[2], region.uv[3]},
+				region.layer,
+				{(uint8_t)(c.r * 255), (uint8_t)(c.g * 255),
+				 (uint8_t)(c.b * 255), (uint8_t)(c.a * 255)}};
+			text->instances.push_back(batch.add(instance, group));
+		}
+		pen_x += m.advance * scale;
+	}
+}
+void TextRenderer::remove(CelText *text) {
+	for (auto h : text->instances)
+		batch.remove(h);
+	text->instances.clear();
+	texts.erase(text);
+}
+void TextRenderer::enqueue(RenderQueue &queue) {
+	glyphs.next_frame();
+	// the glyphs of unchanged texts are marked used first, so building the
+	// changed texts only evicts glyphs no text shows
+	for (CelText *text : texts)
+		if (!text->dirty)
+			for (char32_t codepoint : text->text)
+				if (codepoint != '\n')
+					glyphs.get(text->font, codepoint);
+	for (CelText *text : texts)
+		if (text->dirty)
+			build(text);
+	// evicted or moved glyphs change the regions of other texts
+	if (glyphs.get_generation() != generation) {
+		generation = glyphs.get_generation();
+		for (CelText *text : texts)
+			build(text);
+	}
+	batch.enqueue(queue, 0, glyphs.get_texture(), GL_TEXTURE_2D_ARRAY);
+}
+void TextRenderer::clean_up() {
+	glyphs.clean_up();
+	batch.clean_up();
+}
+void enqueue_texts(CelWin *win, RenderQueue &queue) {
+	auto it = text_renderer.find(win);
+	if (it != text_renderer.end())
+		it->second->enqueue(queue);
+}
+void destroy_texts(CelWin *win) {
+	auto it = text_renderer.find(win);
+	if (it == text_renderer.end())
+		return;
+	it->second->clean_up();
+	delete it->second;
+	text_renderer.erase(it);
+}
+void cel_set_glyph_cache_dir(const char *path) {
+	const std::lock_guard<std::mutex> lk(font_lock);
+	cache_dir = path ? path : "";
+	cache_dir_set = true;
+}
+CelFont *cel_load_font(const char *path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		CEL_LOG(WARNING, "Could not open font \"{}\"!", path);
+		return nullptr;
+	}
+	CelFont *font = new CelFont();
+	font->data.assign(std::istreambuf_iterator<char>(file), {});
+	std::string dir;
+	{
+		const std::lock_guard<std::mutex> lk(font_lock);
+		if (!library && FT_Init_FreeType(&library)) {
+			library = nullptr;
+			CEL_LOG(WARNING, "Could not initialize FreeType!");
+			delete font;
+			return nullptr;
+		}
+		if (FT_New_Memory_Face(library, font->data.data(), font->data.size(),
+							   0, &font->face)) {
+			CEL_LOG(WARNING, "Could not load font \"{}\"!", path);
+			delete font;
+			return nullptr;
+		}
+		if (!cache_dir_set) {
+			cache_dir = default_cache_dir();
+			cache_dir_set = true;
+		}
+		dir = cache_dir;
+	}
+	FT_Set_Pixel_Sizes(font->face, 0, SDF_BASE_SIZE);
+	font->line_height = font->face->size->metrics.height / 64.0f;
+	font->hash = fnv1a(font->data);
+	open_cache(font, dir);
+	return font;
+}
+void cel_delete_font(CelFont *font) {
+	if (font->mapped)
+		munmap((void *)font->mapped, font->mapped_size);
+	if (font->fd >= 0)
+		close(font->fd);
+	{
+		const std::lock_guard<std::mutex> lk(font_lock);
+		FT_Done_Face(font->face);
+	}
+	delete font;
+}
+CelText *cel_create_text(CelWin *win, CelFont *font, const char *utf8,
+						 float x, float y, float size, CelColorRGBA color) {
+	CelText *text = new CelText();
+	text->origin = win;
+	text->font = font;
+	text->text = decode_utf8(utf8);
+	text->x = x;
+	text->y = y;
+	text->size = size;
+	text->color = color;
+	{
+		using namespace std;
+		const lock_guard<mutex> lk(Internal::gl_lock);
+		Internal::damage(win);
+		glfwMakeContextCurrent(win->window);
+		if (!text_renderer.contains(win))
+			text_renderer.insert({win, new TextRenderer()});
+		text_renderer[win]->add(text);
+		glfwMakeContextCurrent(nullptr);
+	}
+	return text;
+}
+void cel_delete_text(CelWin *win, CelText *text) {
+	{
+		using namespace std;
+		const lock_guard<mutex> lk(Internal::gl_lock);
+		Internal::damage(win);
+		text_renderer[win]->remove(text);
+	}
+	delete text;
+}
+void cel_text_set_string(CelText *text, const char *utf8) {
+	const std::lock_guard<std::mutex> lk(Internal::gl_lock);
+	Internal::damage(text->origin);
+	text->text = decode_utf8(utf8);
+	text->dirty = true;
+}
+void cel_text_set_position(CelText *text, float x, float y) {
+	const std::lock_guard<std::mutex> lk(Internal::gl_lock);
+	Internal::damage(text->origin);
+	text->x = x;
+	text->y = y;
+	text->dirty = true;
+}
+void cel_text_set_style(CelText *text, float size, CelColorRGBA color) {
+	const std::lock_guard<std::mutex> lk(Internal::gl_lock);
+	Internal::damage(text->origin);
+	text->size = size;
+	text->color = color;
+	text->dirty = true;
+}
+void cel_text_set_layer(CelText *text, int layer) {
+	const std::lock_guard<std::mutex> lk(Internal::gl_lock);
+	Internal::damage(text->origin);
+	text->layer = layer;
+	text->dirty = true;
+}
+void cel_set_glyph_cache_budget(CelWin *win, size_t bytes) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(win);
+	glfwMakeContextCurrent(win->window);
+	if (!text_renderer.contains(win))
+		text_renderer.insert({win, new TextRenderer()});
+	text_renderer[win]->set_budget(bytes);
+	glfwMakeContextCurrent(nullptr);
+}
+const std::string primitive_traits<GlyphInstance>::vertex_src = R"(
+#version 400
+)" FRAME_UBO_GLSL R"(
+layout (location = 0) in vec2 pos;
+layout (location = 1) in vec2 origin;
+layout (location = 2) in vec2 offset;
+layout (location = 3) in vec2 size;
+layout (location = 4) in vec4 region;
+layout (location = 5) in uint layer;
+layout (location = 6) in vec4 color;
+out vec3 uv;
+out vec4 tint;
+void main() {
+  // offsets are in pixels with y pointing down, the quad spans (0,0)-(1,-1)
+  vec2 corner = offset + vec2(pos.x, -pos.y) * size;
+  uv = vec3(mix(region.xy, region.zw, vec2(pos.x, -pos.y)), layer);
+  tint = color;
+  gl_Position =
+      view * vec4(origin + corner * vec2(2, -2) / window_size, 0.0, 1.0);
+}
+)";
+const std::string primitive_traits<GlyphInstance>::fragment_src = R"(
+#version 400
+uniform sampler2DArray atlas;
+in vec3 uv;
+in vec4 tint;
+out vec4 final_color;
+void main() {
+  // the field is scaled to any size, the edge is smoothed over one pixel of
+  // the screen
+  float dist = texture(atlas, uv).r;
+  float w = fwidth(dist);
+  float coverage = smoothstep(0.5 - w, 0.5 + w, dist);
+  if (coverage <= 0)
+    discard;
+  final_color = vec4(tint.rgb, tint.a * coverage);
+}
+)";
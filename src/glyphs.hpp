@@ -0,0 +1,178 @@
+#ifndef GLYPHS_HPP
+#define GLYPHS_HPP
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "atlas.hpp"
+#include "batch.hpp"
+#include "celerityui.h"
+#include "render_queue.hpp"
+#include <ft2build.h>
+#include FT_FREETYPE_H
+// glyphs are rasterized once at this em size in pixels and scaled to any size
+#define SDF_BASE_SIZE 48
+// distance in pixels of the base size that the field covers around the outline
+#define SDF_SPREAD 6
+/**
+ * Metrics of a glyph in pixels of the base size. The bitmap includes the
+ * spread of the distance field on every side.
+ */
+struct GlyphMetrics {
+	int16_t width, height;
+	// offset of the top left corner of the bitmap from the pen position
+	int16_t bearing_x, bearing_y;
+	float advance;
+};
+/**
+ * A glyph of a text, drawn from the distance field in the glyph atlas of the
+ * window. The quad is placed in pixels relative to the origin of the text, so
+ * resizing the window does not change the instances.
+ */
+struct GlyphInstance {
+	float origin[2];
+	float offset[2];
+	float size[2];
+	float uv[4];
+	uint32_t layer;
+	uint8_t color[4];
+};
+template <>
+struct primitive_traits<GlyphInstance> {
+	using layout = VertexLayout<GlyphInstance,
+								CEL_ATTRIB(GlyphInstance, origin, false),
+								CEL_ATTRIB(GlyphInstance, offset, false),
+								CEL_ATTRIB(GlyphInstance, size, false),
+								CEL_ATTRIB(GlyphInstance, uv, false),
+								CEL_ATTRIB(GlyphInstance, layer, false),
+								CEL_ATTRIB(GlyphInstance, color, true)>;
+	static const std::string vertex_src;
+	static const std::string fragment_src;
+};
+/**
+ * A font shared by all windows. Generated distance fields are appended to a
+ * cache file named after the hash of the font file, which is memory mapped
+ * when the font is loaded again, so glyphs are only rasterized once.
+ */
+struct CelFont {
+	FT_Face face;
+	std::vector<unsigned char> data;
+	uint64_t hash;
+	// distance between baselines in pixels of the base size
+	float line_height;
+	// guards the face and the cache file, fonts are used by every render
+	// thread
+	std::mutex lock;
+	int fd = -1;
+	const char *mapped = nullptr;
+	size_t mapped_size = 0, file_size = 0;
+	// offset of the record of every cached glyph in the file
+	std::unordered_map<uint32_t, size_t> index;
+};
+/**
+ * Returns the distance field of a glyph, from the cache file if it was
+ * generated before
+ * @param pixels receives width x height bytes, 128 is the outline
+ */
+void glyph_sdf(CelFont *font, uint32_t codepoint, GlyphMetrics &metrics,
+			   std::vector<uint8_t> &pixels);
+/**
+ * The glyphs resident in the atlas of one window. The atlas is limited by a
+ * byte budget, glyphs that were not used for the longest time are evicted
+ * first.
+ */
+class GlyphCache {
+   public:
+	struct Glyph {
+		GlyphMetrics metrics;
+		// invalid for glyphs without a bitmap (e.g. spaces) or that did not
+		// fit into the budget
+		TextureAtlas::handle handle;
+	};
+
+   private:
+	struct Key {
+		CelFont *font;
+		uint32_t codepoint;
+		bool operator==(const Key &o) const {
+			return font == o.font && codepoint == o.codepoint;
+		}
+	};
+	struct KeyHash {
+		size_t operator()(const Key &k) const {
+			return std::hash<const void *>()(k.font) ^
+				   (std::hash<uint32_t>()(k.codepoint) * 0x9e3779b97f4a7c15ull);
+		}
+	};
+	TextureAtlas atlas;
+	std::unordered_map<Key, Glyph, KeyHash> glyphs;
+	std::unordered_map<TextureAtlas::handle, Key> owner;
+	// returned for a glyph that does not fit into the budget
+	Glyph unplaced;
+	uint32_t evictions = 0;
+
+   public:
+	GlyphCache();
+	/**
+	 * Returns the glyph and marks it used in this frame, it is generated and
+	 * uploaded if it is not resident
+	 * @return a glyph without handle that is only valid until the next call if
+	 * the glyph does not fit into the budget, texts still advance by its
+	 * metrics
+	 */
+	const Glyph *get(CelFont *font, uint32_t codepoint);
+	AtlasRegion region(const Glyph *glyph) const {
+		return atlas.region(glyph->handle);
+	}
+	void set_budget(size_t bytes);
+	void next_frame() { atlas.next_frame(); }
+	GLuint get_texture() const { return atlas.get_texture(); }
+	/**
+	 * Changes whenever regions of resident glyphs moved or glyphs were
+	 * evicted
+	 */
+	uint64_t get_generation() const {
+		return (uint64_t)atlas.get_generation() << 32 | evictions;
+	}
+	void clean_up() { atlas.clean_up(); }
+};
+struct CelText {
+	CelWin *origin;
+	CelFont *font;
+	std::u32string text;
+	float x, y, size;
+	CelColorRGBA color;
+	int layer = 0;
+	std::vector<BatchRenderer<GlyphInstance>::handle> instances;
+	bool dirty = true;
+};
+class TextRenderer {
+	GlyphCache glyphs;
+	BatchRenderer<GlyphInstance> batch;
+	std::unordered_set<CelText *> texts;
+	uint64_t generation = 0;
+	void build(CelText *text);
+
+   public:
+	TextRenderer();
+	void add(CelText *text) { texts.insert(text); }
+	void remove(CelText *text);
+	void set_budget(size_t bytes) { glyphs.set_budget(bytes); }
+	void enqueue(RenderQueue &queue);
+	/**
+	 * Replaces Destructor, cleans up all OpenGL related data.
+	 */
+	void clean_up();
+};
+/**
+ * Adds the texts of the window to the render queue of the frame
+ */
+void enqueue_texts(CelWin *win, RenderQueue &queue);
+/**
+ * Releases the texts and the glyph atlas of a window before it is destroyed, its context has to
+ * be current
+ */
+void destroy_texts(CelWin *win);
+#endif
@@ -0,0 +1,510 @@
+#include "images.hpp"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "src/internal.hpp"
+#include "src/logger.hpp"
+#include "src/memory.hpp"
+#include "src/ubo.hpp"
+// pixel buffer memory of one upload chunk, three chunks are in flight
+#define IMAGE_UPLOAD_CHUNK (4 * 1024 * 1024)
+// images up to this width and height are packed into the atlas of the window
+#define IMAGE_ATLAS_MAX 256
+#define IMAGE_ATLAS_PAGE 1024
+#define IMAGE_ATLAS_PAGES 8
+// images packed per frame, the others wait for the next frames
+#define IMAGE_ATLAS_PACKS_PER_FRAME 16
+static std::unordered_map<CelWin *, ImageRenderer *> image_renderer;
+// changes of image_renderer hold this and the gl_lock, the decode threads
+// only this one
+static std::mutex renderers_lock;
+static std::atomic<uint64_t> next_image_id = 0;
+static std::atomic<CelImageDecoder> user_decoder = nullptr;
+static int read_ppm_number(FILE *file) {
+	int c = fgetc(file);
+	while (c != EOF && (isspace(c) || c == '#')) {
+		if (c == '#')
+			while (c != EOF && c != '\n')
+				c = fgetc(file);
+		c = fgetc(file);
+	}
+	int res = 0;
+	bool any = false;
+	while (c != EOF && isdigit(c)) {
+		res = res * 10 + (c - '0');
+		any = true;
+		c = fgetc(file);
+	}
+	// exactly one whitespace separates the header from the pixels, it was
+	// consumed above
+	return any ? res : -1;
+}
+/**
+ * Built-in decoder for binary PPM (P6) files with 8 bit channels
+ */
+static unsigned char *decode_ppm(const char *path, int *width, int *height) {
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return nullptr;
+	unsigned char *res = nullptr;
+	char magic[2];
+	if (fread(magic, 1, 2, file) == 2 && magic[0] == 'P' && magic[1] == '6') {
+		const int w = read_ppm_number(file);
+		const int h = read_ppm_number(file);
+		const int maxval = read_ppm_number(file);
+		if (w > 0 && h > 0 && maxval == 255) {
+			const size_t pixels = (size_t)w * h;
+			std::vector<unsigned char> rgb(pixels * 3);
+			res = (unsigned char *)malloc(pixels * 4);
+			if (res && fread(rgb.data(), 1, rgb.size(), file) == rgb.size()) {
+				for (size_t i = 0; i < pixels; i++) {
+					res[i * 4 + 0] = rgb[i * 3 + 0];
+					res[i * 4 + 1] = rgb[i * 3 + 1];
+					res[i * 4 + 2] = rgb[i * 3 + 2];
+					res[i * 4 + 3] = 255;
+				}
+				*width = w;
+				*height = h;
+			} else {
+				free(res);
+				res = nullptr;
+			}
+		}
+	}
+	fclose(file);
+	return res;
+}
+/**
+ * Threads shared by all windows that decode the queued images and hand them
+ * to the uploader of their window
+ */
+struct DecodePool {
+	std::mutex lock;
+	std::condition_variable wake;
+	std::deque<ImageJob> jobs;
+	bool started = false;
+};
+static DecodePool decode_pool;
+static void decode_routine() {
+	using namespace std;
+	while (true) {
+		ImageJob job;
+		{
+			unique_lock<mutex> lk(decode_pool.lock);
+			decode_pool.wake.wait(lk, [] { return !decode_pool.jobs.empty(); });
+			job = std::move(decode_pool.jobs.front());
+			decode_pool.jobs.pop_front();
+		}
+		CelImageDecoder decoder = user_decoder.load();
+		job.pixels = decoder ? decoder(job.path.c_str(), &job.width, &job.height)
+							 : decode_ppm(job.path.c_str(), &job.width,
+										  &job.height);
+		if (!job.pixels)
+			CEL_LOG(WARNING, "Could not decode image \"{}\"!", job.path);
+		CelWin *win = job.win;
+		{
+			const lock_guard<mutex> lk(renderers_lock);
+			auto it = image_renderer.find(win);
+			if (it == image_renderer.end()) {
+				// the window was closed while the image was decoded
+				free(job.pixels);
+				continue;
+			}
+			ImageRenderer *target = it->second;
+			if (!job.pixels)
+				target->finish(job.id, 0);
+			else if (job.width <= IMAGE_ATLAS_MAX &&
+					 job.height <= IMAGE_ATLAS_MAX)
+				target->finish(std::move(job));
+			else
+				target->get_uploader()->push(std::move(job));
+			// the window is only destroyed after its renderer was removed
+			Internal::damage(win);
+		}
+	}
+}
+// drops the queued jobs of a closed window
+static void cancel_decoding(CelWin *win) {
+	using namespace std;
+	const lock_guard<mutex> lk(decode_pool.lock);
+	erase_if(decode_pool.jobs,
+			 [win](const ImageJob &job) { return job.win == win; });
+}
+static void decode(ImageJob job) {
+	using namespace std;
+	{
+		const lock_guard<mutex> lk(decode_pool.lock);
+		if (!decode_pool.started) {
+			decode_pool.started = true;
+			// decoding is bound by the CPU, the render threads keep one core
+			const unsigned cores = thread::hardware_concurrency();
+			const unsigned count = cores > 1 ? cores - 1 : 1;
+			for (unsigned i = 0; i < count; i++)
+				thread(decode_routine).detach();
+		}
+		decode_pool.jobs.push_back(std::move(job));
+	}
+	decode_pool.wake.notify_one();
+}
+ImageUploader::ImageUploader(CelWin *win, ImageRenderer *target)
+	: win(win), target(target) {
+	// created by the render thread together with the window
+	context = Internal::upload_context(win);
+	if (!context)
+		CEL_LOG(ERROR, "The window has no upload context!");
+	routine = new std::thread(&ImageUploader::run, this);
+}
+void ImageUploader::push(ImageJob job) {
+	{
+		const std::lock_guard<std::mutex> lk(lock);
+		jobs.push_back(std::move(job));
+	}
+	wake.notify_one();
+}
+void ImageUploader::run() {
+	using namespace std;
+	glfwMakeContextCurrent(context);
+	pbo = new RingBuffer(GL_PIXEL_UNPACK_BUFFER, IMAGE_UPLOAD_CHUNK);
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	while (true) {
+		ImageJob job;
+		{
+			unique_lock<mutex> lk(lock);
+			wake.wait(lk, [this] { return !running || !jobs.empty(); });
+			if (!running)
+				break;
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		const GLuint texture = upload(job);
+		free(job.pixels);
+		target->finish(job.id, texture);
+		Internal::damage(win);
+	}
+	pbo->clean_up();
+	delete pbo;
+	pbo = nullptr;
+	glfwMakeContextCurrent(nullptr);
+}
+GLuint ImageUploader::upload(const ImageJob &job) {
+	if (job.width > max_size || job.height > max_size) {
+		CEL_LOG(WARNING, "Image \"{}\" exceeds the maximum texture size of {}!",
+			job.path, max_size);
+		return 0;
+	}
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+					GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, job.width, job.height, 0,
+				 GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	// the mipmap chain adds a third of the base level
+	track_memory(CEL_MEMORY_TEXTURES, texture,
+				 (size_t)job.width * job.height * 4 * 4 / 3);
+	// the rows are streamed in chunks through the pixel buffer ring, the
+	// driver copies each chunk asynchronously while the next one is written
+	const size_t row = (size_t)job.width * 4;
+	const int rows = std::max<size_t>(1, pbo->get_region_size() / row);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->get_id());
+	for (int y = 0; y < job.height; y += rows) {
+		const int count = std::min(rows, job.height - y);
+		char *dst = pbo->begin_region();
+		memcpy(dst, job.pixels + y * row, count * row);
+		pbo->flush(count * row);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->get_id());
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, job.width, count, GL_RGBA,
+						GL_UNSIGNED_BYTE, (void *)pbo->region_offset());
+		pbo->end_region();
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	// the texture may only be used by the window once the commands of this
+	// context completed
+	GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+	GLenum res = glClientWaitSync(fence, 0, 0);
+	while (res != GL_ALREADY_SIGNALED && res != GL_CONDITION_SATISFIED &&
+		   res != GL_WAIT_FAILED)
+		res = glClientWaitSync(fence, 0, 1000000);
+	glDeleteSync(fence);
+	return texture;
+}
+void ImageUploader::stop() {
+	{
+		const std::lock_guard<std::mutex> lk(lock);
+		running = false;
+		for (ImageJob &job : jobs)
+			free(job.pixels);
+		jobs.clear();
+	}
+	wake.notify_one();
+	routine->join();
+	delete routine;
+	routine = nullptr;
+	context = nullptr;
+}
+static ImageInstance to_instance(const CelImage *image, bool ready) {
+	const CelColorRGBA &p = image->placeholder;
+	return {{image->x, image->y},
+			{image->width, image->height},
+			{(uint8_t)(p.r * 255), (uint8_t)(p.g * 255), (uint8_t)(p.b * 255),
+			 (uint8_t)(p.a * 255)},
+			ready ? 1u : 0u};
+}
+static AtlasQuadInstance to_quad(const CelImage *image,
+								 const AtlasRegion &region) {
+	return {{image->x, image->y},
+			{image->width, image->height},
+			{region.uv[0], region.uv[1], region.uv[2], region.uv[3]},
+			region.layer,
+			{255, 255, 255, 255}};
+}
+ImageRenderer::ImageRenderer(CelWin *win) : win(win) {
+	ShaderProgram &program = batch.get_program();
+	program.bind_uniform_block("Frame", FRAME_UBO_BINDING);
+	program.start();
+	program.load("image", 0);
+	program.stop();
+	ShaderProgram &quad_program = quads.get_program();
+	quad_program.bind_uniform_block("Frame", FRAME_UBO_BINDING);
+	quad_program.start();
+	quad_program.load("atlas", 0);
+	quad_program.stop();
+	uploader = new ImageUploader(win, this);
+}
+uint64_t ImageRenderer::add(CelImage *image) {
+	const uint64_t id = next_image_id++;
+	images.insert({image, {id, batch.add(to_instance(image, false))}});
+	by_id.insert({id, image});
+	return id;
+}
+void ImageRenderer::remove(CelImage *image) {
+	auto it = images.find(image);
+	if (it == images.end())
+		return;
+	if (it->second.texture) {
+		glDeleteTextures(1, &it->second.texture);
+		untrack_memory(CEL_MEMORY_TEXTURES, it->second.texture);
+	}
+	if (it->second.region != TextureAtlas::invalid) {
+		atlas->remove(it->second.region);
+		quads.remove(it->second.quad);
+	} else {
+		batch.remove(it->second.handle);
+	}
+	by_id.erase(it->second.id);
+	images.erase(it);
+}
+void ImageRenderer::finish(uint64_t id, GLuint texture) {
+	const std::lock_guard<std::mutex> lk(finished_lock);
+	finished.push_back({id, texture});
+}
+void ImageRenderer::finish(ImageJob job) {
+	const std::lock_guard<std::mutex> lk(finished_lock);
+	decoded.push_back(std::move(job));
+}
+void ImageRenderer::pack(ImageJob job) {
+	auto it = by_id.find(job.id);
+	// the image was deleted while it was decoded
+	if (it == by_id.end()) {
+		free(job.pixels);
+		return;
+	}
+	CelImage *image = it->second;
+	Entry &entry = images[image];
+	if (!atlas)
+		atlas = new TextureAtlas(GL_RGBA8, GL_RGBA, IMAGE_ATLAS_PAGE,
+								 IMAGE_ATLAS_PAGES);
+	// all packed images were touched this frame, so none of them is evicted
+	entry.region = atlas->insert(job.width, job.height, job.pixels);
+	if (entry.region == TextureAtlas::invalid) {
+		// streamed into a texture of its own like large images
+		uploader->push(std::move(job));
+		return;
+	}
+	free(job.pixels);
+	batch.remove(entry.handle);
+	entry.quad = quads.add(to_quad(image, atlas->region(entry.region)),
+						   batch_group(image->layer, true));
+	image->ready = true;
+}
+void ImageRenderer::enqueue(RenderQueue &queue) {
+	if (atlas) {
+		atlas->next_frame();
+		for (const auto &[image, entry] : images)
+			if (entry.region != TextureAtlas::invalid)
+				atlas->touch(entry.region);
+	}
+	std::vector<ImageJob> packing;
+	bool pending;
+	{
+		const std::lock_guard<std::mutex> lk(finished_lock);
+		// a burst of decoded images is spread over several frames
+		while (!decoded.empty() &&
+			   packing.size() < IMAGE_ATLAS_PACKS_PER_FRAME) {
+			packing.push_back(std::move(decoded.front()));
+			decoded.pop_front();
+		}
+		pending = !decoded.empty();
+		for (const auto &[id, texture] : finished) {
+			auto it = by_id.find(id);
+			if (it == by_id.end()) {
+				// the image was deleted while it was loaded
+				if (texture) {
+					glDeleteTextures(1, &texture);
+					untrack_memory(CEL_MEMORY_TEXTURES, texture);
+				}
+				continue;
+			}
+			CelImage *image = it->second;
+			images[image].texture = texture;
+			image->ready = texture != 0;
+			image->failed = texture == 0;
+		}
+		finished.clear();
+	}
+	for (ImageJob &job : packing)
+		pack(std::move(job));
+	if (pending)
+		Internal::damage(win);
+	for (const auto &[image, entry] : images) {
+		if (entry.region != TextureAtlas::invalid) {
+			// the regions move whenever the atlas grows or is defragmented
+			quads.set(entry.quad,
+					  to_quad(image, atlas->region(entry.region)));
+			quads.set_group(entry.quad, batch_group(image->layer, true));
+			continue;
+		}
+		batch.set(entry.handle, to_instance(image, entry.texture != 0));
+		// images may be translucent and are drawn with their own texture
+		batch.enqueue_instance(queue, entry.handle, image->layer, true,
+							   entry.texture);
+	}
+	if (atlas)
+		quads.enqueue(queue, 0, atlas->get_texture(), GL_TEXTURE_2D_ARRAY);
+}
+void ImageRenderer::clean_up() {
+	uploader->stop();
+	delete uploader;
+	uploader = nullptr;
+	for (const auto &[image, entry] : images)
+		if (entry.texture) {
+			glDeleteTextures(1, &entry.texture);
+			untrack_memory(CEL_MEMORY_TEXTURES, entry.texture);
+		}
+	images.clear();
+	by_id.clear();
+	{
+		const std::lock_guard<std::mutex> lk(finished_lock);
+		for (ImageJob &job : decoded)
+			free(job.pixels);
+		decoded.clear();
+	}
+	batch.clean_up();
+	quads.clean_up();
+	if (atlas) {
+		atlas->clean_up();
+		delete atlas;
+		atlas = nullptr;
+	}
+}
+void enqueue_images(CelWin *win, RenderQueue &queue) {
+	auto it = image_renderer.find(win);
+	if (it != image_renderer.end())
+		it->second->enqueue(queue);
+}
+void destroy_images(CelWin *win) {
+	cancel_decoding(win);
+	ImageRenderer *renderer;
+	{
+		// images decoded afterwards find no renderer and are dropped
+		const std::lock_guard<std::mutex> lk(renderers_lock);
+		auto it = image_renderer.find(win);
+		if (it == image_renderer.end())
+			return;
+		renderer = it->second;
+		image_renderer.erase(it);
+	}
+	renderer->clean_up();
+	delete renderer;
+}
+void cel_set_image_decoder(CelImageDecoder decoder) { user_decoder = decoder; }
+CelImage *cel_create_image(CelWin *win, const char *path, float x, float y,
+						   float width, float height) {
+	CelImage *image = new CelImage();
+	image->x = x;
+	image->y = y;
+	image->width = width;
+	image->height = height;
+	image->placeholder = {0.85f, 0.85f, 0.85f, 1.0f};
+	image->origin = win;
+	ImageJob job;
+	job.win = win;
+	job.path = path;
+	{
+		using namespace std;
+		const lock_guard<mutex> lk(Internal::gl_lock);
+		Internal::damage(win);
+		glfwMakeContextCurrent(win->window);
+		if (!image_renderer.contains(win)) {
+			ImageRenderer *renderer = new ImageRenderer(win);
+			const lock_guard<mutex> rk(renderers_lock);
+			image_renderer.insert({win, renderer});
+		}
+		job.id = image_renderer[win]->add(image);
+		glfwMakeContextCurrent(nullptr);
+	}
+	decode(std::move(job));
+	return image;
+}
+void cel_delete_image(CelWin *win, CelImage *image) {
+	{
+		using namespace std;
+		const lock_guard<mutex> lk(Internal::gl_lock);
+		Internal::damage(win);
+		glfwMakeContextCurrent(win->window);
+		image_renderer[win]->remove(image);
+		glfwMakeContextCurrent(nullptr);
+	}
+	delete image;
+}
+const std::string primitive_traits<ImageInstance>::vertex_src = R"(
+#version 400
+)" FRAME_UBO_GLSL R"(
+layout (location = 0) in vec2 pos;
+layout (location = 1) in vec2 position;
+layout (location = 2) in vec2 scale;
+layout (location = 3) in vec4 placeholder;
+layout (location = 4) in uint ready;
+out vec2 uv;
+out vec4 out_placeholder;
+flat out uint out_ready;
+void main() {
+  // the rows of the image are stored from top to bottom
+  uv = vec2(pos.x, -pos.y);
+  out_placeholder = placeholder;
+  out_ready = ready;
+  gl_Position = view * vec4(position + pos * scale, 0.0, 1.0);
+}
+)";
+const std::string primitive_traits<ImageInstance>::fragment_src = R"(
+#version 400
+uniform sampler2D image;
+in vec2 uv;
+in vec4 out_placeholder;
+flat in uint out_ready;
+out vec4 final_color;
+void main() {
+  final_color = out_ready != 0u ? texture(image, uv) : out_placeholder;
+}
+)";
@@ -0,0 +1,142 @@
+#ifndef IMAGES_HPP
+#define IMAGES_HPP
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "atlas.hpp"
+#include "batch.hpp"
+#include "buffer.hpp"
+#include "celerityui.h"
+#include "render_queue.hpp"
+/**
+ * Per instance data of an image, drawn with its own texture once it is
+ * uploaded and as a placeholder before. Small images are drawn as quads of the
+ * atlas of their window instead.
+ */
+struct ImageInstance {
+	float pos[2];
+	float size[2];
+	uint8_t placeholder[4];
+	uint32_t ready;
+};
+template <>
+struct primitive_traits<ImageInstance> {
+	using layout = VertexLayout<ImageInstance,
+								CEL_ATTRIB(ImageInstance, pos, false),
+								CEL_ATTRIB(ImageInstance, size, false),
+								CEL_ATTRIB(ImageInstance, placeholder, true),
+								CEL_ATTRIB(ImageInstance, ready, false)>;
+	static const std::string vertex_src;
+	static const std::string fragment_src;
+};
+class ImageRenderer;
+/**
+ * Decoded pixels of an image on their way to the GPU
+ */
+struct ImageJob {
+	// the renderer of the window is looked up when the job is done, it may
+	// have been closed in the meantime
+	CelWin *win;
+	// unique across all windows, so results of deleted images are dropped
+	uint64_t id;
+	std::string path;
+	int width = 0, height = 0;
+	// RGBA8, rows from top to bottom, allocated by the decoder with malloc
+	unsigned char *pixels = nullptr;
+};
+/**
+ * Uploads the decoded images of one window from its own thread. It uses the
+ * hidden upload context of the window and streams the pixels through a ring
+ * of pixel buffer objects, so neither the decoding nor the texture uploads
+ * block the render thread.
+ */
+class ImageUploader {
+	CelWin *win;
+	ImageRenderer *target;
+	GLFWwindow *context = nullptr;
+	RingBuffer *pbo = nullptr;
+	GLint max_size = 0;
+	std::thread *routine = nullptr;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::deque<ImageJob> jobs;
+	bool running = true;
+	void run();
+	GLuint upload(const ImageJob &job);
+
+   public:
+	ImageUploader(CelWin *win, ImageRenderer *target);
+	void push(ImageJob job);
+	/**
+	 * Stops the thread, uploads still queued are dropped. The context is
+	 * destroyed with the window.
+	 */
+	void stop();
+};
+class ImageRenderer {
+	BatchRenderer<ImageInstance> batch;
+	// small images share the texture of the atlas and are drawn in one batch
+	BatchRenderer<AtlasQuadInstance> quads;
+	TextureAtlas *atlas = nullptr;
+	struct Entry {
+		uint64_t id;
+		BatchRenderer<ImageInstance>::handle handle;
+		GLuint texture = 0;
+		// the quad replaces the instance in batch once the image is packed
+		TextureAtlas::handle region = TextureAtlas::invalid;
+		BatchRenderer<AtlasQuadInstance>::handle quad = 0;
+	};
+	ImageUploader *uploader;
+	std::unordered_map<CelImage *, Entry> images;
+	std::unordered_map<uint64_t, CelImage *> by_id;
+	// finished uploads, pushed by the uploader thread
+	std::mutex finished_lock;
+	std::vector<std::pair<uint64_t, GLuint>> finished;
+	// decoded small images, packed into the atlas by the render thread
+	std::deque<ImageJob> decoded;
+	CelWin *win;
+	/**
+	 * Packs the image into the atlas, it is handed to the uploader if the
+	 * atlas is full
+	 */
+	void pack(ImageJob job);
+
+   public:
+	ImageRenderer(CelWin *win);
+	ImageUploader *get_uploader() { return uploader; }
+	uint64_t add(CelImage *image);
+	void remove(CelImage *image);
+	/**
+	 * Hands a texture uploaded by another context to the render thread
+	 */
+	void finish(uint64_t id, GLuint texture);
+	/**
+	 * Hands the pixels of a small image to the render thread, which packs a
+	 * limited number of them into the atlas every frame
+	 */
+	void finish(ImageJob job);
+	/**
+	 * Applies the finished uploads and adds the images to the render queue
+	 */
+	void enqueue(RenderQueue &queue);
+	/**
+	 * Replaces Destructor, stops the uploader and cleans up all OpenGL
+	 * related data.
+	 */
+	void clean_up();
+};
+/**
+ * Adds the images of the window to the render queue of the frame
+ */
+void enqueue_images(CelWin *win, RenderQueue &queue);
+/**
+ * Releases the images and the uploader of a window before it is destroyed, its context has to
+ * be current
+ */
+void destroy_images(CelWin *win);
+#endif
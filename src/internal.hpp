@@ -1,7 +1,19 @@
 #ifndef INTERNAL_HPP
 #define INTERNAL_HPP
 #include <mutex>
+struct CelWin;
+struct GLFWwindow;
 struct Internal {
 	static std::mutex gl_lock;
+	/**
+	 * Marks the window damaged and wakes its render thread, called by API
+	 * functions that change what is drawn
+	 */
+	static void damage(CelWin *win);
+	/**
+	 * Hidden context sharing the objects of the window, created together with
+	 * the window by its render thread for uploads from other threads
+	 */
+	static GLFWwindow *upload_context(CelWin *win);
 };
 #endif
@@ -0,0 +1,146 @@
+#include "kernel.hpp"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <stdexcept>
+#include "src/internal.hpp"
+#include "src/logger.hpp"
+#include "src/memory.hpp"
+#include "src/rects.hpp"
+#include "src/ubo.hpp"
+std::unordered_map<CelWin *, std::vector<CelKernel *>> kernels;
+static const std::string kernel_prelude =
+	"#version 430\n"
+	"layout (local_size_x = " EXPAND_AND_STRINGIZE(KERNEL_GROUP_SIZE) ") in;\n"
+	FRAME_UBO_GLSL RECT_INSTANCE_GLSL
+	"layout (std430, binding = " EXPAND_AND_STRINGIZE(RECT_SSBO_BINDING) ")"
+	" buffer Rects { RectInstance rects[]; };\n"
+	"uniform int rect_count;\n";
+bool kernels_running(CelWin *win) {
+	auto it = kernels.find(win);
+	return it != kernels.end() && !it->second.empty();
+}
+void run_kernels(CelWin *win) {
+	auto it = kernels.find(win);
+	RectRenderer *rects = find_rect_renderer(win);
+	if (it == kernels.end() || !rects || rects->instance_count() == 0)
+		return;
+	const GLuint count = rects->instance_count();
+	for (CelKernel *kernel : it->second) {
+		ComputeShader *shader = kernel->shader;
+		for (auto &[binding, buffer] : kernel->buffers) {
+			if (buffer.dirty) {
+				if (!buffer.id)
+					glGenBuffers(1, &buffer.id);
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer.id);
+				glBufferData(GL_SHADER_STORAGE_BUFFER, buffer.data.size(),
+							 buffer.data.data(), GL_STATIC_DRAW);
+				track_memory(CEL_MEMORY_STORAGE_BUFFERS, buffer.id,
+							 buffer.data.size());
+				buffer.dirty = false;
+			}
+			shader->bind_storage_buffer(buffer.id, binding, 0);
+		}
+		// the instances are drawn afterwards, read by the next kernel and
+		// might be partially overwritten by the next upload
+		shader->bind_storage_buffer(rects->get_instance_buffer(),
+									RECT_SSBO_BINDING,
+									GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+										GL_SHADER_STORAGE_BARRIER_BIT |
+										GL_BUFFER_UPDATE_BARRIER_BIT);
+		shader->start();
+		shader->load("rect_count", (int)count);
+		for (const auto &[name, value] : kernel->floats)
+			shader->load(name, value);
+		for (const auto &[name, value] : kernel->ints)
+			shader->load(name, value);
+		shader->dispatch((count + KERNEL_GROUP_SIZE - 1) / KERNEL_GROUP_SIZE,
+						 1);
+		shader->stop();
+	}
+}
+CelKernel *cel_create_kernel(CelWin *win, const char *source) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(win);
+	glfwMakeContextCurrent(win->window);
+	CelKernel *kernel = nullptr;
+	if (!GLEW_ARB_compute_shader || !GLEW_ARB_shader_storage_buffer_object) {
+		CEL_LOG(WARNING, "Compute kernels are not supported by this context");
+	} else {
+		// compilation errors are reported to the caller as NULL
+		try {
+			ComputeShader *shader =
+				new ComputeShader(kernel_prelude + string(source));
+			shader->bind_uniform_block("Frame", FRAME_UBO_BINDING);
+			kernel = new CelKernel{win, shader, {}, {}, {}};
+			kernels[win].push_back(kernel);
+		} catch (const runtime_error &e) {
+			CEL_LOG(WARNING, "Kernel not created: {}", e.what());
+		}
+	}
+	glfwMakeContextCurrent(nullptr);
+	return kernel;
+}
+// frees the buffers and the program of the kernel, its context has to be
+// current
+static void release(CelKernel *kernel) {
+	for (auto &[binding, buffer] : kernel->buffers)
+		if (buffer.id) {
+			glDeleteBuffers(1, &buffer.id);
+			untrack_memory(CEL_MEMORY_STORAGE_BUFFERS, buffer.id);
+		}
+	kernel->shader->clean_up();
+	delete kernel->shader;
+	delete kernel;
+}
+void destroy_kernels(CelWin *win) {
+	auto it = kernels.find(win);
+	if (it == kernels.end())
+		return;
+	for (CelKernel *kernel : it->second)
+		release(kernel);
+	kernels.erase(it);
+}
+void cel_delete_kernel(CelKernel *kernel) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(kernel->origin);
+	glfwMakeContextCurrent(kernel->origin->window);
+	vector<CelKernel *> &list = kernels[kernel->origin];
+	list.erase(find(list.begin(), list.end(), kernel));
+	release(kernel);
+	glfwMakeContextCurrent(nullptr);
+}
+void cel_kernel_set_float(CelKernel *kernel, const char *name, float value) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(kernel->origin);
+	kernel->floats[name] = value;
+}
+void cel_kernel_set_int(CelKernel *kernel, const char *name, int value) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(kernel->origin);
+	kernel->ints[name] = value;
+}
+unsigned int cel_kernel_rect_index(CelRect *rect) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	return find_rect_renderer(rect->origin)->index_of(rect);
+}
+int cel_kernel_set_buffer(CelKernel *kernel, unsigned int binding,
+						  const void *data, size_t bytes) {
+	if (binding == RECT_SSBO_BINDING) {
+		CEL_LOG(WARNING, "Binding {} is reserved for the rectangle instances",
+			binding);
+		return 0;
+	}
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(kernel->origin);
+	CelKernel::Buffer &buffer = kernel->buffers[binding];
+	const char *bytes_begin = (const char *)data;
+	buffer.data.assign(bytes_begin, bytes_begin + bytes);
+	buffer.dirty = true;
+	return 1;
+}
@@ -0,0 +1,46 @@
+#ifndef KERNEL_HPP
+#define KERNEL_HPP
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "celerityui.h"
+#include "shader.hpp"
+/**
+ * Shader storage binding of the rectangle instances, the buffers of the user
+ * are bound to the following binding points
+ */
+#define RECT_SSBO_BINDING 0
+#define KERNEL_GROUP_SIZE 64
+/**
+ * A compute shader that runs over the rectangle instances of a window every
+ * frame. Parameters are set by the user thread and applied by the render
+ * thread before the next dispatch.
+ */
+struct CelKernel {
+	CelWin *origin;
+	ComputeShader *shader;
+	std::unordered_map<std::string, float> floats;
+	std::unordered_map<std::string, int> ints;
+	struct Buffer {
+		GLuint id = 0;
+		std::vector<char> data;
+		bool dirty = true;
+	};
+	// by binding point
+	std::unordered_map<GLuint, Buffer> buffers;
+};
+/**
+ * Runs the kernels of the window over its rectangle instances, after the
+ * rectangles were enqueued and before the queue is submitted
+ */
+void run_kernels(CelWin *win);
+/**
+ * True if the window has kernels, it then has to be redrawn continuously
+ */
+bool kernels_running(CelWin *win);
+/**
+ * Deletes the kernels of a window before it is destroyed, its context has to
+ * be current
+ */
+void destroy_kernels(CelWin *win);
+#endif
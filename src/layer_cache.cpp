@@ -0,0 +1,353 @@
+#include "layer_cache.hpp"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <cmath>
+#include "src/internal.hpp"
+#include "src/logger.hpp"
+#include "src/memory.hpp"
+#include "src/scene.hpp"
+#include "src/trace.hpp"
+std::unordered_map<CelWin *, LayerCache *> layer_caches;
+LayerCache *find_layer_cache(CelWin *win) {
+	auto it = layer_caches.find(win);
+	return it == layer_caches.end() ? nullptr : it->second;
+}
+const std::string primitive_traits<CompositeInstance>::vertex_src = R"(
+#version 400
+)" FRAME_UBO_GLSL R"(
+layout (location = 0) in vec2 pos;
+layout (location = 1) in vec2 position;
+layout (location = 2) in vec2 scale;
+out vec2 uv;
+void main() {
+  // the top row of the quad samples the top row of the texture
+  uv = vec2(pos.x, 1 + pos.y);
+  gl_Position = view * vec4(position + pos * scale, 0.0, 1.0);
+}
+)";
+const std::string primitive_traits<CompositeInstance>::fragment_src = R"(
+#version 400
+uniform sampler2D layer;
+in vec2 uv;
+out vec4 final_color;
+void main() {
+  // the layer was blended into a transparent texture, its colors are
+  // premultiplied
+  vec4 color = texture(layer, uv);
+  if (color.a <= 0)
+    discard;
+  final_color = vec4(color.rgb / color.a, color.a);
+}
+)";
+LayerCache::LayerCache(CelWin *win) : win(win) {
+	ShaderProgram &program = quads.get_program();
+	program.bind_uniform_block("Frame", FRAME_UBO_BINDING);
+	program.start();
+	program.load("layer", 0);
+	program.stop();
+}
+CachedLayer *LayerCache::layer_of(const CelRect *rect) const {
+	// nested cached nodes are part of the texture of the outermost one
+	CachedLayer *res = nullptr;
+	for (CelNode *n = rect->node; n; n = n->scene->get_parent(n)) {
+		auto it = layers.find(n);
+		if (it != layers.end())
+			res = it->second;
+	}
+	return res;
+}
+void LayerCache::set_cached(CelNode *node, bool cached) {
+	auto it = layers.find(node);
+	if (cached == (it != layers.end()))
+		return;
+	if (cached) {
+		CachedLayer *layer = new CachedLayer(rect_program(win));
+		layer->quad = quads.add({{0, 0}, {0, 0}});
+		layers.insert({node, layer});
+		return;
+	}
+	// the members are drawn directly again from the next frame on
+	CachedLayer *layer = it->second;
+	for (const auto &[rect, handle] : layer->members)
+		owner.erase(rect);
+	evict(layer);
+	quads.remove(layer->quad);
+	layer->batch.clean_up();
+	delete layer;
+	layers.erase(it);
+}
+bool LayerCache::claim(CelRect *rect, const RectInstance &instance,
+					   int group, bool animated) {
+	// layers have no stencil buffer and are drawn without the window's
+	// clips, so stencil clipped rectangles stay in the window's batch
+	CachedLayer *layer = layers.empty() || group_clip(group)
+							 ? nullptr
+							 : layer_of(rect);
+	auto it = owner.find(rect);
+	CachedLayer *prev = it == owner.end() ? nullptr : it->second;
+	if (prev != layer) {
+		if (prev)
+			release(rect);
+		if (layer) {
+			layer->members.insert({rect, layer->batch.add(instance, group)});
+			owner.insert({rect, layer});
+			layer->valid = false;
+			layer->changed = true;
+		}
+		return layer != nullptr;
+	}
+	if (!layer)
+		return false;
+	const BatchRenderer<RectInstance>::handle h = layer->members[rect];
+	bool changed = animated;
+	if (layer->batch.get_group(h) != group) {
+		layer->batch.set_group(h, group);
+		changed = true;
+	}
+	changed = layer->batch.set(h, instance) || changed;
+	if (changed) {
+		layer->valid = false;
+		layer->changed = true;
+	}
+	return true;
+}
+void LayerCache::release(CelRect *rect) {
+	auto it = owner.find(rect);
+	if (it == owner.end())
+		return;
+	CachedLayer *layer = it->second;
+	layer->batch.remove(layer->members[rect]);
+	layer->members.erase(rect);
+	layer->valid = false;
+	layer->changed = true;
+	owner.erase(it);
+}
+void LayerCache::evict(CachedLayer *layer) {
+	if (!layer->texture)
+		return;
+	glDeleteFramebuffers(1, &layer->fbo);
+	glDeleteTextures(1, &layer->texture);
+	untrack_memory(CEL_MEMORY_TEXTURES, layer->texture);
+	layer->fbo = 0;
+	layer->texture = 0;
+	layer->valid = false;
+	resident -= layer->bytes;
+	layer->bytes = 0;
+}
+bool LayerCache::make_room(size_t bytes, const CachedLayer *keep) {
+	while (resident + bytes > budget) {
+		CachedLayer *lru = nullptr;
+		for (const auto &[node, layer] : layers)
+			if (layer != keep && layer->texture &&
+				(!lru || layer->last_used < lru->last_used))
+				lru = layer;
+		if (!lru)
+			return false;
+		evict(lru);
+	}
+	return true;
+}
+bool LayerCache::allocate(CachedLayer *layer) {
+	const size_t bytes = (size_t)layer->width * layer->height * 4;
+	if (!make_room(bytes, layer))
+		return false;
+	glGenTextures(1, &layer->texture);
+	glBindTexture(GL_TEXTURE_2D, layer->texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, layer->width, layer->height, 0,
+				 GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	track_memory(CEL_MEMORY_TEXTURES, layer->texture, bytes);
+	// the composite is pixel aligned, no filtering needed
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glGenFramebuffers(1, &layer->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, layer->fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+						   GL_TEXTURE_2D, layer->texture, 0);
+	const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	layer->texture_size[0] = layer->width;
+	layer->texture_size[1] = layer->height;
+	layer->bytes = bytes;
+	resident += bytes;
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		CEL_LOG(WARNING, "Incomplete layer framebuffer, status {}", status);
+		evict(layer);
+		return false;
+	}
+	return true;
+}
+void LayerCache::render(CachedLayer *layer, UniformRing *ring,
+						const FrameUniforms &frame) {
+	// maps the bounds of the layer onto the whole texture, the window size is
+	// kept so pixel based sizes stay the same
+	const float w = window_width, h = window_height;
+	const float left = layer->x / w * 2 - 1,
+				right = (layer->x + layer->width) / w * 2 - 1,
+				top = 1 - layer->y / h * 2,
+				bottom = 1 - (layer->y + layer->height) / h * 2;
+	glm::mat4 view(1.0f);
+	view[0][0] = 2 / (right - left);
+	view[1][1] = 2 / (top - bottom);
+	view[3][0] = -(right + left) / (right - left);
+	view[3][1] = -(top + bottom) / (top - bottom);
+	FrameUniforms layer_frame = frame;
+	layer_frame.view = view;
+	const size_t offset = ring->push(layer_frame);
+	ring->flush();
+	ring->bind(FRAME_UBO_BINDING, offset, sizeof(layer_frame));
+	glBindFramebuffer(GL_FRAMEBUFFER, layer->fbo);
+	glViewport(0, 0, layer->width, layer->height);
+	const GLfloat transparent[] = {0, 0, 0, 0};
+	glClearBufferfv(GL_COLOR, 0, transparent);
+	RenderQueue queue;
+	layer->batch.enqueue(queue);
+	queue.submit();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, window_width, window_height);
+	layer->valid = true;
+}
+// conservative pixel bounds of the members, including one pixel for the
+// anti-aliased edges, clipped to the window
+static void layer_bounds(CachedLayer *layer, int width, int height) {
+	float min[2] = {INFINITY, INFINITY}, max[2] = {-INFINITY, -INFINITY};
+	for (const RectInstance &inst : layer->batch.data()) {
+		const float sx = std::abs(inst.size[0]), sy = std::abs(inst.size[1]);
+		const float cx = inst.pos[0] + inst.size[0] / 2,
+					cy = inst.pos[1] - inst.size[1] / 2;
+		float ex = sx / 2, ey = sy / 2;
+		if (inst.rotation != 0) {
+			// rectangles are rotated in pixels
+			const float px = sx * width / 2, py = sy * height / 2;
+			const float r = std::sqrt(px * px + py * py) / 2;
+			ex = r * 2 / width;
+			ey = r * 2 / height;
+		}
+		min[0] = std::min(min[0], cx - ex);
+		max[0] = std::max(max[0], cx + ex);
+		min[1] = std::min(min[1], cy - ey);
+		max[1] = std::max(max[1], cy + ey);
+	}
+	const int left = std::max(0, (int)std::floor((min[0] + 1) / 2 * width) - 1);
+	const int right =
+		std::min(width, (int)std::ceil((max[0] + 1) / 2 * width) + 1);
+	const int top = std::max(0, (int)std::floor((1 - max[1]) / 2 * height) - 1);
+	const int bottom =
+		std::min(height, (int)std::ceil((1 - min[1]) / 2 * height) + 1);
+	layer->x = left;
+	layer->y = top;
+	layer->width = std::max(0, right - left);
+	layer->height = std::max(0, bottom - top);
+}
+void LayerCache::update(UniformRing *ring, const FrameUniforms &frame) {
+	frame_count++;
+	const glm::vec2 &size = frame.window_size;
+	if (size.x != window_width || size.y != window_height) {
+		window_width = size.x;
+		window_height = size.y;
+		for (const auto &[node, layer] : layers)
+			layer->valid = false;
+	}
+	// the budget might have been lowered
+	make_room(0, nullptr);
+	for (const auto &[node, layer] : layers) {
+		if (layer->changed) {
+			layer->changed = false;
+			layer->stable_frames = 0;
+		} else {
+			layer->stable_frames++;
+		}
+		// layers that change every frame are cheaper to draw directly
+		if (layer->valid || layer->stable_frames == 0 ||
+			layer->members.empty())
+			continue;
+		layer->layer = INT32_MAX;
+		for (const auto &[rect, handle] : layer->members)
+			layer->layer = std::min(layer->layer, rect->layer);
+		layer_bounds(layer, window_width, window_height);
+		if (layer->width == 0 || layer->height == 0)
+			continue;
+		if (layer->texture && (layer->width != layer->texture_size[0] ||
+							   layer->height != layer->texture_size[1]))
+			evict(layer);
+		if (!layer->texture && !allocate(layer))
+			continue;
+		render(layer, ring, frame);
+	}
+}
+void LayerCache::enqueue(RenderQueue &queue) {
+	const float w = window_width, h = window_height;
+	for (const auto &[node, layer] : layers) {
+		if (layer->members.empty())
+			continue;
+		if (!layer->valid || !layer->texture) {
+			layer->batch.enqueue(queue);
+			continue;
+		}
+		layer->last_used = frame_count;
+		quads.set(layer->quad, {{layer->x / w * 2 - 1, 1 - layer->y / h * 2},
+								{layer->width / w * 2, layer->height / h * 2}});
+		quads.enqueue_instance(queue, layer->quad, layer->layer, true,
+							   layer->texture);
+	}
+}
+void LayerCache::clean_up() {
+	for (const auto &[node, layer] : layers) {
+		evict(layer);
+		layer->batch.clean_up();
+		delete layer;
+	}
+	layers.clear();
+	owner.clear();
+	quads.clean_up();
+}
+void enqueue_layers(CelWin *win, RenderQueue &queue, UniformRing *ring,
+					const FrameUniforms &frame) {
+	LayerCache *cache = find_layer_cache(win);
+	if (!cache)
+		return;
+	cache->update(ring, frame);
+	cache->enqueue(queue);
+}
+void destroy_layer_cache(CelWin *win) {
+	auto it = layer_caches.find(win);
+	if (it == layer_caches.end())
+		return;
+	it->second->clean_up();
+	delete it->second;
+	layer_caches.erase(it);
+}
+void uncache_subtree(CelNode *node) {
+	LayerCache *cache = find_layer_cache(node->origin);
+	if (!cache)
+		return;
+	glfwMakeContextCurrent(node->origin->window);
+	for (CelNode *n : node->scene->subtree(node))
+		cache->set_cached(n, false);
+	glfwMakeContextCurrent(nullptr);
+}
+void cel_node_set_cached(CelNode *node, int cached) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(node->origin);
+	trace(TRACE_NODE_CACHED, trace_id(node), cached);
+	CelWin *win = node->origin;
+	if (!cached && !layer_caches.contains(win))
+		return;
+	glfwMakeContextCurrent(win->window);
+	if (!layer_caches.contains(win))
+		layer_caches.insert({win, new LayerCache(win)});
+	layer_caches[win]->set_cached(node, cached != 0);
+	glfwMakeContextCurrent(nullptr);
+}
+void cel_set_layer_cache_budget(CelWin *win, size_t bytes) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	glfwMakeContextCurrent(win->window);
+	if (!layer_caches.contains(win))
+		layer_caches.insert({win, new LayerCache(win)});
+	layer_caches[win]->set_budget(bytes);
+	glfwMakeContextCurrent(nullptr);
+}
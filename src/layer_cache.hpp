@@ -0,0 +1,129 @@
+#ifndef LAYER_CACHE_HPP
+#define LAYER_CACHE_HPP
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include "batch.hpp"
+#include "celerityui.h"
+#include "rects.hpp"
+#include "render_queue.hpp"
+#include "ubo.hpp"
+/**
+ * Textured quad that composites a cached layer, in normalized device
+ * coordinates
+ */
+struct CompositeInstance {
+	float pos[2];
+	float size[2];
+};
+template <>
+struct primitive_traits<CompositeInstance> {
+	using layout = VertexLayout<CompositeInstance,
+								CEL_ATTRIB(CompositeInstance, pos, false),
+								CEL_ATTRIB(CompositeInstance, size, false)>;
+	static const std::string vertex_src;
+	static const std::string fragment_src;
+};
+/**
+ * The rectangles of a cached subtree. They are rendered into a texture
+ * covering their bounds, which is composited as a single quad as long as none
+ * of them changes.
+ */
+struct CachedLayer {
+	// draws with the rectangle program of the window
+	BatchRenderer<RectInstance> batch;
+	std::unordered_map<CelRect *, BatchRenderer<RectInstance>::handle>
+		members;
+	BatchRenderer<CompositeInstance>::handle quad;
+	GLuint fbo = 0, texture = 0;
+	// size the texture was allocated with and its memory
+	int texture_size[2] = {0, 0};
+	size_t bytes = 0;
+	// bounds of the members in pixels from the top left corner of the window
+	int x = 0, y = 0, width = 0, height = 0;
+	// lowest layer of the members, the composite is drawn in it
+	int layer = 0;
+	// the texture holds the current content of the members
+	bool valid = false;
+	// a member changed since the last frame
+	bool changed = true;
+	// number of frames without changes, animated layers are drawn directly
+	unsigned stable_frames = 0;
+	// frame the layer was last composited in
+	uint64_t last_used = 0;
+	explicit CachedLayer(ShaderProgram &program) : batch(program) {}
+};
+/**
+ * Cached layers of a window with a memory budget for their textures, the
+ * least recently composited layers are evicted first. Layers without a
+ * texture are drawn directly.
+ */
+class LayerCache {
+	CelWin *win;
+	std::unordered_map<CelNode *, CachedLayer *> layers;
+	// layer of every rectangle that is drawn by a cached layer
+	std::unordered_map<CelRect *, CachedLayer *> owner;
+	BatchRenderer<CompositeInstance> quads;
+	size_t budget = 64 * 1024 * 1024;
+	size_t resident = 0;
+	uint64_t frame_count = 0;
+	int window_width = -1, window_height = -1;
+	CachedLayer *layer_of(const CelRect *rect) const;
+	void evict(CachedLayer *layer);
+	/**
+	 * Evicts least recently used layers until `bytes` more fit into the
+	 * budget, `keep` is never evicted
+	 * @return false if the budget cannot be met
+	 */
+	bool make_room(size_t bytes, const CachedLayer *keep);
+	bool allocate(CachedLayer *layer);
+	void render(CachedLayer *layer, UniformRing *ring,
+				const FrameUniforms &frame);
+
+   public:
+	LayerCache(CelWin *win);
+	/**
+	 * Creates or drops the layer of a node
+	 */
+	void set_cached(CelNode *node, bool cached);
+	void set_budget(size_t bytes) { budget = bytes; }
+	/**
+	 * Moves the rectangle into the layer of the outermost cached node above
+	 * it and invalidates the layer if the instance changed or is animated,
+	 * rectangles with a stencil clip are never cached
+	 * @return true if the rectangle is drawn by a layer
+	 */
+	bool claim(CelRect *rect, const RectInstance &instance, int group,
+			   bool animated);
+	void release(CelRect *rect);
+	/**
+	 * Renders the invalid layers into their textures, leaves the default
+	 * framebuffer bound
+	 */
+	void update(UniformRing *ring, const FrameUniforms &frame);
+	void enqueue(RenderQueue &queue);
+	/**
+	 * Replaces Destructor, cleans up all OpenGL related data.
+	 */
+	void clean_up();
+};
+/**
+ * Returns the layer cache of the window, nullptr if it has no cached nodes
+ */
+LayerCache *find_layer_cache(CelWin *win);
+/**
+ * Drops the layers of the subtree of a node before it is removed
+ */
+void uncache_subtree(CelNode *node);
+/**
+ * Releases the cached layers of a window before it is destroyed, its context has to
+ * be current
+ */
+void destroy_layer_cache(CelWin *win);
+/**
+ * Brings the cached layers of the window up to date and adds them to the
+ * render queue of the frame, after the rectangles were enqueued
+ */
+void enqueue_layers(CelWin *win, RenderQueue &queue, UniformRing *ring,
+					const FrameUniforms &frame);
+#endif
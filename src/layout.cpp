@@ -0,0 +1,258 @@
+#include "layout.hpp"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <unordered_map>
+#include "src/internal.hpp"
+std::unordered_map<CelWin *, LayoutEngine *> layouts;
+void update_layout(CelWin *win) {
+	if (layouts.contains(win))
+		layouts[win]->update(win->width, win->height);
+}
+void detach_from_box(CelRect *rect) {
+	if (!rect->box)
+		return;
+	std::vector<CelRect *> &rects = rect->box->rects;
+	rects.erase(std::find(rects.begin(), rects.end(), rect));
+	rect->box = nullptr;
+}
+CelBox *LayoutEngine::create(CelWin *win, CelBox *parent) {
+	CelBox *box = new CelBox();
+	box->origin = win;
+	box->parent = parent;
+	if (parent)
+		parent->children.push_back(box);
+	else
+		roots.push_back(box);
+	invalidate(box);
+	return box;
+}
+void LayoutEngine::remove(CelBox *box) {
+	while (!box->children.empty())
+		remove(box->children.back());
+	std::vector<CelBox *> &siblings =
+		box->parent ? box->parent->children : roots;
+	siblings.erase(std::find(siblings.begin(), siblings.end(), box));
+	if (box->parent)
+		invalidate(box->parent);
+	for (CelRect *rect : box->rects)
+		rect->box = nullptr;
+	delete box;
+}
+void LayoutEngine::invalidate(CelBox *box) {
+	box->measure_dirty = true;
+	box->layout_dirty = true;
+	box->subtree_dirty = true;
+	// the parent has to place its children again, the measured size of an
+	// ancestor only changes as long as it is not fixed
+	bool measure = true;
+	for (CelBox *a = box->parent; a; a = a->parent) {
+		if (measure) {
+			a->layout_dirty = true;
+			measure = a->width < 0 || a->height < 0;
+			a->measure_dirty = a->measure_dirty || measure;
+		}
+		a->subtree_dirty = true;
+	}
+}
+void LayoutEngine::measure(CelBox *box) {
+	if (!box->measure_dirty) {
+		// invalidation stops at fixed size boxes, their dirty descendants
+		// still have to be measured before they are placed
+		if (box->subtree_dirty)
+			for (CelBox *child : box->children)
+				if (child->subtree_dirty)
+					measure(child);
+		return;
+	}
+	const int main = box->direction == CEL_DIRECTION_ROW ? 0 : 1;
+	float size[2] = {0, 0};
+	for (CelBox *child : box->children) {
+		measure(child);
+		size[main] += child->measured[main];
+		size[1 - main] = std::max(size[1 - main], child->measured[1 - main]);
+	}
+	box->measured[0] = box->width >= 0
+						   ? box->width
+						   : size[0] + box->padding[0] + box->padding[2];
+	box->measured[1] = box->height >= 0
+						   ? box->height
+						   : size[1] + box->padding[1] + box->padding[3];
+	box->measure_dirty = false;
+}
+static void write_rects(const CelBox *box) {
+	const float ww = box->origin->width, wh = box->origin->height;
+	for (CelRect *rect : box->rects) {
+		rect->x = box->x / ww * 2 - 1;
+		rect->y = 1 - box->y / wh * 2;
+		rect->width = box->w / ww * 2;
+		rect->height = box->h / wh * 2;
+	}
+}
+void LayoutEngine::place(CelBox *box, float x, float y, float w, float h) {
+	const bool changed = rewrite_all || box->x != x || box->y != y ||
+						 box->w != w || box->h != h;
+	if (changed) {
+		box->x = x;
+		box->y = y;
+		box->w = w;
+		box->h = h;
+		write_rects(box);
+	}
+	if (changed || box->layout_dirty) {
+		layout_children(box);
+	} else if (box->subtree_dirty) {
+		// the children keep their place, only dirty descendants are visited
+		for (CelBox *child : box->children)
+			if (child->subtree_dirty)
+				place(child, child->x, child->y, child->w, child->h);
+	}
+	box->layout_dirty = false;
+	box->subtree_dirty = false;
+}
+void LayoutEngine::layout_children(CelBox *box) {
+	if (box->children.empty())
+		return;
+	const int main = box->direction == CEL_DIRECTION_ROW ? 0 : 1;
+	const float origin[2] = {box->x + box->padding[0],
+							 box->y + box->padding[1]};
+	const float inner[2] = {
+		std::max(0.0f, box->w - box->padding[0] - box->padding[2]),
+		std::max(0.0f, box->h - box->padding[1] - box->padding[3])};
+	// distribute the free space along the main axis
+	float used = 0, grow = 0, shrink = 0;
+	for (CelBox *child : box->children) {
+		used += child->measured[main];
+		grow += child->grow;
+		shrink += child->shrink * child->measured[main];
+	}
+	const float free = inner[main] - used;
+	float offset = 0, spacing = 0;
+	if (free > 0 && grow == 0) {
+		if (box->justify == CEL_ALIGN_CENTER)
+			offset = free / 2;
+		else if (box->justify == CEL_ALIGN_END)
+			offset = free;
+		else if (box->justify == CEL_ALIGN_STRETCH &&
+				 box->children.size() > 1)
+			spacing = free / (box->children.size() - 1);
+	}
+	float pos = offset;
+	for (CelBox *child : box->children) {
+		float size[2], at[2];
+		size[main] = child->measured[main];
+		if (free > 0 && grow > 0)
+			size[main] += free * child->grow / grow;
+		else if (free < 0 && shrink > 0)
+			size[main] = std::max(0.0f, size[main] + free * child->shrink *
+														 child->measured[main] /
+														 shrink);
+		at[main] = origin[main] + pos;
+		pos += size[main] + spacing;
+		// align along the cross axis
+		const int cross = 1 - main;
+		const bool fixed = (cross == 0 ? child->width : child->height) >= 0;
+		size[cross] = box->align == CEL_ALIGN_STRETCH && !fixed
+						  ? inner[cross]
+						  : std::min(child->measured[cross], inner[cross]);
+		at[cross] = origin[cross];
+		if (box->align == CEL_ALIGN_CENTER)
+			at[cross] += (inner[cross] - size[cross]) / 2;
+		else if (box->align == CEL_ALIGN_END)
+			at[cross] += inner[cross] - size[cross];
+		place(child, at[0], at[1], size[0], size[1]);
+	}
+}
+void LayoutEngine::update(int width, int height) {
+	const bool resized = width != window_width || height != window_height;
+	window_width = width;
+	window_height = height;
+	for (CelBox *root : roots) {
+		if (!resized && !root->subtree_dirty)
+			continue;
+		measure(root);
+		// rectangles are in normalized device coordinates, they all change
+		// with the window size
+		rewrite_all = resized;
+		place(root, 0, 0, root->width >= 0 ? root->width : width,
+			  root->height >= 0 ? root->height : height);
+	}
+	rewrite_all = false;
+}
+static LayoutEngine *get_layout(CelWin *win) {
+	if (!layouts.contains(win))
+		layouts.insert({win, new LayoutEngine()});
+	return layouts[win];
+}
+CelBox *cel_create_box(CelWin *win, CelBox *parent) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(win);
+	return get_layout(win)->create(win, parent);
+}
+void cel_delete_box(CelBox *box) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(box->origin);
+	get_layout(box->origin)->remove(box);
+}
+void cel_box_set_direction(CelBox *box, CelDirection direction) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(box->origin);
+	box->direction = direction;
+	get_layout(box->origin)->invalidate(box);
+}
+void cel_box_set_size(CelBox *box, float width, float height) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(box->origin);
+	box->width = width;
+	box->height = height;
+	get_layout(box->origin)->invalidate(box);
+}
+void cel_box_set_flex(CelBox *box, float grow, float shrink) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(box->origin);
+	box->grow = grow;
+	box->shrink = shrink;
+	get_layout(box->origin)->invalidate(box);
+}
+void cel_box_set_padding(CelBox *box, float left, float top, float right,
+						 float bottom) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(box->origin);
+	box->padding[0] = left;
+	box->padding[1] = top;
+	box->padding[2] = right;
+	box->padding[3] = bottom;
+	get_layout(box->origin)->invalidate(box);
+}
+void cel_box_set_align(CelBox *box, CelAlign justify, CelAlign align) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(box->origin);
+	box->justify = justify;
+	box->align = align;
+	get_layout(box->origin)->invalidate(box);
+}
+void cel_box_attach_rectangle(CelBox *box, CelRect *rect) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(box->origin);
+	if (rect->box == box)
+		return;
+	detach_from_box(rect);
+	box->rects.push_back(rect);
+	rect->box = box;
+	if (box->w >= 0)
+		write_rects(box);
+}
+void cel_box_get_bounds(CelBox *box, float *x, float *y, float *width,
+						float *height) {
+	*x = box->x;
+	*y = box->y;
+	*width = box->w;
+	*height = box->h;
+}
@@ -0,0 +1,64 @@
+#ifndef LAYOUT_HPP
+#define LAYOUT_HPP
+#include <vector>
+#include "celerityui.h"
+/**
+ * A box of the layout tree. Sizes and results are in pixels from the top left
+ * corner of the window. The measured size and the placement of every box are
+ * cached, changing a property only invalidates the chain from the box up to
+ * the first ancestor whose size does not depend on its children.
+ */
+struct CelBox {
+	CelWin *origin;
+	CelBox *parent = nullptr;
+	std::vector<CelBox *> children;
+	std::vector<CelRect *> rects;
+	CelDirection direction = CEL_DIRECTION_ROW;
+	CelAlign justify = CEL_ALIGN_START;
+	CelAlign align = CEL_ALIGN_STRETCH;
+	// preferred size, negative if it is derived from the children
+	float width = -1, height = -1;
+	float grow = 0, shrink = 1;
+	// left, top, right, bottom
+	float padding[4] = {0, 0, 0, 0};
+	// cached results
+	float measured[2] = {0, 0};
+	float x = 0, y = 0, w = -1, h = -1;
+	// the measured size has to be recomputed
+	bool measure_dirty = true;
+	// the children have to be placed again
+	bool layout_dirty = true;
+	// some box in the subtree is dirty
+	bool subtree_dirty = true;
+};
+class LayoutEngine {
+	std::vector<CelBox *> roots;
+	int window_width = -1, window_height = -1;
+	bool rewrite_all = false;
+	void measure(CelBox *box);
+	void place(CelBox *box, float x, float y, float w, float h);
+	void layout_children(CelBox *box);
+
+   public:
+	CelBox *create(CelWin *win, CelBox *parent);
+	void remove(CelBox *box);
+	/**
+	 * Marks the box and the chain of its ancestors that depend on it dirty
+	 */
+	void invalidate(CelBox *box);
+	/**
+	 * Lays out the dirty parts of the tree, everything if the window size
+	 * changed, and writes the results to the attached rectangles
+	 */
+	void update(int width, int height);
+};
+/**
+ * Lays out the dirty boxes of a window, called once per frame before the
+ * primitives are enqueued
+ */
+void update_layout(CelWin *win);
+/**
+ * Detaches a rectangle from its box before it is deleted
+ */
+void detach_from_box(CelRect *rect);
+#endif
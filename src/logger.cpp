@@ -0,0 +1,275 @@
+#include "logger.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+/**
+ * Single producer, single consumer ring of the messages of one thread
+ */
+struct LogRing {
+  static constexpr size_t capacity = 1024;
+  LogRecord records[capacity];
+  // written by the producer resp. the consumer
+  std::atomic<size_t> head = 0, tail = 0;
+  std::atomic<size_t> dropped = 0;
+  // false once the thread exited, the ring is freed after it was drained
+  std::atomic<bool> alive = true;
+  unsigned int thread;
+};
+/**
+ * Registered rings and the background thread that drains them
+ */
+struct LogState {
+  std::mutex rings_lock;
+  std::vector<LogRing *> rings;
+  unsigned int next_thread = 0;
+  // serializes the drains of the background thread and of flush_logs
+  std::mutex drain_lock;
+  std::mutex wake_lock;
+  std::condition_variable wake;
+  bool running = true;
+  std::thread flusher;
+  LogState() : flusher(&LogState::run, this) {}
+  ~LogState() {
+    {
+      const std::lock_guard<std::mutex> lk(wake_lock);
+      running = false;
+    }
+    wake.notify_one();
+    flusher.join();
+    drain();
+    for (LogRing *ring : rings)
+      delete ring;
+  }
+  void run() {
+    std::unique_lock<std::mutex> lk(wake_lock);
+    while (running) {
+      wake.wait_for(lk, std::chrono::milliseconds(10));
+      lk.unlock();
+      drain();
+      lk.lock();
+    }
+  }
+  void drain();
+};
+static LogState &state() {
+  static LogState s;
+  return s;
+}
+static const int64_t log_epoch = log_time();
+int64_t log_time() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+struct LogRingHolder {
+  LogRing *ring = nullptr;
+  ~LogRingHolder() {
+    if (ring)
+      ring->alive.store(false, std::memory_order_release);
+  }
+};
+static thread_local LogRingHolder holder;
+static LogRing *thread_ring() {
+  if (!holder.ring) {
+    LogState &s = state();
+    LogRing *ring = new LogRing();
+    const std::lock_guard<std::mutex> lk(s.rings_lock);
+    ring->thread = s.next_thread++;
+    s.rings.push_back(ring);
+    holder.ring = ring;
+  }
+  return holder.ring;
+}
+void log_push(const LogRecord &record) {
+  LogRing *ring = thread_ring();
+  const size_t head = ring->head.load(std::memory_order_relaxed);
+  // never wait for the writer, a full ring loses the message
+  if (head - ring->tail.load(std::memory_order_acquire) >= LogRing::capacity) {
+    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    release_record(record);
+    return;
+  }
+  ring->records[head % LogRing::capacity] = record;
+  ring->head.store(head + 1, std::memory_order_release);
+}
+static const char *tag_of(LOGTYPE type) {
+  switch (type) {
+  case DEBUG:
+    return "\033[0;33m[\033[0;32mDEBUG\033[0;33m]\033[0m ";
+  case VERBOSE:
+    return "\033[0;33m[\033[0;35mVERBOSE\033[0;33m]\033[0m ";
+  case INFO:
+    return "\033[0;33m[\033[0;36mINFO\033[0;33m]\033[0m ";
+  case WARNING:
+    return "\033[0;33m[\033[0;33mWARNING\033[0;33m]\033[0m ";
+  default:
+    return "\033[0;33m[\033[1;31mERROR\033[0;33m]\033[0m ";
+  }
+}
+// appends the next argument of the record, returns the position after it
+static size_t format_arg(std::string &out, const LogRecord &record,
+                         size_t pos) {
+  const char tag = record.args[pos++];
+  const unsigned char *data = record.args + pos;
+  switch (tag) {
+  case 'b': {
+    bool v;
+    std::memcpy(&v, data, sizeof(v));
+    out += v ? "true" : "false";
+    return pos + sizeof(v);
+  }
+  case 'i': {
+    int64_t v;
+    std::memcpy(&v, data, sizeof(v));
+    out += std::to_string(v);
+    return pos + sizeof(v);
+  }
+  case 'u': {
+    uint64_t v;
+    std::memcpy(&v, data, sizeof(v));
+    out += std::to_string(v);
+    return pos + sizeof(v);
+  }
+  case 'd': {
+    double v;
+    std::memcpy(&v, data, sizeof(v));
+    out += std::to_string(v);
+    return pos + sizeof(v);
+  }
+  case 'p': {
+    const void *v;
+    std::memcpy(&v, data, sizeof(v));
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%p", v);
+    out += buf;
+    return pos + sizeof(v);
+  }
+  case 'h': {
+    const std::string *v;
+    std::memcpy(&v, data, sizeof(v));
+    out += *v;
+    return pos + sizeof(v);
+  }
+  default: {
+    uint16_t len;
+    std::memcpy(&len, data, sizeof(len));
+    out.append((const char *)data + sizeof(len), len);
+    return pos + sizeof(len) + len;
+  }
+  }
+}
+void release_record(const LogRecord &record) {
+  for (size_t pos = 0; pos < record.size;) {
+    const char tag = record.args[pos++];
+    const unsigned char *data = record.args + pos;
+    if (tag == 'h') {
+      const std::string *v;
+      std::memcpy(&v, data, sizeof(v));
+      delete v;
+      pos += sizeof(v);
+    } else if (tag == 'b') {
+      pos += sizeof(bool);
+    } else if (tag == 's') {
+      uint16_t len;
+      std::memcpy(&len, data, sizeof(len));
+      pos += sizeof(len) + len;
+    } else {
+      pos += 8;
+    }
+  }
+}
+std::string format_record(const LogRecord &record) {
+  std::string msg;
+  size_t arg = 0;
+  for (const char *c = record.format; *c; c++) {
+    if (c[0] == '{' && c[1] == '}') {
+      if (arg < record.size)
+        arg = format_arg(msg, record, arg);
+      c++;
+    } else {
+      msg += *c;
+    }
+  }
+  return msg;
+}
+static void write_record(std::string &out, const LogRecord &record,
+                         unsigned int thread) {
+  char stamp[48];
+  std::snprintf(stamp, sizeof(stamp), "[%.6f T%u] ",
+                (record.time - log_epoch) / 1e9, thread);
+  out += tag_of(record.type);
+  out += stamp;
+  out += format_record(record);
+  if (record.type != VERBOSE && record.type != INFO) {
+    out += " [In ";
+    out += record.file;
+    out += ":" + std::to_string(record.line) + "]";
+  }
+  out += '\n';
+}
+void LogState::drain() {
+  const std::lock_guard<std::mutex> dl(drain_lock);
+  std::vector<LogRing *> current;
+  {
+    const std::lock_guard<std::mutex> lk(rings_lock);
+    current = rings;
+  }
+  // messages of all threads are written in the order they were logged
+  std::vector<std::pair<int64_t, std::string>> lines;
+  std::vector<LogRing *> finished;
+  for (LogRing *ring : current) {
+    const bool alive = ring->alive.load(std::memory_order_acquire);
+    size_t tail = ring->tail.load(std::memory_order_relaxed);
+    const size_t head = ring->head.load(std::memory_order_acquire);
+    for (; tail != head; tail++) {
+      const LogRecord &record = ring->records[tail % LogRing::capacity];
+      std::string line;
+      write_record(line, record, ring->thread);
+      release_record(record);
+      lines.push_back({record.time, std::move(line)});
+    }
+    ring->tail.store(tail, std::memory_order_release);
+    const size_t dropped = ring->dropped.exchange(0);
+    if (dropped)
+      lines.push_back({log_time(), std::string(tag_of(WARNING)) +
+                                       std::to_string(dropped) +
+                                       " messages of thread T" +
+                                       std::to_string(ring->thread) +
+                                       " were dropped\n"});
+    if (!alive)
+      finished.push_back(ring);
+  }
+  if (!finished.empty()) {
+    const std::lock_guard<std::mutex> lk(rings_lock);
+    for (LogRing *ring : finished) {
+      std::erase(rings, ring);
+      delete ring;
+    }
+  }
+  if (lines.empty())
+    return;
+  std::stable_sort(lines.begin(), lines.end(),
+                   [](const auto &a, const auto &b) { return a.first < b.first; });
+  std::string out;
+  for (const auto &[time, line] : lines)
+    out += line;
+  std::fwrite(out.data(), 1, out.size(), stdout);
+  std::fflush(stdout);
+}
+void flush_logs() { state().drain(); }
+void log_throw(const LogRecord &record) {
+  // the exception carries the whole message, also if it is not logged
+  const std::string msg = format_record(record);
+  if (logging_level.load(std::memory_order_relaxed) >= 1) {
+    log_push(record);
+    flush_logs();
+  } else {
+    release_record(record);
+  }
+  throw std::runtime_error("error occured: " + msg);
+}
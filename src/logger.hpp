@@ -1,42 +1,172 @@
 #ifndef LOGGER_H
 #define LOGGER_H
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
 #include <experimental/source_location>
-#include <iostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
 // 0 no logging, 1 only errors, 2 errors and warnings, 3 error, warnings and
-// info, 4 verbose, 5 debugging messages for the library developers
-static int logging_level = 5;
+// info, 4 verbose, 5 debugging messages for the library developers.
+// Messages above the build time level are compiled out together with the
+// evaluation of their arguments (see CEL_LOG), the runtime level can only
+// lower it further.
+#ifndef CEL_LOG_LEVEL
+#define CEL_LOG_LEVEL 3
+#endif
+// bytes available inline for the arguments of one message, longer strings are
+// moved to the heap
+#define LOG_ARGS_SIZE 200
 enum LOGTYPE { DEBUG, VERBOSE, INFO, ERROR, WARNING };
-inline void log(LOGTYPE type, std::string msg,
-                const std::experimental::source_location loc =
-                    std::experimental::source_location::current()) {
-  using namespace std;
+constexpr int log_level_of(LOGTYPE type) {
   switch (type) {
   case DEBUG:
-    if (logging_level >= 5)
-      cout << "\033[0;33m[\033[0;32mDEBUG\033[0;33m]\033[0m " << msg << " [In "
-           << loc.file_name() << ":" << loc.line() << "]" << endl;
-    break;
+    return 5;
   case VERBOSE:
-    if (logging_level >= 4)
-      cout << "\033[0;33m[\033[0;35mVERBOSE\033[0;33m]\033[0m " << msg << endl;
-    break;
+    return 4;
   case INFO:
-    if (logging_level >= 3)
-
-      cout << "\033[0;33m[\033[0;36mINFO\033[0;33m]\033[0m " << msg << endl;
-    break;
+    return 3;
   case WARNING:
-    if (logging_level >= 2)
-      cout << "\033[0;33m[\033[0;33mWARNING\033[0;33m]\033[0m " << msg
-           << " [In " << loc.file_name() << ":" << loc.line() << "]" << endl;
-    break;
-  case ERROR:
-    if (logging_level >= 1)
-      cout << "\033[0;33m[\033[1;31mERROR\033[0;33m]\033[0m " << msg << " [In "
-           << loc.file_name() << ":" << loc.line() << "]" << endl;
-    throw std::runtime_error("error occured: " + msg);
+    return 2;
+  default:
+    return 1;
+  }
+}
+// errors are thrown even if they are not logged
+constexpr bool log_compiled(LOGTYPE type) {
+  return type == ERROR || log_level_of(type) <= CEL_LOG_LEVEL;
+}
+inline std::atomic<int> logging_level = CEL_LOG_LEVEL;
+/**
+ * Format string and location of a message. The format has to be a string
+ * literal, every "{}" in it is replaced by the next argument when the
+ * message is written.
+ */
+struct LogSite {
+  const char *format;
+  const char *file;
+  unsigned int line;
+  template <size_t N>
+  LogSite(const char (&format)[N],
+          const std::experimental::source_location loc =
+              std::experimental::source_location::current())
+      : format(format), file(loc.file_name()), line(loc.line()) {}
+};
+/**
+ * One message as it is passed to the background thread, the arguments are
+ * stored as tagged values and only formatted there
+ */
+struct LogRecord {
+  LOGTYPE type;
+  const char *format;
+  const char *file;
+  unsigned int line;
+  // nanoseconds of the steady clock
+  int64_t time;
+  uint16_t size = 0;
+  unsigned char args[LOG_ARGS_SIZE];
+  void put(char tag, const void *data, size_t bytes) {
+    if (size + 1 + bytes > LOG_ARGS_SIZE)
+      return;
+    args[size++] = tag;
+    std::memcpy(args + size, data, bytes);
+    size += bytes;
   }
+  void put(std::string_view str) {
+    if (size + 3 + str.size() <= LOG_ARGS_SIZE) {
+      const uint16_t len = str.size();
+      put('s', &len, sizeof(len));
+      std::memcpy(args + size, str.data(), len);
+      size += len;
+      return;
+    }
+    // freed by release_record once the record was formatted or dropped
+    if (size + 1 + sizeof(std::string *) > LOG_ARGS_SIZE)
+      return;
+    const std::string *spilled = new std::string(str);
+    put('h', &spilled, sizeof(spilled));
+  }
+  template <typename T> void put(const T &value) {
+    if constexpr (std::is_same_v<T, bool>) {
+      put('b', &value, sizeof(bool));
+    } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+      const int64_t v = value;
+      put('i', &v, sizeof(v));
+    } else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+      const uint64_t v = (uint64_t)value;
+      put('u', &v, sizeof(v));
+    } else if constexpr (std::is_floating_point_v<T>) {
+      const double v = value;
+      put('d', &v, sizeof(v));
+    } else if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+      put(std::string_view(value));
+    } else {
+      static_assert(std::is_pointer_v<T>, "Unsupported log argument!");
+      const void *v = value;
+      put('p', &v, sizeof(v));
+    }
+  }
+};
+/**
+ * Appends the record to the ring buffer of the calling thread without
+ * locking, it is dropped if the buffer is full. The ring takes over the
+ * strings the record moved to the heap.
+ */
+void log_push(const LogRecord &record);
+/**
+ * Frees the strings the record moved to the heap
+ */
+void release_record(const LogRecord &record);
+/**
+ * Writes the record and everything queued before it, then throws
+ */
+[[noreturn]] void log_throw(const LogRecord &record);
+/**
+ * Blocks until all queued messages are written
+ */
+void flush_logs();
+std::string format_record(const LogRecord &record);
+int64_t log_time();
+/**
+ * Logs a message of the given type, e.g.
+ *   CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", name);
+ * Messages above CEL_LOG_LEVEL are discarded at compile time without
+ * evaluating their arguments. Errors are thrown after they were written.
+ */
+#define CEL_LOG(type, ...)              \
+  do {                                  \
+    if constexpr (log_compiled(type))   \
+      log<type>(__VA_ARGS__);           \
+  } while (0)
+template <LOGTYPE type, typename... Args>
+inline void log(LogSite site, const Args &...args) {
+  if (type != ERROR &&
+      log_level_of(type) > logging_level.load(std::memory_order_relaxed))
+    return;
+  LogRecord record;
+  record.type = type;
+  record.format = site.format;
+  record.file = site.file;
+  record.line = site.line;
+  record.time = log_time();
+  (record.put(args), ...);
+  if (type == ERROR)
+    log_throw(record);
+  log_push(record);
+}
+/**
+ * Logs a message that was already formatted
+ */
+template <LOGTYPE type, typename S>
+  requires std::same_as<std::decay_t<S>, std::string>
+inline void log(S &&msg,
+                const std::experimental::source_location loc =
+                    std::experimental::source_location::current()) {
+  log<type>(LogSite("{}", loc), msg);
 }
-inline void info(std::string msg) noexcept { log(INFO, msg); }
+inline void info(std::string msg) noexcept { CEL_LOG(INFO, msg); }
 inline void set_logger_level(int level) { logging_level = level; }
 #endif
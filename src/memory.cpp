@@ -0,0 +1,118 @@
+#include "memory.hpp"
+#include <GLFW/glfw3.h>
+#include <mutex>
+#include <unordered_map>
+#include "src/logger.hpp"
+struct WindowMemory {
+	CelMemoryStats stats = {};
+	// size of every tracked object, keyed by category and id
+	std::unordered_map<uint64_t, size_t> objects;
+	size_t budget = 0;
+	void (*callback)(CelWin *, const CelMemoryStats *) = nullptr;
+	// the budget is exceeded resp. the callback still has to be called
+	bool over = false, pending = false;
+};
+static std::mutex memory_lock;
+static std::unordered_map<CelWin *, WindowMemory> memory;
+static std::unordered_map<GLFWwindow *, CelWin *> contexts;
+static uint64_t object_key(CelMemoryCategory category, uint64_t id) {
+	return id ^ (uint64_t)category << 56;
+}
+// the memory lock has to be held
+static WindowMemory &current_memory() {
+	auto it = contexts.find(glfwGetCurrentContext());
+	return memory[it == contexts.end() ? nullptr : it->second];
+}
+static void update_budget(WindowMemory &m) {
+	const bool over = m.budget && m.stats.gpu_total > m.budget;
+	if (over && !m.over)
+		m.pending = true;
+	m.over = over;
+}
+void track_memory(CelMemoryCategory category, uint64_t id, size_t bytes) {
+	const std::lock_guard<std::mutex> lk(memory_lock);
+	WindowMemory &m = current_memory();
+	auto [it, inserted] = m.objects.insert({object_key(category, id), 0});
+	if (inserted)
+		m.stats.count[category]++;
+	size_t &total =
+		category == CEL_MEMORY_HOST ? m.stats.host_total : m.stats.gpu_total;
+	m.stats.bytes[category] += bytes - it->second;
+	total += bytes - it->second;
+	it->second = bytes;
+	update_budget(m);
+}
+void untrack_memory(CelMemoryCategory category, uint64_t id) {
+	const std::lock_guard<std::mutex> lk(memory_lock);
+	WindowMemory &m = current_memory();
+	auto it = m.objects.find(object_key(category, id));
+	if (it == m.objects.end())
+		return;
+	size_t &total =
+		category == CEL_MEMORY_HOST ? m.stats.host_total : m.stats.gpu_total;
+	m.stats.bytes[category] -= it->second;
+	m.stats.count[category]--;
+	total -= it->second;
+	m.objects.erase(it);
+	update_budget(m);
+}
+void register_context(GLFWwindow *context, CelWin *win) {
+	const std::lock_guard<std::mutex> lk(memory_lock);
+	contexts[context] = win;
+}
+void unregister_context(GLFWwindow *context) {
+	const std::lock_guard<std::mutex> lk(memory_lock);
+	contexts.erase(context);
+}
+void check_memory_budget(CelWin *win) {
+	CelMemoryStats stats;
+	void (*callback)(CelWin *, const CelMemoryStats *);
+	{
+		const std::lock_guard<std::mutex> lk(memory_lock);
+		auto it = memory.find(win);
+		if (it == memory.end() || !it->second.pending)
+			return;
+		it->second.pending = false;
+		stats = it->second.stats;
+		callback = it->second.callback;
+	}
+	if (callback)
+		callback(win, &stats);
+}
+void release_memory_stats(CelWin *win) {
+	const std::lock_guard<std::mutex> lk(memory_lock);
+	auto it = memory.find(win);
+	if (it == memory.end())
+		return;
+	const CelMemoryStats &stats = it->second.stats;
+	if (!it->second.objects.empty())
+		CEL_LOG(WARNING,
+			"Window \"{}\" leaked {} objects, {} bytes of GPU and {} bytes of "
+			"host memory!",
+			win->name, it->second.objects.size(), stats.gpu_total,
+			stats.host_total);
+	memory.erase(it);
+}
+void cel_get_memory_stats(CelWin *win, CelMemoryStats *stats) {
+	const std::lock_guard<std::mutex> lk(memory_lock);
+	*stats = {};
+	for (const auto &[w, m] : memory) {
+		if (win && w != win)
+			continue;
+		for (int c = 0; c < CEL_MEMORY_CATEGORIES; c++) {
+			stats->bytes[c] += m.stats.bytes[c];
+			stats->count[c] += m.stats.count[c];
+		}
+		stats->gpu_total += m.stats.gpu_total;
+		stats->host_total += m.stats.host_total;
+	}
+}
+void cel_set_memory_budget(CelWin *win, size_t bytes,
+						   void (*callback)(CelWin *, const CelMemoryStats *)) {
+	const std::lock_guard<std::mutex> lk(memory_lock);
+	WindowMemory &m = memory[win];
+	m.budget = bytes;
+	m.callback = callback;
+	m.over = false;
+	update_budget(m);
+}
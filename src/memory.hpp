@@ -0,0 +1,30 @@
+#ifndef MEMORY_HPP
+#define MEMORY_HPP
+#include <cstddef>
+#include <cstdint>
+#include "celerityui.h"
+/**
+ * Accounting of the memory allocated for OpenGL objects and their CPU side
+ * copies. Allocations are attributed to the window whose context (or a
+ * context registered for it) is current on the calling thread, objects are
+ * identified by their OpenGL name resp. the address of the owner for host
+ * memory. Tracking an object again replaces its previous size.
+ */
+void track_memory(CelMemoryCategory category, uint64_t id, size_t bytes);
+void untrack_memory(CelMemoryCategory category, uint64_t id);
+/**
+ * Attributes allocations made while the context is current to the window
+ */
+void register_context(GLFWwindow *context, CelWin *win);
+void unregister_context(GLFWwindow *context);
+/**
+ * Calls the budget callback of the window if it exceeded its budget since the
+ * last check, has to be called without holding the gl lock
+ */
+void check_memory_budget(CelWin *win);
+/**
+ * Drops the accounting of a destroyed window after all of its objects were
+ * released, remaining objects are reported as leaks
+ */
+void release_memory_stats(CelWin *win);
+#endif
@@ -0,0 +1,61 @@
+#include "occlusion.hpp"
+#include <algorithm>
+#include <cmath>
+void CoverageBuffer::reset(int w, int h) {
+	width = std::max(w, 0);
+	height = std::max(h, 0);
+	tiles_x = (width + OCCLUSION_TILE - 1) / OCCLUSION_TILE;
+	tiles_y = (height + OCCLUSION_TILE - 1) / OCCLUSION_TILE;
+	covered.assign((size_t)tiles_x * tiles_y, 0);
+}
+bool CoverageBuffer::touched(const PixelBounds &b, int range[4]) const {
+	const float left = std::max(b.left, 0.0f),
+				top = std::max(b.top, 0.0f),
+				right = std::min(b.right, (float)width),
+				bottom = std::min(b.bottom, (float)height);
+	if (!(left < right && top < bottom))
+		return false;
+	range[0] = (int)(left / OCCLUSION_TILE);
+	range[1] = (int)(top / OCCLUSION_TILE);
+	range[2] = std::min((int)std::ceil(right / OCCLUSION_TILE), tiles_x);
+	range[3] = std::min((int)std::ceil(bottom / OCCLUSION_TILE), tiles_y);
+	return true;
+}
+bool CoverageBuffer::inside(const PixelBounds &b, int range[4]) const {
+	// clamped first, bounds may be infinite
+	const float left = std::clamp(b.left, 0.0f, (float)width),
+				top = std::clamp(b.top, 0.0f, (float)height),
+				right = std::clamp(b.right, 0.0f, (float)width),
+				bottom = std::clamp(b.bottom, 0.0f, (float)height);
+	range[0] = (int)std::ceil(left / OCCLUSION_TILE);
+	range[1] = (int)std::ceil(top / OCCLUSION_TILE);
+	// tiles at the right and bottom border end with the window
+	range[2] = right >= width ? tiles_x : (int)(right / OCCLUSION_TILE);
+	range[3] = bottom >= height ? tiles_y : (int)(bottom / OCCLUSION_TILE);
+	return range[0] < range[2] && range[1] < range[3];
+}
+bool CoverageBuffer::add(const PixelBounds &b) {
+	int r[4];
+	if (!inside(b, r) ||
+		(r[2] - r[0]) * (r[3] - r[1]) < MIN_OCCLUDER_TILES)
+		return false;
+	for (int y = r[1]; y < r[3]; y++)
+		std::fill(covered.begin() + (size_t)y * tiles_x + r[0],
+				  covered.begin() + (size_t)y * tiles_x + r[2], 1);
+	return true;
+}
+bool CoverageBuffer::occludes(const PixelBounds &b) const {
+	int r[4];
+	if (!touched(b, r))
+		return true;
+	for (int y = r[1]; y < r[3]; y++)
+		for (int x = r[0]; x < r[2]; x++)
+			if (!covered[(size_t)y * tiles_x + x])
+				return false;
+	return true;
+}
+float CoverageBuffer::visible_area(const PixelBounds &b) const {
+	const float w = std::min(b.right, (float)width) - std::max(b.left, 0.0f),
+				h = std::min(b.bottom, (float)height) - std::max(b.top, 0.0f);
+	return w > 0 && h > 0 ? w * h : 0;
+}
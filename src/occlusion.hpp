@@ -0,0 +1,49 @@
+#ifndef OCCLUSION_HPP
+#define OCCLUSION_HPP
+#include <cstdint>
+#include <vector>
+// edge length of a coverage tile in pixels
+#define OCCLUSION_TILE 16
+// occluders have to cover at least this many tiles completely
+#define MIN_OCCLUDER_TILES 4
+/**
+ * Bounds in pixels from the top left corner of the window
+ */
+struct PixelBounds {
+	float left, top, right, bottom;
+};
+/**
+ * Coarse coverage of the window by opaque occluders. A tile is covered once an
+ * occluder covers all of its pixels, bounds are occluded if all tiles they
+ * touch are covered. Occluders have to be added front to back.
+ */
+class CoverageBuffer {
+	int width = 0, height = 0, tiles_x = 0, tiles_y = 0;
+	std::vector<uint8_t> covered;
+	/**
+	 * Range of tiles touched by the bounds, resp. completely inside them
+	 * @return false if the range is empty
+	 */
+	bool touched(const PixelBounds &b, int range[4]) const;
+	bool inside(const PixelBounds &b, int range[4]) const;
+
+   public:
+	/**
+	 * Uncovers all tiles of a window of the given size
+	 */
+	void reset(int width, int height);
+	/**
+	 * Covers the tiles completely inside the bounds
+	 * @return false if the bounds are too small to be an occluder
+	 */
+	bool add(const PixelBounds &b);
+	/**
+	 * True if the bounds are covered or outside of the window
+	 */
+	bool occludes(const PixelBounds &b) const;
+	/**
+	 * Area of the bounds inside the window in pixels
+	 */
+	float visible_area(const PixelBounds &b) const;
+};
+#endif
@@ -0,0 +1,499 @@
+#include "paths.hpp"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include "src/celerityui.h"
+#include "src/internal.hpp"
+#include "src/ubo.hpp"
+std::unordered_map<CelWin *, PathRenderer *> path_renderer;
+// maximum distance in pixels between a curve and its flattened polyline
+#define CURVE_TOLERANCE 0.25f
+CelPath *cel_create_path(CelWin *win, float stroke_width,
+						 CelColorRGBA stroke) {
+	CelPath *path = new CelPath();
+	path->origin = win;
+	path->stroke_width = stroke_width;
+	path->stroke = stroke;
+	{
+		using namespace std;
+		const lock_guard<mutex> lk(Internal::gl_lock);
+		Internal::damage(win);
+		glfwMakeContextCurrent(win->window);
+		if (!path_renderer.contains(win))
+			path_renderer.insert({win, new PathRenderer()});
+		path_renderer[win]->add(path);
+		glfwMakeContextCurrent(nullptr);
+	}
+	return path;
+}
+void cel_delete_path(CelWin *win, CelPath *path) {
+	{
+		using namespace std;
+		const lock_guard<mutex> lk(Internal::gl_lock);
+		Internal::damage(win);
+		path_renderer[win]->remove(path);
+	}
+	delete path;
+}
+static void add_point(CelPath *path, float x, float y) {
+	if (path->subpaths.empty()) {
+		path->subpaths.push_back({});
+		path->closed.push_back(false);
+	}
+	path->subpaths.back().push_back(x);
+	path->subpaths.back().push_back(y);
+	path->fill_from = std::min(path->fill_from, path->subpaths.size() - 1);
+}
+static void current_point(const CelPath *path, float &x, float &y) {
+	if (path->subpaths.empty() || path->subpaths.back().empty()) {
+		x = y = 0;
+		return;
+	}
+	const std::vector<float> &points = path->subpaths.back();
+	x = points[points.size() - 2];
+	y = points[points.size() - 1];
+}
+// number of line segments a curve with the given control polygon length in
+// NDC needs to stay within CURVE_TOLERANCE
+static int curve_segments(const CelPath *path, float control_length) {
+	const float pixels = control_length * 0.5f *
+						 std::max(path->origin->width, path->origin->height);
+	return std::clamp((int)std::ceil(std::sqrt(pixels / CURVE_TOLERANCE)), 1,
+					  256);
+}
+void cel_path_move_to(CelPath *path, float x, float y) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(path->origin);
+	if (path->subpaths.empty() || !path->subpaths.back().empty()) {
+		path->subpaths.push_back({});
+		path->closed.push_back(false);
+	}
+	add_point(path, x, y);
+}
+void cel_path_line_to(CelPath *path, float x, float y) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(path->origin);
+	add_point(path, x, y);
+}
+void cel_path_append_points(CelPath *path, const float *xy, int count) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(path->origin);
+	if (path->subpaths.empty()) {
+		path->subpaths.push_back({});
+		path->closed.push_back(false);
+	}
+	path->subpaths.back().insert(path->subpaths.back().end(), xy,
+								 xy + 2 * count);
+	path->fill_from = std::min(path->fill_from, path->subpaths.size() - 1);
+}
+void cel_path_quad_to(CelPath *path, float cx, float cy, float x, float y) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(path->origin);
+	float x0, y0;
+	current_point(path, x0, y0);
+	const int n = curve_segments(path, hypot(cx - x0, cy - y0) +
+										   hypot(x - cx, y - cy));
+	for (int i = 1; i <= n; i++) {
+		const float t = (float)i / n, u = 1 - t;
+		add_point(path, u * u * x0 + 2 * u * t * cx + t * t * x,
+				  u * u * y0 + 2 * u * t * cy + t * t * y);
+	}
+}
+void cel_path_cubic_to(CelPath *path, float c1x, float c1y, float c2x,
+					   float c2y, float x, float y) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(path->origin);
+	float x0, y0;
+	current_point(path, x0, y0);
+	const int n = curve_segments(path, hypot(c1x - x0, c1y - y0) +
+										   hypot(c2x - c1x, c2y - c1y) +
+										   hypot(x - c2x, y - c2y));
+	for (int i = 1; i <= n; i++) {
+		const float t = (float)i / n, u = 1 - t;
+		const float a = u * u * u, b = 3 * u * u * t, c = 3 * u * t * t,
+					d = t * t * t;
+		add_point(path, a * x0 + b * c1x + c * c2x + d * x,
+				  a * y0 + b * c1y + c * c2y + d * y);
+	}
+}
+void cel_path_close(CelPath *path) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(path->origin);
+	if (path->subpaths.empty() || path->subpaths.back().size() < 4)
+		return;
+	const std::vector<float> &points = path->subpaths.back();
+	const float x = points[0], y = points[1];
+	// the closing segment is an ordinary segment, the next subpath starts at
+	// the start of this one
+	add_point(path, x, y);
+	path->closed.back() = true;
+	path->subpaths.push_back({x, y});
+	path->closed.push_back(false);
+}
+void cel_path_clear(CelPath *path) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(path->origin);
+	path->subpaths.clear();
+	path->closed.clear();
+	path->stroke_dirty = true;
+	path->fill_from = 0;
+}
+void cel_path_set_stroke(CelPath *path, float stroke_width,
+						 CelColorRGBA stroke) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(path->origin);
+	path->stroke_width = stroke_width;
+	path->stroke = stroke;
+	path->stroke_dirty = true;
+}
+void cel_path_set_fill(CelPath *path, int filled, CelColorRGBA fill) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(path->origin);
+	path->filled = filled;
+	path->fill = fill;
+	path->fill_from = 0;
+}
+void cel_path_set_layer(CelPath *path, int layer) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(path->origin);
+	path->layer = layer;
+	path->layer_dirty = true;
+}
+void enqueue_paths(CelWin *win, RenderQueue &queue) {
+	if (path_renderer.contains(win))
+		path_renderer[win]->enqueue(queue, win->width, win->height);
+}
+void destroy_paths(CelWin *win) {
+	auto it = path_renderer.find(win);
+	if (it == path_renderer.end())
+		return;
+	it->second->clean_up();
+	delete it->second;
+	path_renderer.erase(it);
+}
+void cel_render_paths(CelWin *win) {
+	RenderQueue queue;
+	enqueue_paths(win, queue);
+	queue.submit();
+}
+const std::string primitive_traits<SegmentInstance>::vertex_src = R"(
+#version 400
+)" FRAME_UBO_GLSL R"(
+layout (location = 0) in vec2 pos;
+layout (location = 1) in vec2 from;
+layout (location = 2) in vec2 to;
+layout (location = 3) in float width;
+layout (location = 4) in vec4 color;
+out vec4 out_color;
+flat out vec2 px_from;
+flat out vec2 px_to;
+flat out float radius;
+void main() {
+  // work in pixels so the anti-aliasing ramp is one pixel wide
+  px_from = (from * 0.5 + 0.5) * window_size;
+  px_to = (to * 0.5 + 0.5) * window_size;
+  radius = width / 2;
+  vec2 dir = px_to - px_from;
+  float len = length(dir);
+  dir = len > 0 ? dir / len : vec2(1, 0);
+  vec2 normal = vec2(-dir.y, dir.x);
+  // cover the capsule around the segment plus one pixel for the ramp
+  float r = radius + 1;
+  vec2 px = mix(px_from - dir * r, px_to + dir * r, pos.x) +
+            normal * mix(-r, r, -pos.y);
+  out_color = color;
+  gl_Position = view * vec4(px / window_size * 2 - 1, 0.0, 1.0);
+}
+)";
+const std::string primitive_traits<SegmentInstance>::fragment_src = R"(
+#version 400
+in vec4 out_color;
+flat in vec2 px_from;
+flat in vec2 px_to;
+flat in float radius;
+out vec4 final_color;
+void main() {
+  vec2 p = gl_FragCoord.xy - px_from;
+  vec2 d = px_to - px_from;
+  float t = clamp(dot(p, d) / max(dot(d, d), 1e-6), 0, 1);
+  float dist = length(p - d * t);
+  float coverage = clamp(radius + 0.5 - dist, 0, 1);
+  final_color = vec4(out_color.rgb, out_color.a * coverage);
+}
+)";
+const std::string primitive_traits<TriangleInstance>::vertex_src = R"(
+#version 400
+)" FRAME_UBO_GLSL R"(
+layout (location = 0) in vec2 pos;
+layout (location = 1) in vec2 a;
+layout (location = 2) in vec2 b;
+layout (location = 3) in vec2 c;
+layout (location = 4) in vec4 color;
+out vec4 out_color;
+void main() {
+  // the corners (0, 0) and (0, -1) of the quad pick a and b, the other two
+  // collapse onto c so the second triangle of the quad is degenerated
+  vec2 p = pos.x > 0.5 ? c : (pos.y < -0.5 ? b : a);
+  out_color = color;
+  gl_Position = view * vec4(p, 0.0, 1.0);
+}
+)";
+const std::string primitive_traits<TriangleInstance>::fragment_src = R"(
+#version 400
+in vec4 out_color;
+out vec4 final_color;
+void main() {
+  final_color = out_color;
+}
+)";
+static uint8_t to_unorm8(float v) {
+	return (uint8_t)(std::clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+PathRenderer::PathRenderer() {
+	strokes.get_program().bind_uniform_block("Frame", FRAME_UBO_BINDING);
+	fills.get_program().bind_uniform_block("Frame", FRAME_UBO_BINDING);
+}
+void PathRenderer::add(CelPath *path) { paths.push_back(path); }
+void PathRenderer::release(CelPath *path) {
+	for (auto handle : path->segments)
+		strokes.remove(handle);
+	for (auto handle : path->triangles)
+		fills.remove(handle);
+	path->segments.clear();
+	path->triangles.clear();
+	path->fill_starts.clear();
+}
+void PathRenderer::remove(CelPath *path) {
+	release(path);
+	paths.erase(std::find(paths.begin(), paths.end(), path));
+}
+void PathRenderer::tessellate_stroke(CelPath *path) {
+	if (path->stroke_dirty) {
+		for (auto handle : path->segments)
+			strokes.remove(handle);
+		path->segments.clear();
+		path->stroked_subpaths = 0;
+		path->stroked_points = 0;
+		path->stroke_dirty = false;
+		path->bounds[0] = path->bounds[1] = FLT_MAX;
+		path->bounds[2] = path->bounds[3] = -FLT_MAX;
+	}
+	const CelColorRGBA &c = path->stroke;
+	SegmentInstance segment = {{0, 0},
+							   {0, 0},
+							   path->stroke_width,
+							   {to_unorm8(c.r), to_unorm8(c.g),
+								to_unorm8(c.b), to_unorm8(c.a)}};
+	// only the points appended since the last tessellation are new segments
+	for (size_t s = path->stroked_subpaths; s < path->subpaths.size(); s++) {
+		const std::vector<float> &points = path->subpaths[s];
+		const size_t n = points.size() / 2;
+		size_t i = s == path->stroked_subpaths ? path->stroked_points : 0;
+		for (i = std::max<size_t>(i, 1); i < n; i++) {
+			segment.from[0] = points[2 * i - 2];
+			segment.from[1] = points[2 * i - 1];
+			segment.to[0] = points[2 * i];
+			segment.to[1] = points[2 * i + 1];
+			for (const float *p : {segment.from, segment.to}) {
+				path->bounds[0] = std::min(path->bounds[0], p[0]);
+				path->bounds[1] = std::min(path->bounds[1], p[1]);
+				path->bounds[2] = std::max(path->bounds[2], p[0]);
+				path->bounds[3] = std::max(path->bounds[3], p[1]);
+			}
+			path->segments.push_back(
+				strokes.add(segment, batch_group(path->layer, true)));
+		}
+		path->stroked_subpaths = s;
+		path->stroked_points = n;
+	}
+}
+static float cross(const float *o, const float *a, const float *b) {
+	return (a[0] - o[0]) * (b[1] - o[1]) - (a[1] - o[1]) * (b[0] - o[0]);
+}
+static bool in_triangle(const float *p, const float *a, const float *b,
+						const float *c) {
+	return cross(a, b, p) >= 0 && cross(b, c, p) >= 0 && cross(c, a, p) >= 0;
+}
+// triangulates one implicitly closed subpath by ear clipping. Only reflex
+// vertices can lie inside an ear and clipping never turns a convex vertex
+// into a reflex one, so only the reflex vertices of the subpath are tested.
+void PathRenderer::triangulate(CelPath *path, const std::vector<float> &points,
+							   TriangleInstance &triangle) {
+	size_t n = points.size() / 2;
+	if (n >= 2 && points[0] == points[2 * n - 2] &&
+		points[1] == points[2 * n - 1])
+		n--;
+	if (n < 3)
+		return;
+	float area = 0;
+	for (size_t i = 0; i < n; i++) {
+		const size_t j = (i + 1) % n;
+		area += points[2 * i] * points[2 * j + 1] -
+				points[2 * j] * points[2 * i + 1];
+	}
+	// counter clockwise order of the remaining polygon
+	std::vector<size_t> polygon(n);
+	for (size_t i = 0; i < n; i++)
+		polygon[i] = area >= 0 ? i : n - 1 - i;
+	std::vector<size_t> reflex;
+	for (size_t i = 0; i < n; i++) {
+		const float *a = &points[2 * polygon[(i + n - 1) % n]];
+		const float *b = &points[2 * polygon[i]];
+		const float *d = &points[2 * polygon[(i + 1) % n]];
+		if (cross(a, b, d) <= 0)
+			reflex.push_back(polygon[i]);
+	}
+	std::vector<bool> clipped(n, false);
+	size_t misses = 0;
+	for (size_t i = 0; polygon.size() > 2 && misses < polygon.size();) {
+		const size_t m = polygon.size();
+		const size_t ia = polygon[(i + m - 1) % m], ib = polygon[i % m],
+					 id = polygon[(i + 1) % m];
+		const float *a = &points[2 * ia];
+		const float *b = &points[2 * ib];
+		const float *d = &points[2 * id];
+		bool ear = cross(a, b, d) > 0;
+		for (size_t k = 0; ear && k < reflex.size(); k++) {
+			const size_t r = reflex[k];
+			if (!clipped[r] && r != ia && r != ib && r != id &&
+				in_triangle(&points[2 * r], a, b, d))
+				ear = false;
+		}
+		if (!ear) {
+			i = (i + 1) % m;
+			misses++;
+			continue;
+		}
+		std::copy(a, a + 2, triangle.a);
+		std::copy(b, b + 2, triangle.b);
+		std::copy(d, d + 2, triangle.c);
+		path->triangles.push_back(
+			fills.add(triangle, batch_group(path->layer, true)));
+		clipped[ib] = true;
+		polygon.erase(polygon.begin() + i % m);
+		misses = 0;
+	}
+}
+void PathRenderer::tessellate_fill(CelPath *path) {
+	// the triangles of the subpaths before fill_from are kept
+	const size_t from = std::min(path->filled ? path->fill_from : 0,
+								 path->fill_starts.size());
+	const size_t first = from < path->fill_starts.size()
+							 ? path->fill_starts[from]
+							 : path->triangles.size();
+	for (size_t k = first; k < path->triangles.size(); k++)
+		fills.remove(path->triangles[k]);
+	path->triangles.resize(first);
+	path->fill_starts.resize(from);
+	path->fill_from = SIZE_MAX;
+	if (!path->filled)
+		return;
+	const CelColorRGBA &c = path->fill;
+	TriangleInstance triangle = {{0, 0},
+								 {0, 0},
+								 {0, 0},
+								 {to_unorm8(c.r), to_unorm8(c.g),
+								  to_unorm8(c.b), to_unorm8(c.a)}};
+	for (size_t s = from; s < path->subpaths.size(); s++) {
+		path->fill_starts.push_back(path->triangles.size());
+		triangulate(path, path->subpaths[s], triangle);
+	}
+}
+void PathRenderer::enqueue(RenderQueue &queue, int width, int height) {
+	for (CelPath *path : paths) {
+		if (path->layer_dirty) {
+			// paths are anti-aliased and therefore always translucent
+			const int group = batch_group(path->layer, true);
+			for (auto handle : path->segments)
+				strokes.set_group(handle, group);
+			for (auto handle : path->triangles)
+				fills.set_group(handle, group);
+			path->layer_dirty = false;
+		}
+		// the geometry changes of the whole frame are tessellated at once
+		tessellate_stroke(path);
+		if (path->fill_from != SIZE_MAX)
+			tessellate_fill(path);
+	}
+	// the commands only change when instances moved or the pixel size of the
+	// strokes did
+	if (fills.get_slot_version() != fills_version ||
+		strokes.get_slot_version() != strokes_version ||
+		width != levels_width || height != levels_height) {
+		build_levels(width, height);
+		fills_version = fills.get_slot_version();
+		strokes_version = strokes.get_slot_version();
+		levels_width = width;
+		levels_height = height;
+	}
+	// paths are translucent, so their depth orders them back to front: a
+	// level is drawn over the lower ones and its fills below its strokes
+	for (const Level &l : levels) {
+		fills.enqueue_commands(queue, l.fill, l.layer, true, 2 * l.level);
+		strokes.enqueue_commands(queue, l.stroke, l.layer, true,
+								 2 * l.level + 1);
+	}
+}
+void PathRenderer::build_levels(int width, int height) {
+	// strokes reach half their width and the anti-aliasing ramp beyond the
+	// points, in pixels converted to normalized device coordinates
+	const float to_x = 2.0f / std::max(width, 1),
+				to_y = 2.0f / std::max(height, 1);
+	const auto overlap = [&](const CelPath *a, const CelPath *b) {
+		const float reach = (a->stroke_width + b->stroke_width) / 2 + 2;
+		return a->bounds[0] <= b->bounds[2] + reach * to_x &&
+			   b->bounds[0] <= a->bounds[2] + reach * to_x &&
+			   a->bounds[1] <= b->bounds[3] + reach * to_y &&
+			   b->bounds[1] <= a->bounds[3] + reach * to_y;
+	};
+	// a path is drawn over every earlier path of its layer it overlaps
+	for (size_t i = 0; i < paths.size(); i++) {
+		CelPath *path = paths[i];
+		path->level = 0;
+		for (size_t j = 0; j < i; j++) {
+			const CelPath *below = paths[j];
+			if (below->layer == path->layer && below->level >= path->level &&
+				overlap(path, below))
+				path->level = below->level + 1;
+		}
+	}
+	std::vector<CelPath *> order(paths);
+	std::stable_sort(order.begin(), order.end(),
+					 [](const CelPath *a, const CelPath *b) {
+						 return a->layer != b->layer ? a->layer < b->layer
+													 : a->level < b->level;
+					 });
+	levels.clear();
+	std::vector<BatchRenderer<TriangleInstance>::handle> triangles;
+	std::vector<BatchRenderer<SegmentInstance>::handle> segments;
+	for (size_t i = 0; i < order.size();) {
+		size_t j = i;
+		triangles.clear();
+		segments.clear();
+		for (; j < order.size() && order[j]->layer == order[i]->layer &&
+			   order[j]->level == order[i]->level;
+			 j++) {
+			triangles.insert(triangles.end(), order[j]->triangles.begin(),
+							 order[j]->triangles.end());
+			segments.insert(segments.end(), order[j]->segments.begin(),
+							order[j]->segments.end());
+		}
+		Level &l = levels.emplace_back();
+		l.layer = order[i]->layer;
+		l.level = order[i]->level;
+		fills.commands_of(triangles, l.fill);
+		strokes.commands_of(segments, l.stroke);
+		i = j;
+	}
+}
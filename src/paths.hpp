@@ -0,0 +1,136 @@
+#ifndef PATHS_HPP
+#define PATHS_HPP
+#include "batch.hpp"
+#include "celerityui.h"
+#include "render_queue.hpp"
+#include <cfloat>
+#include <cstdint>
+#include <string>
+#include <vector>
+/**
+ * One line segment of a stroked path, expanded to a quad in the vertex shader
+ * and anti-aliased with a coverage ramp in the fragment shader
+ */
+struct SegmentInstance {
+	float from[2];
+	float to[2];
+	// in pixels
+	float width;
+	uint8_t color[4];
+};
+/**
+ * One triangle of a filled path, drawn with the shared quad by collapsing its
+ * fourth corner onto the third
+ */
+struct TriangleInstance {
+	float a[2];
+	float b[2];
+	float c[2];
+	uint8_t color[4];
+};
+template <>
+struct primitive_traits<SegmentInstance> {
+	using layout = VertexLayout<SegmentInstance,
+								CEL_ATTRIB(SegmentInstance, from, false),
+								CEL_ATTRIB(SegmentInstance, to, false),
+								CEL_ATTRIB(SegmentInstance, width, false),
+								CEL_ATTRIB(SegmentInstance, color, true)>;
+	static const std::string vertex_src;
+	static const std::string fragment_src;
+};
+template <>
+struct primitive_traits<TriangleInstance> {
+	using layout = VertexLayout<TriangleInstance,
+								CEL_ATTRIB(TriangleInstance, a, false),
+								CEL_ATTRIB(TriangleInstance, b, false),
+								CEL_ATTRIB(TriangleInstance, c, false),
+								CEL_ATTRIB(TriangleInstance, color, true)>;
+	static const std::string vertex_src;
+	static const std::string fragment_src;
+};
+/**
+ * A path consists of subpaths of flattened points. Its tessellation into
+ * segments and triangles is cached in the PathRenderer of its window and only
+ * redone when the next frame is rendered if the geometry changed. Points
+ * appended to the last subpath only add the new segments and only
+ * re-triangulate the fill of the last subpath.
+ */
+struct CelPath {
+	CelWin *origin;
+	float stroke_width;
+	CelColorRGBA stroke;
+	CelColorRGBA fill;
+	bool filled = false;
+	int layer = 0;
+	// flattened subpaths as interleaved x, y coordinates
+	std::vector<std::vector<float>> subpaths;
+	std::vector<bool> closed;
+	// tessellation state
+	std::vector<BatchRenderer<SegmentInstance>::handle> segments;
+	std::vector<BatchRenderer<TriangleInstance>::handle> triangles;
+	// number of subpaths and points of the last subpath already tessellated
+	size_t stroked_subpaths = 0;
+	size_t stroked_points = 0;
+	// first slot in triangles of every triangulated subpath
+	std::vector<size_t> fill_starts;
+	bool stroke_dirty = true;
+	// first subpath whose fill has to be triangulated again, SIZE_MAX if the
+	// fill is up to date
+	size_t fill_from = 0;
+	bool layer_dirty = false;
+	// bounding box of the stroked points as min x, min y, max x, max y
+	float bounds[4] = {FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX};
+	// depth level within the layer, paths only get a higher level than the
+	// paths they overlap
+	uint32_t level = 0;
+};
+class PathRenderer {
+	BatchRenderer<SegmentInstance> strokes;
+	BatchRenderer<TriangleInstance> fills;
+	// in creation order, which is the paint order within a layer
+	std::vector<CelPath *> paths;
+	// the paths of one level of a layer don't overlap, so their fills and
+	// their strokes are drawn by one item each
+	struct Level {
+		int layer;
+		uint32_t level;
+		std::vector<DrawElementsIndirectCommand> fill, stroke;
+	};
+	std::vector<Level> levels;
+	// slot versions and window size the levels were built for
+	uint64_t fills_version = UINT64_MAX, strokes_version = UINT64_MAX;
+	int levels_width = 0, levels_height = 0;
+	void build_levels(int width, int height);
+	void tessellate_stroke(CelPath *path);
+	void tessellate_fill(CelPath *path);
+	void triangulate(CelPath *path, const std::vector<float> &points,
+					 TriangleInstance &triangle);
+	void release(CelPath *path);
+
+   public:
+	PathRenderer();
+	void add(CelPath *path);
+	void remove(CelPath *path);
+	/**
+	 * Tessellates the changed paths and adds them to the queue
+	 * @param width, height size of the window in pixels
+	 */
+	void enqueue(RenderQueue &queue, int width, int height);
+	/**
+	 * Replaces Destructor, cleans up all OpenGL related data.
+	 */
+	void clean_up() {
+		strokes.clean_up();
+		fills.clean_up();
+	}
+};
+/**
+ * Adds the paths of the window to the render queue of the frame
+ */
+void enqueue_paths(CelWin *win, RenderQueue &queue);
+/**
+ * Releases the path renderer of a window before it is destroyed, its context has to
+ * be current
+ */
+void destroy_paths(CelWin *win);
+#endif
@@ -0,0 +1,225 @@
+#include "rect_sets.hpp"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <unordered_map>
+#include "src/internal.hpp"
+#include "src/logger.hpp"
+#include "src/ubo.hpp"
+// instances one region of a new set holds, the stream grows on demand
+#define RECT_SET_CAPACITY 1024
+static std::unordered_map<CelWin *, RectSetRenderer *> rect_set_renderer;
+using rect_set_layout = primitive_traits<CelRectSetInstance>::layout;
+// element i of a strided array
+template <typename T>
+static inline const T *element(const T *array, size_t stride, size_t i) {
+	return (const T *)((const char *)array + i * stride);
+}
+static uint8_t to_unorm8(float v) {
+	return (uint8_t)(std::clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+void CelRectSet::upload() {
+	const CelRectArrays &a = arrays;
+	const size_t xs = a.x_stride ? a.x_stride : sizeof(float);
+	const size_t ys = a.y_stride ? a.y_stride : sizeof(float);
+	const size_t ws = a.width_stride ? a.width_stride : sizeof(float);
+	const size_t hs = a.height_stride ? a.height_stride : sizeof(float);
+	const size_t rs = a.rotation_stride ? a.rotation_stride : sizeof(float);
+	const size_t cs = a.color_stride ? a.color_stride : 4;
+	const uint8_t uniform[4] = {
+		to_unorm8(a.uniform_color.r), to_unorm8(a.uniform_color.g),
+		to_unorm8(a.uniform_color.b), to_unorm8(a.uniform_color.a)};
+	CelRectSetInstance *out =
+		vao.map_vbo<CelRectSetInstance>(instance_vbo, array_count);
+	for (size_t i = 0; i < array_count; i++) {
+		CelRectSetInstance &inst = out[i];
+		inst.x = *element(a.x, xs, i);
+		inst.y = *element(a.y, ys, i);
+		inst.width = *element(a.width, ws, i);
+		inst.height = *element(a.height, hs, i);
+		inst.rotation = a.rotation ? *element(a.rotation, rs, i) : 0.0f;
+		std::memcpy(inst.color, a.color ? element(a.color, cs, i) : uniform,
+					4);
+	}
+	vao.unmap_vbo<CelRectSetInstance>(instance_vbo, array_count);
+	count = array_count;
+	dirty = false;
+}
+RectSetRenderer::RectSetRenderer()
+	: program(primitive_traits<CelRectSetInstance>::vertex_src,
+			  primitive_traits<CelRectSetInstance>::fragment_src) {
+	program.bind_uniform_block("Frame", FRAME_UBO_BINDING);
+}
+void RectSetRenderer::remove(CelRectSet *set) {
+	sets.erase(set);
+	set->vao.clean_up();
+}
+void RectSetRenderer::enqueue(RenderQueue &queue) {
+	for (CelRectSet *set : sets) {
+		if (set->bound && set->dirty)
+			set->upload();
+		if (!set->count || set->stale)
+			continue;
+		const DrawElementsIndirectCommand cmd = {6, (GLuint)set->count, 0, 0,
+												 0};
+		queue.push(make_sort_key(set->layer, set->translucent, program.id, 0,
+								 0),
+				   &program, &set->vao, &cmd, 1);
+	}
+}
+void RectSetRenderer::clean_up() {
+	for (CelRectSet *set : sets)
+		set->vao.clean_up();
+	sets.clear();
+	program.clean_up();
+}
+void enqueue_rect_sets(CelWin *win, RenderQueue &queue) {
+	auto it = rect_set_renderer.find(win);
+	if (it != rect_set_renderer.end())
+		it->second->enqueue(queue);
+}
+void destroy_rect_sets(CelWin *win) {
+	auto it = rect_set_renderer.find(win);
+	if (it == rect_set_renderer.end())
+		return;
+	it->second->clean_up();
+	delete it->second;
+	rect_set_renderer.erase(it);
+}
+CelRectSet *cel_create_rectangle_set(CelWin *win, int layer, int translucent) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	glfwMakeContextCurrent(win->window);
+	if (!rect_set_renderer.contains(win))
+		rect_set_renderer.insert({win, new RectSetRenderer()});
+	CelRectSet *set = new CelRectSet();
+	set->origin = win;
+	set->layer = layer;
+	set->translucent = translucent;
+	set->vao.add_index_buffer(quad_indices, 6);
+	set->vao.add_vertex_buffer(2, quad_vertices, 8);
+	set->instance_vbo =
+		set->vao.add_streaming_interleaved_buffer<rect_set_layout>(
+			RECT_SET_CAPACITY, 1);
+	rect_set_renderer[win]->add(set);
+	glfwMakeContextCurrent(nullptr);
+	return set;
+}
+void cel_delete_rectangle_set(CelWin *win, CelRectSet *set) {
+	{
+		using namespace std;
+		const lock_guard<mutex> lk(Internal::gl_lock);
+		Internal::damage(win);
+		glfwMakeContextCurrent(win->window);
+		rect_set_renderer[win]->remove(set);
+		glfwMakeContextCurrent(nullptr);
+	}
+	delete set;
+}
+void cel_rectangle_set_bind(CelRectSet *set, const CelRectArrays *arrays,
+							size_t count) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	if (set->mapped) {
+		CEL_LOG(WARNING,
+			"Arrays can not be bound to a mapped rectangle set!");
+		return;
+	}
+	set->arrays = *arrays;
+	set->array_count = count;
+	set->bound = true;
+	set->dirty = true;
+	Internal::damage(set->origin);
+}
+void cel_rectangle_set_changed(CelRectSet *set) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	set->dirty = true;
+	Internal::damage(set->origin);
+}
+CelRectSetInstance *cel_map_rectangles(CelRectSet *set, size_t count) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	if (set->mapped) {
+		CEL_LOG(WARNING, "The rectangle set is already mapped!");
+		return nullptr;
+	}
+	glfwMakeContextCurrent(set->origin->window);
+	const GLuint previous = set->vao.get_vbo_id(set->instance_vbo);
+	CelRectSetInstance *res =
+		set->vao.map_vbo<CelRectSetInstance>(set->instance_vbo, count);
+	glfwMakeContextCurrent(nullptr);
+	// a grown stream replaced the buffer the vao draws from
+	set->stale = set->vao.get_vbo_id(set->instance_vbo) != previous;
+	set->bound = false;
+	set->dirty = false;
+	set->mapped = true;
+	set->mapped_count = count;
+	return res;
+}
+void cel_unmap_rectangles(CelRectSet *set) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	if (!set->mapped)
+		return;
+	glfwMakeContextCurrent(set->origin->window);
+	set->vao.unmap_vbo<CelRectSetInstance>(set->instance_vbo,
+										   set->mapped_count);
+	glfwMakeContextCurrent(nullptr);
+	set->count = set->mapped_count;
+	set->mapped = false;
+	set->stale = false;
+	Internal::damage(set->origin);
+}
+const std::string primitive_traits<CelRectSetInstance>::vertex_src = R"(
+#version 400
+)" FRAME_UBO_GLSL R"(
+layout (location = 0) in vec2 pos;
+layout (location = 1) in float x;
+layout (location = 2) in float y;
+layout (location = 3) in float width;
+layout (location = 4) in float height;
+layout (location = 5) in float rotation;
+layout (location = 6) in vec4 color;
+out vec4 out_color;
+out vec2 local;
+flat out vec2 half_size;
+flat out int smooth_edges;
+void main() {
+  vec2 scale = vec2(width, height);
+  // same placement as the rectangle shader without shapes and animations
+  half_size = max(abs(scale) * window_size / 4, vec2(1e-3));
+  smooth_edges = int(rotation != 0);
+  vec2 unit = pos * vec2(1, -1);
+  if (smooth_edges != 0)
+    unit += (unit * 2 - 1) / (half_size * 2);
+  local = (unit - 0.5) * half_size * 2;
+  vec2 final = unit * vec2(1, -1) * scale;
+  // rotate in pixels, so the shape is not sheared by the aspect ratio
+  float cosr = cos(rotation);
+  float sinr = sin(rotation);
+  vec2 centered = (final - vec2(1, -1) * scale / 2) * window_size / 2;
+  final = vec2(centered.x * cosr - centered.y * sinr, centered.x * sinr + centered.y * cosr);
+  final = final * 2 / window_size + vec2(1, -1) * scale / 2;
+  final += vec2(x, y);
+  out_color = color;
+  gl_Position = view * vec4(final, 0.0, 1.0);
+}
+)";
+const std::string primitive_traits<CelRectSetInstance>::fragment_src = R"(
+#version 400
+in vec4 out_color;
+in vec2 local;
+flat in vec2 half_size;
+flat in int smooth_edges;
+out vec4 final_color;
+void main() {
+  float coverage = 1;
+  if (smooth_edges != 0) {
+    vec2 q = abs(local) - half_size;
+    coverage = clamp(0.5 - length(max(q, 0)) - min(max(q.x, q.y), 0), 0, 1);
+  }
+  if (coverage <= 0)
+    discard;
+  final_color = vec4(out_color.rgb, out_color.a * coverage);
+}
+)";
@@ -0,0 +1,70 @@
+#ifndef RECT_SETS_HPP
+#define RECT_SETS_HPP
+#include <string>
+#include <unordered_set>
+#include "batch.hpp"
+#include "celerityui.h"
+#include "render_queue.hpp"
+#include "shader.hpp"
+#include "vao.hpp"
+template <>
+struct primitive_traits<CelRectSetInstance> {
+	using layout =
+		VertexLayout<CelRectSetInstance,
+					 CEL_ATTRIB(CelRectSetInstance, x, false),
+					 CEL_ATTRIB(CelRectSetInstance, y, false),
+					 CEL_ATTRIB(CelRectSetInstance, width, false),
+					 CEL_ATTRIB(CelRectSetInstance, height, false),
+					 CEL_ATTRIB(CelRectSetInstance, rotation, false),
+					 CEL_ATTRIB(CelRectSetInstance, color, true)>;
+	static const std::string vertex_src;
+	static const std::string fragment_src;
+};
+/**
+ * The instances of a set are streamed into a vao of their own, which is only
+ * written when the bound arrays changed or the caller unmapped new instances.
+ */
+struct CelRectSet {
+	CelWin *origin;
+	int layer;
+	bool translucent;
+	Vao vao;
+	unsigned int instance_vbo;
+	// instances in the current region of the stream
+	size_t count = 0;
+	CelRectArrays arrays = {};
+	size_t array_count = 0;
+	bool bound = false, dirty = false;
+	// the caller writes into a mapped region, the vao still draws the last
+	// one unless the stream had to grow for the mapping
+	bool mapped = false, stale = false;
+	size_t mapped_count = 0;
+	/**
+	 * Gathers the bound arrays into the next region of the stream
+	 */
+	void upload();
+};
+class RectSetRenderer {
+	ShaderProgram program;
+	std::unordered_set<CelRectSet *> sets;
+
+   public:
+	RectSetRenderer();
+	void add(CelRectSet *set) { sets.insert(set); }
+	void remove(CelRectSet *set);
+	void enqueue(RenderQueue &queue);
+	/**
+	 * Replaces Destructor, cleans up all OpenGL related data.
+	 */
+	void clean_up();
+};
+/**
+ * Adds the rectangle sets of the window to the render queue of the frame
+ */
+void enqueue_rect_sets(CelWin *win, RenderQueue &queue);
+/**
+ * Releases the rectangle sets of a window before it is destroyed, its context
+ * has to be current
+ */
+void destroy_rect_sets(CelWin *win);
+#endif
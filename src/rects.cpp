@@ -1,119 +1,597 @@
 #include "rects.hpp"
 #include <GLFW/glfw3.h>
-#include <glm/fwd.hpp>
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <unordered_map>
 #include "src/celerityui.h"
 #include "src/internal.hpp"
+#include "src/kernel.hpp"
+#include "src/layer_cache.hpp"
+#include "src/layout.hpp"
+#include "src/scene.hpp"
+#include "src/trace.hpp"
+#include "src/ubo.hpp"
 std::unordered_map<CelWin *, RectRenderer *> renderer;
+static std::unordered_map<CelWin *, ShaderProgram *> rect_programs;
+static std::unordered_set<CelWin *> culling_disabled;
 CelRect *cel_create_rectangle(CelWin *win, float x, float y, float width,
 							  float height, CelPaint color) {
+	CelRect *rect = new CelRect();
+	rect->color = color;
+	rect->x = x;
+	rect->y = y;
+	rect->width = width;
+	rect->height = height;
+	rect->origin = win;
 	{
 		using namespace std;
 		const lock_guard<mutex> lk(Internal::gl_lock);
+		Internal::damage(win);
 		glfwMakeContextCurrent(win->window);
 		if (!renderer.contains(win))
-			renderer.insert({win, new RectRenderer()});
+			renderer.insert({win, new RectRenderer(win)});
+		renderer[win]->add(rect);
 		glfwMakeContextCurrent(nullptr);
+		trace(TRACE_CREATE_RECT, trace_id(win), trace_id(rect));
+		trace_rect(rect);
 	}
-	CelRect *rect = new CelRect();
-	rect->color = color;
-	rect->x = x;
-	rect->y = y;
-	rect->width = width;
-	rect->height = height;
-	if (renderer[win]->rectangles.empty() ||
-		renderer[win]->rectangles.back().size() >= MAX_BATCH_ELEMENTS)
-		renderer[win]->rectangles.push_back({});
-	renderer[win]->rectangles.back().push_back(rect);
+	return rect;
+}
+CelRect *cel_create_rounded_rectangle(CelWin *win, float x, float y,
+									  float width, float height,
+									  float corner_radius, CelPaint color) {
+	CelRect *rect = cel_create_rectangle(win, x, y, width, height, color);
+	rect->corner_radius = corner_radius;
+	return rect;
+}
+CelRect *cel_create_ellipse(CelWin *win, float x, float y, float width,
+							float height, CelPaint color) {
+	CelRect *rect = cel_create_rectangle(win, x, y, width, height, color);
+	rect->shape = CEL_SHAPE_ELLIPSE;
 	return rect;
 }
 void cel_delete_rectangle(CelWin *win, CelRect *rect) {
-	using namespace std;
-	vector<vector<CelRect *>> &batches = renderer[win]->rectangles;
-	for (vector<CelRect *> &rects : batches) {
-		for (auto it = rects.begin(); it != rects.end(); it++) {
-			if (*it == rect) {
-				rects.erase(it);
-				break;
-			}
-		}
+	{
+		using namespace std;
+		const lock_guard<mutex> lk(Internal::gl_lock);
+		Internal::damage(win);
+		if (rect->node)
+			rect->node->scene->detach(rect);
+		detach_from_box(rect);
+		if (LayerCache *cache = find_layer_cache(win))
+			cache->release(rect);
+		renderer[win]->remove(rect);
+		trace(TRACE_DELETE_RECT, trace_id(win), trace_id(rect));
+		trace_forget(rect);
 	}
 	delete rect;
 }
 
+void enqueue_rectangles(CelWin *win, RenderQueue &queue, bool changed) {
+	if (!renderer.contains(win))
+		return;
+	// kernels move the instances on the GPU, their bounds are unknown
+	const bool culling = !culling_disabled.contains(win) &&
+						 !kernels_running(win);
+	renderer[win]->enqueue(queue, find_layer_cache(win), changed,
+						   culling ? win->width : 0, win->height);
+}
+ShaderProgram &rect_program(CelWin *win) {
+	auto it = rect_programs.find(win);
+	if (it != rect_programs.end())
+		return *it->second;
+	ShaderProgram *program =
+		new ShaderProgram(primitive_traits<RectInstance>::vertex_src,
+						  primitive_traits<RectInstance>::fragment_src);
+	program->bind_uniform_block("Frame", FRAME_UBO_BINDING);
+	rect_programs.insert({win, program});
+	return *program;
+}
+void destroy_rectangles(CelWin *win) {
+	auto it = renderer.find(win);
+	if (it != renderer.end()) {
+		it->second->clean_up();
+		delete it->second;
+		renderer.erase(it);
+	}
+	auto program = rect_programs.find(win);
+	if (program != rect_programs.end()) {
+		program->second->clean_up();
+		delete program->second;
+		rect_programs.erase(program);
+	}
+}
+RectRenderer *find_rect_renderer(CelWin *win) {
+	auto it = renderer.find(win);
+	return it == renderer.end() ? nullptr : it->second;
+}
+void get_rect_stats(CelWin *win, CelFrameStats *stats) {
+	*stats = renderer.contains(win) ? renderer[win]->get_stats()
+									: CelFrameStats{};
+}
+void cel_set_occlusion_culling(CelWin *win, int enabled) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(win);
+	if (enabled)
+		culling_disabled.erase(win);
+	else
+		culling_disabled.insert(win);
+}
+double rectangles_next_frame(CelWin *win, double now) {
+	return renderer.contains(win) ? renderer[win]->next_frame(now) : INFINITY;
+}
 void cel_render_rectangles(CelWin *win) {
-	if (renderer.contains(win))
-		renderer[win]->render_opaque();
+	RenderQueue queue;
+	enqueue_rectangles(win, queue);
+	queue.submit();
 }
-const std::string rect_vertex = R"(
+const std::string primitive_traits<RectInstance>::vertex_src = R"(
 #version 400
-#define MAX_BATCH_ELEMENTS 1024
+)" FRAME_UBO_GLSL R"(
 layout (location = 0) in vec2 pos;
-uniform vec2 positions[MAX_BATCH_ELEMENTS];
-uniform float rotations[MAX_BATCH_ELEMENTS];
-uniform vec2 scales[MAX_BATCH_ELEMENTS];
-uniform vec4 colors[MAX_BATCH_ELEMENTS];
+layout (location = 1) in vec2 end_position;
+layout (location = 2) in vec2 end_scale;
+layout (location = 3) in float end_rotation;
+layout (location = 4) in vec4 end_color;
+layout (location = 5) in float corner_radius;
+layout (location = 6) in uint shape;
+layout (location = 7) in vec2 from_position;
+layout (location = 8) in vec2 from_scale;
+layout (location = 9) in float from_rotation;
+layout (location = 10) in vec4 from_color;
+layout (location = 11) in vec4 anim_start;
+layout (location = 12) in vec4 anim_duration;
+layout (location = 13) in uvec4 easing;
+layout (location = 14) in vec4 clip;
 out vec4 out_color;
+out vec2 world_pos;
+flat out vec4 out_clip;
+out vec2 local;
+flat out vec2 half_size;
+flat out float radius;
+flat out uint out_shape;
+flat out int smooth_edges;
+// has to match ease in rects.cpp
+float ease(uint curve, float t) {
+  if (curve == 1u)
+    return t * t;
+  if (curve == 2u)
+    return t * (2 - t);
+  if (curve == 3u)
+    return t * t * (3 - 2 * t);
+  return t;
+}
 void main() {
+  // animations are evaluated against the frame time, properties that are not
+  // animated have a duration of 0 and are at their end value
+  vec4 t = clamp((time - anim_start) / max(anim_duration, 1e-6), 0, 1);
+  vec2 position = mix(from_position, end_position, ease(easing.x, t.x));
+  vec2 scale = mix(from_scale, end_scale, ease(easing.y, t.y));
+  float rotation = mix(from_rotation, end_rotation, ease(easing.z, t.z));
+  vec4 color = mix(from_color, end_color, ease(easing.w, t.w));
+  // position relative to the center of the shape in pixels for the distance
+  // evaluation in the fragment shader
+  half_size = max(abs(scale) * window_size / 4, vec2(1e-3));
+  radius = min(corner_radius, min(half_size.x, half_size.y));
+  out_shape = shape;
+  // axis aligned rectangles keep their hard pixel edges, all other shapes
+  // are expanded by a pixel for the coverage ramp of their edges
+  smooth_edges = int(rotation != 0 || shape != 0u || radius > 0);
+  vec2 unit = pos * vec2(1, -1);
+  if (smooth_edges != 0)
+    unit += (unit * 2 - 1) / (half_size * 2);
+  local = (unit - 0.5) * half_size * 2;
   // scale
-  vec2 final = pos * scales[gl_InstanceID];
-  // rotate
-  float cosr = cos(rotations[gl_InstanceID]);
-  float sinr = sin(rotations[gl_InstanceID]);
-  vec2 centered = final - vec2(1, -1) * scales[gl_InstanceID] / 2;
+  vec2 final = unit * vec2(1, -1) * scale;
+  // rotate in pixels, so the shape is not sheared by the aspect ratio
+  float cosr = cos(rotation);
+  float sinr = sin(rotation);
+  vec2 centered = (final - vec2(1, -1) * scale / 2) * window_size / 2;
   final = vec2(centered.x * cosr - centered.y * sinr, centered.x * sinr + centered.y * cosr);
-  final += vec2(1, -1) * scales[gl_InstanceID] / 2;
+  final = final * 2 / window_size + vec2(1, -1) * scale / 2;
   // translate
-  final += positions[gl_InstanceID];
+  final += position;
   // pass through
-  out_color = colors[gl_InstanceID];
-  gl_Position = vec4(final, 0.0, 1.0);
+  out_color = color;
+  world_pos = final;
+  out_clip = clip;
+  gl_Position = view * vec4(final, 0.0, 1.0);
 }
 )";
-const std::string rect_frag = R"(
+const std::string primitive_traits<RectInstance>::fragment_src = R"(
 #version 400
 in vec4 out_color;
+in vec2 local;
+flat in vec2 half_size;
+flat in float radius;
+flat in uint out_shape;
+flat in int smooth_edges;
+in vec2 world_pos;
+flat in vec4 out_clip;
 out vec4 final_color;
 void main() {
-  final_color = out_color;
+  // axis aligned clip bounds, left top right bottom
+  if (world_pos.x < out_clip.x || world_pos.y > out_clip.y ||
+      world_pos.x > out_clip.z || world_pos.y < out_clip.w)
+    discard;
+  float coverage = 1;
+  if (smooth_edges != 0) {
+    float dist;
+    if (out_shape == 1u) {
+      // ellipse, distance approximated by the first order taylor expansion
+      vec2 p = local / half_size;
+      vec2 grad = local / (half_size * half_size);
+      dist = (length(p) - 1) / max(length(grad) / max(length(p), 1e-6), 1e-6);
+    } else {
+      // distance to the edges in pixels, plain rectangles have a radius of 0
+      vec2 q = abs(local) - half_size + radius;
+      dist = length(max(q, 0)) + min(max(q.x, q.y), 0) - radius;
+    }
+    coverage = clamp(0.5 - dist, 0, 1);
+  }
+  if (coverage <= 0)
+    discard;
+  final_color = vec4(out_color.rgb, out_color.a * coverage);
 }
 )";
-const static float vertices[] = {0, 0, 0, -1, 1, 0, 1, -1};
-const static unsigned int indices[] = {0, 1, 2, 2, 1, 3};
-RectRenderer::RectRenderer() : program(rect_vertex, rect_frag) {}
-
-void RectRenderer::recalculate_indexing() {
-	while (vaos.size() < rectangles.size()) {
-		vaos.emplace_back();
-		vaos.back().add_index_buffer(indices, 6);
-		vaos.back().add_vertex_buffer(2, vertices, 8);
-	}
-	for (int i = 0; i < vaos.size(); i++) {
-		vaos[i].set_instance_count(rectangles[i].size());
-	}
-}
-void RectRenderer::render_opaque() {
-	using namespace glm;
-	program.start();
-	recalculate_indexing();
-	for (int i = 0; i < vaos.size(); i++) {
-		vaos[i].bind();
-    vaos[i].set_instance_count(rectangles[i].size());
-		for (int j = 0; j < rectangles[i].size(); j++) {
-			CelRect *rect = rectangles[i][j];
-			program.load("positions[" + std::to_string(j) + "]",
-						 vec2(rect->x, rect->y));
-			program.load("rotations[" + std::to_string(j) + "]",
-						 rect->rotation);
-			program.load("scales[" + std::to_string(j) + "]",
-						 vec2(rect->width, rect->height));
-			program.load("colors[" + std::to_string(j) + "]",
-						 vec4(rect->color.color.r, rect->color.color.g,
-							  rect->color.color.b, rect->color.color.a));
+static uint8_t to_unorm8(float v) {
+	return (uint8_t)(std::clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+// has to match ease in the vertex shader
+static float ease(CelEasing curve, float t) {
+	switch (curve) {
+		case CEL_EASE_IN:
+			return t * t;
+		case CEL_EASE_OUT:
+			return t * (2 - t);
+		case CEL_EASE_IN_OUT:
+			return t * t * (3 - 2 * t);
+		default:
+			return t;
+	}
+}
+// progress of an animation in [0, 1], 1 if it is not animated
+static float progress(const CelAnimation &anim, float now) {
+	if (anim.duration <= 0)
+		return 1;
+	return ease(anim.easing,
+				std::clamp((now - anim.start) / anim.duration, 0.0f, 1.0f));
+}
+struct Placement {
+	float x, y, width, height, rotation;
+};
+// places the geometry in the world transform of the node of the rectangle,
+// the shader rotates around the center, so the center is transformed
+static Placement place(const CelRect *rect, const NodeTransform &world,
+					   Placement p) {
+	if (!rect->node)
+		return p;
+	const NodeTransform center = world.apply(
+		{p.x + p.width / 2, p.y - p.height / 2, p.rotation, 1});
+	p.width *= center.scale;
+	p.height *= center.scale;
+	p.x = center.x - p.width / 2;
+	p.y = center.y + p.height / 2;
+	p.rotation = center.rotation;
+	return p;
+}
+static RectInstance to_instance(const CelRect *rect) {
+	const CelColorRGBA &c = rect->color.color;
+	const CelAnimation *anim = rect->animations;
+	// properties that are not animated start at their end value
+	const bool moves = anim[CEL_ANIMATE_POSITION].duration > 0,
+			   sizes = anim[CEL_ANIMATE_SIZE].duration > 0,
+			   rotates = anim[CEL_ANIMATE_ROTATION].duration > 0,
+			   fades = anim[CEL_ANIMATE_COLOR].duration > 0;
+	const NodeTransform world = rect_world(rect);
+	const Placement to = place(
+		rect, world,
+		{rect->x, rect->y, rect->width, rect->height, rect->rotation});
+	const Placement from = place(
+		rect, world,
+		{moves ? anim[CEL_ANIMATE_POSITION].from[0] : rect->x,
+		 moves ? anim[CEL_ANIMATE_POSITION].from[1] : rect->y,
+		 sizes ? anim[CEL_ANIMATE_SIZE].from[0] : rect->width,
+		 sizes ? anim[CEL_ANIMATE_SIZE].from[1] : rect->height,
+		 rotates ? anim[CEL_ANIMATE_ROTATION].from[0] : rect->rotation});
+	const float *fc = anim[CEL_ANIMATE_COLOR].from;
+	const NodeClip clip = rect_clip(rect);
+	RectInstance res = {
+		{to.x, to.y},
+		{to.width, to.height},
+		to.rotation,
+		{to_unorm8(c.r), to_unorm8(c.g), to_unorm8(c.b), to_unorm8(c.a)},
+		rect->corner_radius,
+		(uint32_t)rect->shape,
+		{from.x, from.y},
+		{from.width, from.height},
+		from.rotation,
+		{to_unorm8(c.r), to_unorm8(c.g), to_unorm8(c.b), to_unorm8(c.a)},
+		{},
+		{},
+		{},
+		{clip.bounds[0], clip.bounds[1], clip.bounds[2], clip.bounds[3]},
+		0};
+	if (fades) {
+		for (int i = 0; i < 4; i++)
+			res.from_color[i] = to_unorm8(fc[i]);
+	}
+	for (int i = 0; i < 4; i++) {
+		res.anim_start[i] = anim[i].start;
+		res.anim_duration[i] = anim[i].duration;
+		res.easing[i] = (uint8_t)anim[i].easing;
+	}
+	return res;
+}
+RectRenderer::RectRenderer(CelWin *win) : batch(rect_program(win)) {}
+// rectangles that are not fully opaque or have anti-aliased edges are blended
+// after the opaque rectangles of their layer
+static int group_of(const CelRect *rect) {
+	const CelAnimation &fade = rect->animations[CEL_ANIMATE_COLOR];
+	const CelAnimation &turn = rect->animations[CEL_ANIMATE_ROTATION];
+	const bool rotated = rect->rotation != 0 || turn.duration > 0 ||
+						 rect_world(rect).rotation != 0;
+	const bool translucent = rect->color.color.a < 1 ||
+							 (fade.duration > 0 && fade.from[3] < 1) ||
+							 rotated ||
+							 rect->corner_radius > 0 ||
+							 rect->shape != CEL_SHAPE_RECT;
+	return batch_group(rect->layer, translucent, rect_clip(rect).stencil);
+}
+void RectRenderer::add(CelRect *rect) {
+	rects.insert(rect);
+	uint32_t index = indices.size();
+	if (!free_indices.empty()) {
+		index = free_indices.back();
+		free_indices.pop_back();
+	}
+	indices.insert({rect, index});
+	RectInstance instance = to_instance(rect);
+	instance.index = index;
+	handles.insert({rect, batch.add(instance, group_of(rect))});
+}
+void RectRenderer::remove(CelRect *rect) {
+	rects.erase(rect);
+	built.erase(rect);
+	free_indices.push_back(indices[rect]);
+	indices.erase(rect);
+	std::erase(animated_in_layers, rect);
+	auto it = handles.find(rect);
+	if (it == handles.end())
+		return;
+	batch.remove(it->second);
+	handles.erase(it);
+}
+// conservative bounds in pixels, clipped by the clip bounds of the instance
+static PixelBounds pixel_bounds(const RectInstance &inst, int width,
+								int height) {
+	const float sx = std::abs(inst.size[0]), sy = std::abs(inst.size[1]);
+	const float cx = inst.pos[0] + inst.size[0] / 2,
+				cy = inst.pos[1] - inst.size[1] / 2;
+	float ex = sx / 2, ey = sy / 2;
+	if (inst.rotation != 0) {
+		// rectangles are rotated in pixels
+		const float px = sx * width / 2, py = sy * height / 2;
+		const float r = std::sqrt(px * px + py * py) / 2;
+		ex = r * 2 / width;
+		ey = r * 2 / height;
+	}
+	const float left = std::max(cx - ex, inst.clip[0]),
+				top = std::min(cy + ey, inst.clip[1]),
+				right = std::min(cx + ex, inst.clip[2]),
+				bottom = std::max(cy - ey, inst.clip[3]);
+	return {(left + 1) / 2 * width, (1 - top) / 2 * height,
+			(right + 1) / 2 * width, (1 - bottom) / 2 * height};
+}
+void RectRenderer::cull(int width, int height) {
+	stats = {};
+	if (width <= 0 || height <= 0) {
+		stats.rectangles_drawn = candidates.size();
+		return;
+	}
+	coverage.reset(width, height);
+	// front to back, candidates of a layer are tested before its occluders
+	// are added, the order of the opaque rectangles of one layer is undefined
+	cull_order.resize(candidates.size());
+	for (uint32_t i = 0; i < cull_order.size(); i++)
+		cull_order[i] = i;
+	std::stable_sort(cull_order.begin(), cull_order.end(),
+					 [&](uint32_t a, uint32_t b) {
+						 return candidates[a].rect->layer >
+								candidates[b].rect->layer;
+					 });
+	const float window_area = (float)width * height;
+	for (size_t first = 0; first < cull_order.size();) {
+		const int layer = candidates[cull_order[first]].rect->layer;
+		size_t last = first;
+		while (last < cull_order.size() &&
+			   candidates[cull_order[last]].rect->layer == layer) {
+			Candidate &c = candidates[cull_order[last++]];
+			PixelBounds b = pixel_bounds(c.instance, width, height);
+			const float area = coverage.visible_area(b);
+			stats.overdraw += area / window_area;
+			// anti-aliased edges extend by a pixel, animations move the
+			// rectangle on the GPU
+			const PixelBounds grown = {b.left - 1, b.top - 1, b.right + 1,
+									   b.bottom + 1};
+			c.culled = !c.animated && coverage.occludes(grown);
+			if (c.culled) {
+				stats.rectangles_culled++;
+			} else {
+				stats.rectangles_drawn++;
+				stats.overdraw_culled += area / window_area;
+			}
+		}
+		for (size_t i = first; i < last; i++) {
+			const Candidate &c = candidates[cull_order[i]];
+			// only hard edged opaque rectangles whose bounds are exact
+			if (c.culled || c.animated || group_translucent(c.group) ||
+				group_clip(c.group) || c.instance.shape != CEL_SHAPE_RECT)
+				continue;
+			if (coverage.add(pixel_bounds(c.instance, width, height)))
+				stats.occluders++;
+		}
+		first = last;
+	}
+}
+const RectRenderer::BuiltRect &RectRenderer::build(CelRect *rect,
+												   float now) {
+	for (CelAnimation &anim : rect->animations)
+		if (anim.duration > 0 && anim.start + anim.duration <= now)
+			anim.duration = 0;
+	auto [it, inserted] = built.try_emplace(rect);
+	BuiltRect &b = it->second;
+	const uint32_t version =
+		rect->node ? rect->node->scene->get_version(rect->node) : 0;
+	if (!inserted && b.node_version == version &&
+		std::memcmp(&b.fields, rect, sizeof(CelRect)) == 0)
+		return b;
+	std::memcpy(&b.fields, rect, sizeof(CelRect));
+	b.node_version = version;
+	b.instance = to_instance(rect);
+	b.instance.index = indices[rect];
+	b.group = group_of(rect);
+	b.anim_start = INFINITY;
+	b.anim_end = 0;
+	for (const CelAnimation &anim : rect->animations) {
+		if (anim.duration <= 0)
+			continue;
+		b.anim_start = std::min(b.anim_start, anim.start);
+		b.anim_end = std::max(b.anim_end, anim.start + anim.duration);
+	}
+	return b;
+}
+void RectRenderer::enqueue(RenderQueue &queue, LayerCache *cache,
+						   bool changed, int width, int height) {
+	const float now = (float)glfwGetTime();
+	// the first frame after an animation ended regroups its rectangle
+	if (!changed && now < first_end) {
+		// animations are evaluated on the GPU, only the cached layers of
+		// animated rectangles have to be drawn again
+		if (cache)
+			for (CelRect *rect : animated_in_layers) {
+				const BuiltRect &b = built[rect];
+				cache->claim(rect, b.instance, b.group, now < b.anim_end);
+			}
+		batch.enqueue(queue);
+		return;
+	}
+	first_start = INFINITY;
+	first_end = INFINITY;
+	last_end = 0;
+	animated_in_layers.clear();
+	candidates.clear();
+	// the rectangles are mutated directly by the user, changed instances are
+	// detected here and only their batches are uploaded
+	for (CelRect *rect : rects) {
+		// fields changed directly are recorded once per frame
+		trace_rect(rect);
+		const BuiltRect &b = build(rect, now);
+		const bool animated = now < b.anim_end;
+		if (animated) {
+			first_start = std::min(first_start, b.anim_start);
+			first_end = std::min(first_end, b.anim_end);
+			last_end = std::max(last_end, b.anim_end);
+		}
+		if (cache && cache->claim(rect, b.instance, b.group, animated)) {
+			if (animated)
+				animated_in_layers.push_back(rect);
+			auto it = handles.find(rect);
+			if (it != handles.end()) {
+				batch.remove(it->second);
+				handles.erase(it);
+			}
+			continue;
 		}
-		vaos[i].draw();
+		candidates.push_back({rect, b.instance, b.group, animated, false});
+	}
+	cull(width, height);
+	// culled rectangles leave the batch until they are uncovered again
+	for (const Candidate &c : candidates) {
+		auto it = handles.find(c.rect);
+		if (c.culled) {
+			if (it != handles.end()) {
+				batch.remove(it->second);
+				handles.erase(it);
+			}
+		} else if (it == handles.end()) {
+			handles.insert({c.rect, batch.add(c.instance, c.group)});
+		} else {
+			batch.set_group(it->second, c.group);
+			batch.set(it->second, c.instance);
+		}
+	}
+	batch.enqueue(queue);
+}
+void RectRenderer::snapshot(std::vector<RectInstance> &instances,
+							std::vector<int> &groups) const {
+	for (CelRect *rect : rects) {
+		RectInstance inst = to_instance(rect);
+		std::copy(inst.pos, inst.pos + 2, inst.from_pos);
+		std::copy(inst.size, inst.size + 2, inst.from_size);
+		inst.from_rotation = inst.rotation;
+		std::copy(inst.color, inst.color + 4, inst.from_color);
+		std::fill(inst.anim_start, inst.anim_start + 4, 0.0f);
+		std::fill(inst.anim_duration, inst.anim_duration + 4, 0.0f);
+		const int group = group_of(rect);
+		instances.push_back(inst);
+		groups.push_back(batch_group(group_layer(group),
+									 group_translucent(group)));
+	}
+}
+// starts an animation of `count` fields from their current value
+static void animate(CelRect *rect, CelAnimatedProperty property,
+					float *fields[], const float *to, int count, float delay,
+					float duration, CelEasing easing) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(rect->origin);
+	// direct changes before the call are replayed before it
+	trace_rect(rect);
+	const float now = (float)glfwGetTime();
+	CelAnimation &anim = rect->animations[property];
+	const float t = progress(anim, now);
+	for (int i = 0; i < count; i++) {
+		anim.from[i] =
+			t < 1 ? anim.from[i] + (*fields[i] - anim.from[i]) * t : *fields[i];
+		*fields[i] = to[i];
+	}
+	anim.start = now + delay;
+	anim.duration = duration;
+	anim.easing = easing;
+	if (tracing()) {
+		float values[4] = {0, 0, 0, 0};
+		std::copy(to, to + count, values);
+		trace(TRACE_ANIMATE, trace_id(rect), (uint32_t)property, values,
+			  delay, duration, (uint32_t)easing);
+		trace_rect_sync(rect);
 	}
-	program.stop();
 }
-void RectRenderer::render_transparent(int to_index) {}
+void cel_animate_position(CelRect *rect, float x, float y, float delay,
+						  float duration, CelEasing easing) {
+	float *fields[] = {&rect->x, &rect->y};
+	const float to[] = {x, y};
+	animate(rect, CEL_ANIMATE_POSITION, fields, to, 2, delay, duration,
+			easing);
+}
+void cel_animate_size(CelRect *rect, float width, float height, float delay,
+					  float duration, CelEasing easing) {
+	float *fields[] = {&rect->width, &rect->height};
+	const float to[] = {width, height};
+	animate(rect, CEL_ANIMATE_SIZE, fields, to, 2, delay, duration, easing);
+}
+void cel_animate_rotation(CelRect *rect, float rotation, float delay,
+						  float duration, CelEasing easing) {
+	float *fields[] = {&rect->rotation};
+	animate(rect, CEL_ANIMATE_ROTATION, fields, &rotation, 1, delay, duration,
+			easing);
+}
+void cel_animate_color(CelRect *rect, CelColorRGBA color, float delay,
+					   float duration, CelEasing easing) {
+	CelColorRGBA &c = rect->color.color;
+	float *fields[] = {&c.r, &c.g, &c.b, &c.a};
+	const float to[] = {color.r, color.g, color.b, color.a};
+	animate(rect, CEL_ANIMATE_COLOR, fields, to, 4, delay, duration, easing);
+}
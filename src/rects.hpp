@@ -1,19 +1,209 @@
 #ifndef RECTS_HPP
 #define RECTS_HPP
 #include "celerityui.h"
-#include "vao.hpp"
-#include "shader.hpp"
+#include "batch.hpp"
+#include "occlusion.hpp"
+#include "render_queue.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
-#define MAX_BATCH_ELEMENTS 1024
+/**
+ * Per instance data of a rectangle as it is stored on the GPU
+ */
+struct RectInstance {
+	float pos[2];
+	float size[2];
+	float rotation;
+	uint8_t color[4];
+	// in pixels
+	float corner_radius;
+	uint32_t shape;
+	// animations, the properties above are the end values
+	float from_pos[2];
+	float from_size[2];
+	float from_rotation;
+	uint8_t from_color[4];
+	// of the position, size, rotation and color animation in seconds
+	float anim_start[4];
+	float anim_duration[4];
+	uint8_t easing[4];
+	// left, top, right and bottom edge of the axis aligned clip bounds
+	float clip[4];
+	// stable index of the rectangle for kernels, see cel_kernel_rect_index
+	uint32_t index;
+};
+/**
+ * GLSL declaration of RectInstance for shader storage buffers, the colors
+ * are packed and can be read with unpackUnorm4x8
+ */
+#define RECT_INSTANCE_GLSL               \
+	"struct RectInstance {\n"             \
+	"  float pos[2];\n"                   \
+	"  float size[2];\n"                  \
+	"  float rotation;\n"                 \
+	"  uint color;\n"                     \
+	"  float corner_radius;\n"            \
+	"  uint shape;\n"                     \
+	"  float from_pos[2];\n"              \
+	"  float from_size[2];\n"             \
+	"  float from_rotation;\n"            \
+	"  uint from_color;\n"                \
+	"  float anim_start[4];\n"            \
+	"  float anim_duration[4];\n"         \
+	"  uint easing;\n"                    \
+	"  float clip[4];\n"                  \
+	"  uint index;\n"                     \
+	"};\n"
+static_assert(sizeof(RectInstance) == 28 * 4,
+			  "RECT_INSTANCE_GLSL has to match RectInstance!");
+template <>
+struct primitive_traits<RectInstance> {
+	using layout = VertexLayout<RectInstance,
+								CEL_ATTRIB(RectInstance, pos, false),
+								CEL_ATTRIB(RectInstance, size, false),
+								CEL_ATTRIB(RectInstance, rotation, false),
+								CEL_ATTRIB(RectInstance, color, true),
+								CEL_ATTRIB(RectInstance, corner_radius, false),
+								CEL_ATTRIB(RectInstance, shape, false),
+								CEL_ATTRIB(RectInstance, from_pos, false),
+								CEL_ATTRIB(RectInstance, from_size, false),
+								CEL_ATTRIB(RectInstance, from_rotation, false),
+								CEL_ATTRIB(RectInstance, from_color, true),
+								CEL_ATTRIB(RectInstance, anim_start, false),
+								CEL_ATTRIB(RectInstance, anim_duration, false),
+								CEL_ATTRIB(RectInstance, easing, false),
+								CEL_ATTRIB(RectInstance, clip, false)>;
+	static const std::string vertex_src;
+	static const std::string fragment_src;
+};
+class LayerCache;
 class RectRenderer {
-  std::vector<Vao> vaos;
-	ShaderProgram program;
-  void recalculate_indexing();
-public:
-  // batches of rectangles, each batch has at most MAX_BATCH_ELEMENTS elements
-  std::vector<std::vector<CelRect*>> rectangles;
-	RectRenderer();
-	void render_opaque();
-	void render_transparent(int to_index);
+	BatchRenderer<RectInstance> batch;
+	std::unordered_set<CelRect *> rects;
+	// handle of each rectangle drawn by this batch renderer, rectangles of
+	// cached subtrees are drawn by their layer
+	std::unordered_map<CelRect *, BatchRenderer<RectInstance>::handle>
+		handles;
+	// stable index of every rectangle, freed indices are reused
+	std::unordered_map<CelRect *, uint32_t> indices;
+	std::vector<uint32_t> free_indices;
+	// the instance of every rectangle, only rebuilt if the fields of the
+	// rectangle or the world transform of its node changed
+	struct BuiltRect {
+		CelRect fields;
+		uint32_t node_version;
+		RectInstance instance;
+		int group;
+		// start of the first and end of the last animation, no animation
+		// ends after 0
+		float anim_start, anim_end;
+	};
+	std::unordered_map<CelRect *, BuiltRect> built;
+	// earliest start and earliest resp. latest end of the animations that
+	// were running or pending when the rectangles were last checked
+	float first_start = INFINITY, first_end = INFINITY, last_end = 0;
+	// animated rectangles drawn by a cached layer, their layers are redrawn
+	// every frame
+	std::vector<CelRect *> animated_in_layers;
+	// rectangles not drawn by a layer in the current frame
+	struct Candidate {
+		CelRect *rect;
+		RectInstance instance;
+		int group;
+		bool animated;
+		bool culled;
+	};
+	std::vector<Candidate> candidates;
+	std::vector<uint32_t> cull_order;
+	CoverageBuffer coverage;
+	CelFrameStats stats = {};
+	/**
+	 * Culls the candidates that are covered by opaque candidates of higher
+	 * layers, nothing is culled for width = 0
+	 */
+	void cull(int width, int height);
+	/**
+	 * Updates the instance of a changed rectangle. Animations that ended
+	 * before `now` are cleared first, so they no longer keep the rectangle
+	 * in the translucent group.
+	 */
+	const BuiltRect &build(CelRect *rect, float now);
+
+   public:
+	RectRenderer(CelWin *win);
+	void add(CelRect *rect);
+	void remove(CelRect *rect);
+	/**
+	 * @param changed false if nothing was changed through the API or
+	 *                cel_request_redraw since the last frame, the rectangles
+	 *                are not checked for changes then
+	 * @param width   of the window in pixels for the occlusion culling, 0
+	 *                disables it
+	 */
+	void enqueue(RenderQueue &queue, LayerCache *cache, bool changed,
+				 int width = 0, int height = 0);
+	const CelFrameStats &get_stats() const { return stats; }
+	/**
+	 * Appends the instances of all rectangles of the window with their
+	 * animations finished, including the culled and cached ones
+	 * @param groups receives the batch group of every instance without its
+	 *               stencil clip
+	 */
+	void snapshot(std::vector<RectInstance> &instances,
+				  std::vector<int> &groups) const;
+	/**
+	 * Time on the clock of glfwGetTime at which the next frame has to be
+	 * drawn for the animations, at most `now` while they are running and
+	 * INFINITY if there are none
+	 */
+	double next_frame(double now) const {
+		return now >= last_end ? INFINITY : std::max<double>(first_start, now);
+	}
+	size_t instance_count() const { return batch.size(); }
+	/**
+	 * Returns the index of the rectangle in RectInstance::index, it stays the
+	 * same as long as the rectangle exists
+	 */
+	uint32_t index_of(CelRect *rect) const { return indices.at(rect); }
+	GLuint get_instance_buffer() const { return batch.get_instance_buffer(); }
+	/**
+	 * Replaces Destructor, cleans up all OpenGL related data.
+	 */
+	void clean_up() { batch.clean_up(); }
 };
+/**
+ * Returns the rectangle program of the window, it is compiled once per
+ * context and shared by everything drawing RectInstances. The context of the
+ * window has to be current.
+ */
+ShaderProgram &rect_program(CelWin *win);
+/**
+ * Returns the rectangle renderer of the window, nullptr if it has none
+ */
+RectRenderer *find_rect_renderer(CelWin *win);
+/**
+ * Fills the culling statistics of the last frame of the window, the gl lock
+ * has to be held
+ */
+void get_rect_stats(CelWin *win, CelFrameStats *stats);
+/**
+ * Adds the rectangles of the window to the render queue of the frame
+ * @param changed false if the window was not damaged since the last frame
+ */
+void enqueue_rectangles(CelWin *win, RenderQueue &queue, bool changed = true);
+/**
+ * Releases the rectangle renderer and program of a window before it is
+ * destroyed, after everything else drawing rectangles. Its context has to be
+ * current
+ */
+void destroy_rectangles(CelWin *win);
+/**
+ * Time at which the animations of the window need the next frame, see
+ * RectRenderer::next_frame
+ */
+double rectangles_next_frame(CelWin *win, double now);
 #endif
@@ -0,0 +1,120 @@
+#include "render_queue.hpp"
+#include "src/clip.hpp"
+void RenderQueue::push(uint64_t key, ShaderProgram *program, Vao *vao,
+					   const DrawElementsIndirectCommand *cmds, size_t count,
+					   GLuint texture, GLenum texture_target, uint16_t clip) {
+	if (count == 0)
+		return;
+	items.push_back({key, program, vao, texture, texture_target,
+					 (uint32_t)commands.size(), (uint32_t)count, clip});
+	commands.insert(commands.end(), cmds, cmds + count);
+}
+void RenderQueue::clear() {
+	items.clear();
+	commands.clear();
+}
+// least significant digit radix sort of the keys, one pass per byte. Passes
+// over bytes that are equal in all keys are skipped. The sort is stable, so
+// items with equal keys keep their push order.
+void RenderQueue::sort() {
+	const size_t n = items.size();
+	keys.resize(n);
+	sorted_keys.resize(n);
+	order.resize(n);
+	sorted_order.resize(n);
+	uint64_t all_or = 0, all_and = ~(uint64_t)0;
+	for (size_t i = 0; i < n; i++) {
+		keys[i] = items[i].key;
+		order[i] = i;
+		all_or |= keys[i];
+		all_and &= keys[i];
+	}
+	for (int shift = 0; shift < 64; shift += 8) {
+		if (((all_or ^ all_and) >> shift & 0xff) == 0)
+			continue;
+		size_t count[257] = {0};
+		for (size_t i = 0; i < n; i++)
+			count[(keys[i] >> shift & 0xff) + 1]++;
+		for (int b = 0; b < 256; b++)
+			count[b + 1] += count[b];
+		for (size_t i = 0; i < n; i++) {
+			const size_t dst = count[keys[i] >> shift & 0xff]++;
+			sorted_keys[dst] = keys[i];
+			sorted_order[dst] = order[i];
+		}
+		keys.swap(sorted_keys);
+		order.swap(sorted_order);
+	}
+}
+void RenderQueue::submit() {
+	sort();
+	ShaderProgram *program = nullptr;
+	Vao *vao = nullptr;
+	GLuint texture = 0;
+	uint16_t clip = 0;
+	bool blend = false;
+	glDisable(GL_BLEND);
+	// alpha is accumulated as coverage, so translucent content rendered into
+	// an empty target ends up with premultiplied color and correct alpha
+	glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE,
+						GL_ONE_MINUS_SRC_ALPHA);
+	for (size_t i = 0; i < order.size();) {
+		const RenderItem &item = items[order[i]];
+		if (item.clip != clip) {
+			clip = item.clip;
+			if (clip && clips) {
+				// the clip is drawn with its own program and vao
+				clips->write(clip);
+				program = nullptr;
+				vao = nullptr;
+			} else {
+				glDisable(GL_STENCIL_TEST);
+			}
+		}
+		const bool translucent = item.key >> 47 & 1;
+		if (translucent != blend) {
+			blend = translucent;
+			if (blend)
+				glEnable(GL_BLEND);
+			else
+				glDisable(GL_BLEND);
+		}
+		if (item.program != program) {
+			program = item.program;
+			program->start();
+		}
+		if (item.vao != vao) {
+			vao = item.vao;
+			vao->bind();
+		}
+		if (item.texture != texture) {
+			texture = item.texture;
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(item.texture_target, texture);
+		}
+		// merge the following items that need exactly the same state
+		merged.assign(commands.begin() + item.first_command,
+					  commands.begin() + item.first_command +
+						  item.command_count);
+		size_t j = i + 1;
+		for (; j < order.size(); j++) {
+			const RenderItem &next = items[order[j]];
+			if (next.program != program || next.vao != vao ||
+				next.texture != texture || next.clip != clip ||
+				(bool)(next.key >> 47 & 1) != blend)
+				break;
+			merged.insert(merged.end(), commands.begin() + next.first_command,
+						  commands.begin() + next.first_command +
+							  next.command_count);
+		}
+		vao->draw_indirect(merged);
+		i = j;
+	}
+	if (program)
+		program->stop();
+	if (clip)
+		glDisable(GL_STENCIL_TEST);
+	if (blend)
+		glDisable(GL_BLEND);
+	clear();
+}
@@ -0,0 +1,98 @@
+#ifndef RENDER_QUEUE_HPP
+#define RENDER_QUEUE_HPP
+#include <GL/glew.h>
+#include <cstdint>
+#include <vector>
+#include "shader.hpp"
+#include "vao.hpp"
+/**
+ * Sort key of a draw item, from the most to the least significant bits:
+ *  16 bit layer | 1 bit translucency | 8 bit program | 16 bit texture |
+ *  23 bit depth
+ * for opaque items and
+ *  16 bit layer | 1 bit translucency | 23 bit depth | 8 bit program |
+ *  16 bit texture
+ * for translucent items. Opaque items of a layer are drawn before its
+ * translucent items, opaque items sharing a program and texture end up next
+ * to each other. Translucent items are drawn in depth order, so blending
+ * happens back to front, only items of equal depth are grouped by state.
+ */
+inline uint64_t make_sort_key(int layer, bool translucent, GLuint program,
+							  GLuint texture, uint32_t depth) {
+	const uint64_t biased_layer =
+		(uint64_t)((layer < -32768 ? -32768 : layer > 32767 ? 32767 : layer) +
+				   32768);
+	if (translucent)
+		return biased_layer << 48 | (uint64_t)1 << 47 |
+			   (uint64_t)(depth & 0x7fffff) << 24 |
+			   (uint64_t)(program & 0xff) << 16 | (uint64_t)(texture & 0xffff);
+	return biased_layer << 48 | (uint64_t)(program & 0xff) << 39 |
+		   (uint64_t)(texture & 0xffff) << 23 | (uint64_t)(depth & 0x7fffff);
+}
+/**
+ * Instances of a BatchRenderer are grouped by layer, stencil clip and
+ * translucency, groups are ordered like the sort keys. Layers are clamped
+ * like in the sort key.
+ * @param clip stencil clip of the instances (see StencilClips), 0 for none
+ */
+inline int batch_group(int layer, bool translucent, uint16_t clip = 0) {
+	const int clamped = layer < -32768 ? -32768 : layer > 32767 ? 32767 : layer;
+	return clamped * 65536 + (clip & 0x7fff) * 2 + (translucent ? 1 : 0);
+}
+inline int group_layer(int group) { return group >> 16; }
+inline uint16_t group_clip(int group) { return group >> 1 & 0x7fff; }
+inline bool group_translucent(int group) { return group & 1; }
+class StencilClips;
+/**
+ * Collects the draw items of a frame and submits them ordered by their sort
+ * key. Binding a program, vao, texture or blend state that is already active
+ * is skipped and consecutive items with the same state are merged into one
+ * indirect draw. Items inside a stencil clip are drawn after the clip was
+ * written into the stencil buffer, they are only merged with items of the
+ * same clip.
+ */
+class RenderQueue {
+	struct RenderItem {
+		uint64_t key;
+		ShaderProgram *program;
+		Vao *vao;
+		GLuint texture;
+		GLenum texture_target;
+		uint32_t first_command;
+		uint32_t command_count;
+		uint16_t clip;
+	};
+	std::vector<RenderItem> items;
+	std::vector<DrawElementsIndirectCommand> commands;
+	// scratch memory of the sort and the merged draws
+	std::vector<uint64_t> keys, sorted_keys;
+	std::vector<uint32_t> order, sorted_order;
+	std::vector<DrawElementsIndirectCommand> merged;
+	StencilClips *clips = nullptr;
+	void sort();
+
+   public:
+	/**
+	 * Adds a draw item
+	 * @param key      see make_sort_key
+	 * @param commands the instance ranges of the vao to draw
+	 * @param texture  texture bound to unit 0, 0 for none
+	 * @param clip     stencil clip of the item, 0 for none
+	 */
+	void push(uint64_t key, ShaderProgram *program, Vao *vao,
+			  const DrawElementsIndirectCommand *commands, size_t count,
+			  GLuint texture = 0, GLenum texture_target = GL_TEXTURE_2D,
+			  uint16_t clip = 0);
+	/**
+	 * Writes the stencil clips of the items, without it items are only
+	 * clipped by the bounds of their clips
+	 */
+	void set_stencil_clips(StencilClips *stencil) { clips = stencil; }
+	inline bool empty() const { return items.empty(); }
+	/**
+	 * Draws all items in key order and empties the queue
+	 */
+	void submit();
+	void clear();
+};
+#endif
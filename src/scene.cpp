@@ -0,0 +1,234 @@
+#include "scene.hpp"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <unordered_map>
+#include "src/internal.hpp"
+#include "src/layer_cache.hpp"
+#include "src/logger.hpp"
+#include "src/trace.hpp"
+std::unordered_map<CelWin *, SceneGraph *> scenes;
+SceneGraph *get_scene(CelWin *win) {
+	if (!scenes.contains(win))
+		scenes.insert({win, new SceneGraph()});
+	return scenes[win];
+}
+void update_scene(CelWin *win) {
+	if (scenes.contains(win))
+		scenes[win]->update();
+}
+NodeTransform rect_world(const CelRect *rect) {
+	if (!rect->node)
+		return NodeTransform();
+	return rect->node->scene->get_world(rect->node);
+}
+NodeClip rect_clip(const CelRect *rect) {
+	if (!rect->node)
+		return NodeClip();
+	return rect->node->scene->get_clip(rect->node);
+}
+CelNode *SceneGraph::create(CelWin *win, CelNode *parent) {
+	const uint32_t p = parent ? parent->index : UINT32_MAX;
+	const uint32_t index = parent ? p + nodes[p].size : nodes.size();
+	CelNode *handle = new CelNode{win, this, index};
+	// shift the following nodes, their parents behind the insertion point
+	// move with them
+	for (uint32_t i = index; i < nodes.size(); i++) {
+		nodes[i].handle->index++;
+		if (nodes[i].parent != UINT32_MAX && nodes[i].parent >= index)
+			nodes[i].parent++;
+	}
+	SceneNode node = {handle, p, 1, {}, {}, true, 0, {},
+					  false, {0, 0, 0, 0}, {}, 0};
+	nodes.insert(nodes.begin() + index, node);
+	for (uint32_t a = p; a != UINT32_MAX; a = nodes[a].parent)
+		nodes[a].size++;
+	any_dirty = true;
+	return handle;
+}
+void SceneGraph::remove(CelNode *node) {
+	const uint32_t index = node->index;
+	const uint32_t size = nodes[index].size;
+	for (uint32_t a = nodes[index].parent; a != UINT32_MAX; a = nodes[a].parent)
+		nodes[a].size -= size;
+	for (uint32_t i = index; i < index + size; i++) {
+		for (CelRect *rect : nodes[i].rects)
+			rect->node = nullptr;
+		release_stencil(nodes[i]);
+		delete nodes[i].handle;
+	}
+	nodes.erase(nodes.begin() + index, nodes.begin() + index + size);
+	for (uint32_t i = index; i < nodes.size(); i++) {
+		nodes[i].handle->index = i;
+		if (nodes[i].parent != UINT32_MAX && nodes[i].parent >= index)
+			nodes[i].parent -= size;
+	}
+}
+void SceneGraph::set_transform(CelNode *node, const NodeTransform &local) {
+	SceneNode &n = nodes[node->index];
+	n.local = local;
+	n.dirty = true;
+	any_dirty = true;
+}
+void SceneGraph::set_clip(CelNode *node, const float *rect) {
+	SceneNode &n = nodes[node->index];
+	n.has_clip = rect != nullptr;
+	if (rect)
+		std::copy(rect, rect + 4, n.clip_rect);
+	n.dirty = true;
+	any_dirty = true;
+}
+void SceneGraph::release_stencil(SceneNode &n) {
+	if (!n.own_stencil)
+		return;
+	stencil_regions[n.own_stencil - 1].clear();
+	free_stencils.push_back(n.own_stencil);
+	n.own_stencil = 0;
+}
+void SceneGraph::update_clip(SceneNode &n, const NodeClip &parent) {
+	n.clip = parent;
+	if (!n.has_clip) {
+		release_stencil(n);
+		return;
+	}
+	const float x = n.clip_rect[0], y = n.clip_rect[1], w = n.clip_rect[2],
+				h = n.clip_rect[3];
+	const float local[4][2] = {{x, y}, {x + w, y}, {x + w, y - h}, {x, y - h}};
+	float corners[8];
+	float min[2] = {FLT_MAX, FLT_MAX}, max[2] = {-FLT_MAX, -FLT_MAX};
+	for (int c = 0; c < 4; c++) {
+		const NodeTransform p = n.world.apply({local[c][0], local[c][1], 0, 1});
+		corners[c * 2] = p.x;
+		corners[c * 2 + 1] = p.y;
+		min[0] = std::min(min[0], p.x);
+		min[1] = std::min(min[1], p.y);
+		max[0] = std::max(max[0], p.x);
+		max[1] = std::max(max[1], p.y);
+	}
+	float *b = n.clip.bounds;
+	b[0] = std::max(b[0], min[0]);
+	b[1] = std::min(b[1], max[1]);
+	b[2] = std::min(b[2], max[0]);
+	b[3] = std::max(b[3], min[1]);
+	// quarter turns keep the clip axis aligned, its bounds are exact
+	const float quarter = std::remainder(n.world.rotation, 1.57079632679f);
+	if (std::abs(quarter) < 1e-5f) {
+		release_stencil(n);
+		return;
+	}
+	if (!n.own_stencil) {
+		if (!free_stencils.empty()) {
+			n.own_stencil = free_stencils.back();
+			free_stencils.pop_back();
+		} else if (stencil_regions.size() < MAX_STENCIL_CLIPS) {
+			stencil_regions.emplace_back();
+			n.own_stencil = stencil_regions.size();
+		} else {
+			CEL_LOG(WARNING, "Too many rotated clips, clipping to their bounds!");
+			return;
+		}
+	}
+	std::vector<float> &region = stencil_regions[n.own_stencil - 1];
+	region.clear();
+	if (const std::vector<float> *outer = stencil_region(parent.stencil))
+		region = *outer;
+	region.insert(region.end(), corners, corners + 8);
+	n.clip.stencil = n.own_stencil;
+}
+std::vector<CelNode *> SceneGraph::subtree(const CelNode *node) const {
+	std::vector<CelNode *> res;
+	const uint32_t end = node->index + nodes[node->index].size;
+	for (uint32_t i = node->index; i < end; i++)
+		res.push_back(nodes[i].handle);
+	return res;
+}
+void SceneGraph::attach(CelNode *node, CelRect *rect) {
+	detach(rect);
+	nodes[node->index].rects.push_back(rect);
+	rect->node = node;
+}
+void SceneGraph::detach(CelRect *rect) {
+	if (!rect->node)
+		return;
+	std::vector<CelRect *> &rects = rect->node->scene->nodes[rect->node->index].rects;
+	rects.erase(std::find(rects.begin(), rects.end(), rect));
+	rect->node = nullptr;
+}
+void SceneGraph::update() {
+	if (!any_dirty)
+		return;
+	const NodeTransform identity;
+	const NodeClip unclipped;
+	for (uint32_t i = 0; i < nodes.size();) {
+		if (!nodes[i].dirty) {
+			i++;
+			continue;
+		}
+		// the whole subtree depends on this node, parents precede children
+		const uint32_t end = i + nodes[i].size;
+		for (uint32_t j = i; j < end; j++) {
+			SceneNode &n = nodes[j];
+			const NodeTransform &parent =
+				n.parent == UINT32_MAX ? identity : nodes[n.parent].world;
+			n.world = parent.apply(n.local);
+			update_clip(n, n.parent == UINT32_MAX ? unclipped
+												  : nodes[n.parent].clip);
+			n.dirty = false;
+			n.version++;
+		}
+		i = end;
+	}
+	any_dirty = false;
+}
+CelNode *cel_create_node(CelWin *win, CelNode *parent) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(win);
+	CelNode *node = get_scene(win)->create(win, parent);
+	trace(TRACE_CREATE_NODE, trace_id(win), trace_id(node), trace_id(parent));
+	return node;
+}
+void cel_delete_node(CelNode *node) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(node->origin);
+	trace(TRACE_DELETE_NODE, trace_id(node));
+	// the ids of the subtree are released with it
+	for (CelNode *n : node->scene->subtree(node))
+		trace_forget(n);
+	uncache_subtree(node);
+	node->scene->remove(node);
+}
+void cel_node_set_transform(CelNode *node, float x, float y, float rotation,
+							float scale) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(node->origin);
+	trace(TRACE_NODE_TRANSFORM, trace_id(node), x, y, rotation, scale);
+	node->scene->set_transform(node, {x, y, rotation, scale});
+}
+void cel_node_set_clip(CelNode *node, float x, float y, float width,
+					   float height) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(node->origin);
+	const float rect[4] = {x, y, width, height};
+	trace(TRACE_NODE_CLIP, trace_id(node), x, y, width, height);
+	node->scene->set_clip(node, rect);
+}
+void cel_node_clear_clip(CelNode *node) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(node->origin);
+	trace(TRACE_NODE_CLEAR_CLIP, trace_id(node));
+	node->scene->set_clip(node, nullptr);
+}
+void cel_node_attach_rectangle(CelNode *node, CelRect *rect) {
+	using namespace std;
+	const lock_guard<mutex> lk(Internal::gl_lock);
+	Internal::damage(rect->origin);
+	trace(TRACE_NODE_ATTACH, trace_id(node), trace_id(rect));
+	if (node)
+		node->scene->attach(node, rect);
+	else if (rect->node)
+		rect->node->scene->detach(rect);
+}
@@ -0,0 +1,147 @@
+#ifndef SCENE_HPP
+#define SCENE_HPP
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "celerityui.h"
+/**
+ * Similarity transform of a node: scaled, then rotated, then translated
+ */
+struct NodeTransform {
+	float x = 0, y = 0, rotation = 0, scale = 1;
+	/**
+	 * Returns the transform of a child with this world transform and the
+	 * given local transform
+	 */
+	inline NodeTransform apply(const NodeTransform &local) const {
+		const float cosr = std::cos(rotation), sinr = std::sin(rotation);
+		return {x + scale * (local.x * cosr - local.y * sinr),
+				y + scale * (local.x * sinr + local.y * cosr),
+				rotation + local.rotation, scale * local.scale};
+	}
+};
+/**
+ * Clipping of the content of a node by the clips of the node and its
+ * ancestors. Clips that are axis aligned in the window are intersected into
+ * the bounds, which are applied per instance. Every rotated clip is a stencil
+ * clip, its region also contains the rotated clips above it. The bounds
+ * contain the bounding boxes of the stencil clips.
+ */
+struct NodeClip {
+	// left, top, right and bottom edge in normalized device coordinates
+	float bounds[4] = {-FLT_MAX, FLT_MAX, FLT_MAX, -FLT_MAX};
+	// innermost stencil clip, 0 for none
+	uint16_t stencil = 0;
+};
+// stencil clips are part of the batch group of an instance
+#define MAX_STENCIL_CLIPS 0x7fff
+class SceneGraph;
+struct CelNode {
+	CelWin *origin;
+	SceneGraph *scene;
+	// index of the node in the flat array of its scene
+	uint32_t index;
+};
+/**
+ * Nodes of a window stored in a flat array in depth first order, so the
+ * subtree of a node is the range [index, index + size). World transforms are
+ * cached and only the subtrees of nodes whose local transform changed are
+ * recomputed, in one linear pass in which every parent precedes its children.
+ */
+class SceneGraph {
+	struct SceneNode {
+		CelNode *handle;
+		// index of the parent, UINT32_MAX for top level nodes
+		uint32_t parent;
+		// number of nodes in the subtree including this one
+		uint32_t size;
+		NodeTransform local, world;
+		bool dirty;
+		// incremented every time the world transform is recomputed
+		uint32_t version;
+		std::vector<CelRect *> rects;
+		// clip rectangle in local coordinates like the one of a rectangle
+		bool has_clip = false;
+		float clip_rect[4] = {0, 0, 0, 0};
+		NodeClip clip;
+		// stencil clip allocated for the rotated clip of this node
+		uint16_t own_stencil = 0;
+	};
+	std::vector<SceneNode> nodes;
+	bool any_dirty = false;
+	// world space quads of every stencil clip, 8 floats per quad, indexed by
+	// stencil clip - 1
+	std::vector<std::vector<float>> stencil_regions;
+	std::vector<uint16_t> free_stencils;
+	void release_stencil(SceneNode &n);
+	void update_clip(SceneNode &n, const NodeClip &parent);
+
+   public:
+	/**
+	 * Inserts a node as the last child of `parent` (or as top level node)
+	 */
+	CelNode *create(CelWin *win, CelNode *parent);
+	/**
+	 * Removes the node and its subtree, detaches attached rectangles
+	 */
+	void remove(CelNode *node);
+	void set_transform(CelNode *node, const NodeTransform &local);
+	/**
+	 * Clips the subtree of the node, nullptr removes the clip
+	 * @param rect x, y, width and height in the coordinates of the node
+	 */
+	void set_clip(CelNode *node, const float *rect);
+	const NodeClip &get_clip(const CelNode *node) const {
+		return nodes[node->index].clip;
+	}
+	/**
+	 * Returns the quads of a stencil clip, nullptr if it does not exist
+	 */
+	const std::vector<float> *stencil_region(uint16_t stencil) const {
+		if (stencil == 0 || stencil > stencil_regions.size())
+			return nullptr;
+		return &stencil_regions[stencil - 1];
+	}
+	const NodeTransform &get_local(const CelNode *node) const {
+		return nodes[node->index].local;
+	}
+	const NodeTransform &get_world(const CelNode *node) const {
+		return nodes[node->index].world;
+	}
+	uint32_t get_version(const CelNode *node) const {
+		return nodes[node->index].version;
+	}
+	CelNode *get_parent(const CelNode *node) const {
+		const uint32_t p = nodes[node->index].parent;
+		return p == UINT32_MAX ? nullptr : nodes[p].handle;
+	}
+	/**
+	 * Returns the nodes of the subtree of `node` in depth first order
+	 */
+	std::vector<CelNode *> subtree(const CelNode *node) const;
+	void attach(CelNode *node, CelRect *rect);
+	void detach(CelRect *rect);
+	const std::vector<CelRect *> &attached(const CelNode *node) const {
+		return nodes[node->index].rects;
+	}
+	/**
+	 * Recomputes the world transforms of all dirty subtrees
+	 */
+	void update();
+};
+SceneGraph *get_scene(CelWin *win);
+/**
+ * Recomputes the world transforms of the dirty nodes of a window, called
+ * once per frame before the primitives are enqueued
+ */
+void update_scene(CelWin *win);
+/**
+ * Returns the world transform the rectangle is placed in
+ */
+NodeTransform rect_world(const CelRect *rect);
+/**
+ * Returns the clip of the node the rectangle is placed in
+ */
+NodeClip rect_clip(const CelRect *rect);
+#endif
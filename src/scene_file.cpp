@@ -0,0 +1,183 @@
+#include "scene_file.hpp"
+#include <GLFW/glfw3.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+#include "src/internal.hpp"
+#include "src/logger.hpp"
+#include "src/ubo.hpp"
+static_assert(std::endian::native == std::endian::little,
+			  "Scene files are written in little-endian byte order!");
+static std::unordered_map<CelWin *, SceneFileRenderer *> scene_file_renderer;
+using rect_layout = primitive_traits<RectInstance>::layout;
+SceneFileRenderer::SceneFileRenderer(CelWin *win)
+	: program(&rect_program(win)) {}
+void SceneFileRenderer::remove(CelSceneFile *file) {
+	files.erase(file);
+	file->vao.clean_up();
+}
+void SceneFileRenderer::enqueue(RenderQueue &queue) {
+	for (CelSceneFile *file : files)
+		for (const SceneFileGroup &g : file->groups) {
+			const DrawElementsIndirectCommand cmd = {6, g.count, 0, 0,
+													 g.first};
+			queue.push(make_sort_key(g.layer, g.translucent, program->id, 0, 0),
+					   program, &file->vao, &cmd, 1);
+		}
+}
+void SceneFileRenderer::clean_up() {
+	for (CelSceneFile *file : files)
+		file->vao.clean_up();
+	files.clear();
+}
+void enqueue_scene_files(CelWin *win, RenderQueue &queue) {
+	auto it = scene_file_renderer.find(win);
+	if (it != scene_file_renderer.end())
+		it->second->enqueue(queue);
+}
+void destroy_scene_files(CelWin *win) {
+	auto it = scene_file_renderer.find(win);
+	if (it == scene_file_renderer.end())
+		return;
+	it->second->clean_up();
+	delete it->second;
+	scene_file_renderer.erase(it);
+}
+int cel_save_scene(CelWin *win, const char *path) {
+	std::vector<RectInstance> instances;
+	std::vector<int> groups;
+	{
+		using namespace std;
+		const lock_guard<mutex> lk(Internal::gl_lock);
+		if (RectRenderer *rects = find_rect_renderer(win))
+			rects->snapshot(instances, groups);
+	}
+	// instances are stored ordered by group, every group is one range
+	std::vector<uint32_t> order(instances.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return groups[a] < groups[b];
+	});
+	std::vector<SceneFileGroup> ranges;
+	for (uint32_t i = 0; i < order.size(); i++) {
+		const int group = groups[order[i]];
+		if (i == 0 || groups[order[i - 1]] != group)
+			ranges.push_back({group_layer(group), group_translucent(group), i,
+							  0});
+		ranges.back().count++;
+	}
+	SceneFileHeader header = {};
+	std::memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic));
+	header.version = SCENE_FILE_VERSION;
+	header.header_size = sizeof(header);
+	header.instance_size = sizeof(RectInstance);
+	header.group_count = ranges.size();
+	header.instance_count = instances.size();
+	header.groups_offset = sizeof(header);
+	const uint64_t groups_end =
+		header.groups_offset + ranges.size() * sizeof(SceneFileGroup);
+	header.instances_offset = (groups_end + SCENE_FILE_ALIGNMENT - 1) /
+							  SCENE_FILE_ALIGNMENT * SCENE_FILE_ALIGNMENT;
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		CEL_LOG(WARNING, "Could not create scene file \"{}\"!", path);
+		return 0;
+	}
+	const char padding[SCENE_FILE_ALIGNMENT] = {};
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+			  fwrite(ranges.data(), sizeof(SceneFileGroup), ranges.size(),
+					 file) == ranges.size() &&
+			  fwrite(padding, 1, header.instances_offset - groups_end,
+					 file) == header.instances_offset - groups_end;
+	for (size_t i = 0; ok && i < order.size(); i++)
+		ok = fwrite(&instances[order[i]], sizeof(RectInstance), 1, file) == 1;
+	if (fclose(file) != 0 || !ok) {
+		CEL_LOG(WARNING, "Could not write scene file \"{}\"!", path);
+		return 0;
+	}
+	return 1;
+}
+CelSceneFile *cel_load_scene(CelWin *win, const char *path) {
+	const int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		if (fd >= 0)
+			close(fd);
+		CEL_LOG(WARNING, "Could not open scene file \"{}\"!", path);
+		return nullptr;
+	}
+	const size_t size = st.st_size;
+	void *mapped = size >= sizeof(SceneFileHeader)
+					   ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)
+					   : MAP_FAILED;
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		CEL_LOG(WARNING, "Could not map scene file \"{}\"!", path);
+		return nullptr;
+	}
+	const char *data = (const char *)mapped;
+	SceneFileHeader header;
+	std::memcpy(&header, data, sizeof(header));
+	const bool valid =
+		std::memcmp(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic)) ==
+			0 &&
+		header.version == SCENE_FILE_VERSION &&
+		header.instance_size == sizeof(RectInstance) &&
+		header.groups_offset <= size &&
+		header.group_count <=
+			(size - header.groups_offset) / sizeof(SceneFileGroup) &&
+		header.instances_offset <= size &&
+		header.instance_count <=
+			(size - header.instances_offset) / sizeof(RectInstance);
+	if (!valid) {
+		CEL_LOG(WARNING, "\"{}\" is no scene file of this version!", path);
+		munmap(mapped, size);
+		return nullptr;
+	}
+	CelSceneFile *scene = new CelSceneFile();
+	scene->instance_count = header.instance_count;
+	scene->groups.resize(header.group_count);
+	std::memcpy(scene->groups.data(), data + header.groups_offset,
+				header.group_count * sizeof(SceneFileGroup));
+	// ranges outside of the instance array are dropped
+	std::erase_if(scene->groups, [&](const SceneFileGroup &g) {
+		return g.first > header.instance_count ||
+			   g.count > header.instance_count - g.first;
+	});
+	{
+		using namespace std;
+		const lock_guard<mutex> lk(Internal::gl_lock);
+		Internal::damage(win);
+		glfwMakeContextCurrent(win->window);
+		if (!scene_file_renderer.contains(win))
+			scene_file_renderer.insert({win, new SceneFileRenderer(win)});
+		scene->vao.add_index_buffer(quad_indices, 6);
+		scene->vao.add_vertex_buffer(2, quad_vertices, 8);
+		// the mapped pages are uploaded without being touched on the CPU
+		scene->vao.add_interleaved_buffer<rect_layout>(
+			(const RectInstance *)(data + header.instances_offset),
+			header.instance_count, 1);
+		scene_file_renderer[win]->add(scene);
+		glfwMakeContextCurrent(nullptr);
+	}
+	munmap(mapped, size);
+	return scene;
+}
+void cel_unload_scene(CelWin *win, CelSceneFile *scene) {
+	{
+		using namespace std;
+		const lock_guard<mutex> lk(Internal::gl_lock);
+		Internal::damage(win);
+		glfwMakeContextCurrent(win->window);
+		scene_file_renderer[win]->remove(scene);
+		glfwMakeContextCurrent(nullptr);
+	}
+	delete scene;
+}
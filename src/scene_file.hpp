@@ -0,0 +1,77 @@
+#ifndef SCENE_FILE_HPP
+#define SCENE_FILE_HPP
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+#include "batch.hpp"
+#include "celerityui.h"
+#include "rects.hpp"
+#include "render_queue.hpp"
+/**
+ * Layout of a scene file, all values are little-endian:
+ *   SceneFileHeader
+ *   SceneFileGroup[group_count] at groups_offset
+ *   RectInstance[instance_count] at instances_offset, ordered by group
+ * The instances are stored exactly like on the GPU, so the array is uploaded
+ * from the mapped file as is. Files of another version or instance size are
+ * rejected.
+ */
+#define SCENE_FILE_MAGIC "CELSCENE"
+#define SCENE_FILE_VERSION 2
+// alignment of the instance array in the file
+#define SCENE_FILE_ALIGNMENT 64
+struct SceneFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t instance_size;
+	uint32_t group_count;
+	uint64_t instance_count;
+	// from the start of the file
+	uint64_t groups_offset;
+	uint64_t instances_offset;
+};
+static_assert(sizeof(SceneFileHeader) == 48,
+			  "SceneFileHeader has to be packed!");
+/**
+ * A range of instances drawn in the same layer
+ */
+struct SceneFileGroup {
+	int32_t layer;
+	uint32_t translucent;
+	uint32_t first;
+	uint32_t count;
+};
+struct CelSceneFile {
+	Vao vao;
+	std::vector<SceneFileGroup> groups;
+	size_t instance_count;
+};
+/**
+ * Draws the loaded scene files of a window with the rectangle shader
+ */
+class SceneFileRenderer {
+	// the rectangle program of the window
+	ShaderProgram *program;
+	std::unordered_set<CelSceneFile *> files;
+
+   public:
+	SceneFileRenderer(CelWin *win);
+	void add(CelSceneFile *file) { files.insert(file); }
+	void remove(CelSceneFile *file);
+	void enqueue(RenderQueue &queue);
+	/**
+	 * Replaces Destructor, cleans up all OpenGL related data.
+	 */
+	void clean_up();
+};
+/**
+ * Adds the loaded scene files of the window to the render queue of the frame
+ */
+void enqueue_scene_files(CelWin *win, RenderQueue &queue);
+/**
+ * Releases the loaded scene files of a window before it is destroyed, its
+ * context has to be current
+ */
+void destroy_scene_files(CelWin *win);
+#endif
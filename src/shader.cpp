@@ -1,5 +1,6 @@
 #include "shader.hpp"
 #include "logger.hpp"
+#include "memory.hpp"
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <filesystem>
@@ -11,12 +12,11 @@
 #include <unordered_map>
 #include <vector>
 static GLuint createShader(std::string srcs, GLuint type) {
-  GLuint id = glCreateShader(type);
-
   if (srcs.length() == 0) {
-    log(ERROR, "Could not compile Shader, because of empty source!");
+    CEL_LOG(ERROR, "Could not compile Shader, because of empty source!");
     return 0;
   }
+  GLuint id = glCreateShader(type);
   const char *src = srcs.c_str();
   glShaderSource(id, 1, &src, nullptr);
   glCompileShader(id);
@@ -25,8 +25,10 @@ static GLuint createShader(std::string srcs, GLuint type) {
   glGetShaderiv(id, GL_COMPILE_STATUS, &success);
   if (!success) {
     glGetShaderInfoLog(id, 512, nullptr, infoLog);
-    log(ERROR, "SHADER COMPILATION FAILED: \n" + std::string(infoLog) +
-                   "\nFor source:\n" + srcs);
+    // logging the error throws
+    glDeleteShader(id);
+    CEL_LOG(ERROR, "SHADER COMPILATION FAILED: \n" + std::string(infoLog) +
+                       "\nFor source:\n" + srcs);
   }
   return id;
 }
@@ -35,12 +37,20 @@ void ShaderProgram::_construct(
     std::vector<std::pair<std::string, GLuint>> shader,
     std::vector<std::string> predefattribs) {
   id = glCreateProgram();
-  std::vector<GLuint> todel(shader.size());
-  int i = 0;
-  for (auto &shd : shader) {
-    GLuint sid = createShader(shd.first, shd.second);
-    glAttachShader(id, sid);
-    todel[i++] = sid;
+  std::vector<GLuint> todel;
+  // a failed stage throws, the program and the stages compiled so far are
+  // released before the error is passed on
+  try {
+    for (auto &shd : shader) {
+      GLuint sid = createShader(shd.first, shd.second);
+      glAttachShader(id, sid);
+      todel.push_back(sid);
+    }
+  } catch (...) {
+    for (GLuint del : todel)
+      glDeleteShader(del);
+    glDeleteProgram(id);
+    throw;
   }
   glLinkProgram(id);
   for (GLuint del : todel)
@@ -50,9 +60,14 @@ void ShaderProgram::_construct(
   glGetProgramiv(id, GL_LINK_STATUS, &success);
   if (!success) {
     glGetProgramInfoLog(id, 512, nullptr, infoLog);
-    log(ERROR, "SHADERPROGRAM LINKING FAILED\n" + std::string(infoLog));
-  } else
-    log(VERBOSE, "Successfully compiled shaderprogram");
+    glDeleteProgram(id);
+    CEL_LOG(ERROR, "SHADERPROGRAM LINKING FAILED\n" + std::string(infoLog));
+  } else {
+    CEL_LOG(VERBOSE, "Successfully compiled shaderprogram");
+    GLint size = 0;
+    glGetProgramiv(id, GL_PROGRAM_BINARY_LENGTH, &size);
+    track_memory(CEL_MEMORY_PROGRAMS, id, size);
+  }
   if (!predefattribs.empty())
     add_attributes(predefattribs);
 }
@@ -75,7 +90,7 @@ void ShaderProgram::recompile() {
   glGetProgramiv(id, GL_LINK_STATUS, &success);
   if (!success) {
     glGetProgramInfoLog(id, 512, nullptr, infoLog);
-    log(ERROR, "SHADERPROGRAM LINKING FAILED\n" + std::string(infoLog));
+    CEL_LOG(ERROR, "SHADERPROGRAM LINKING FAILED\n" + std::string(infoLog));
   } else {
     for (unsigned int i = 0; i < attribs.size(); i++)
       glBindAttribLocation(id, i, attribs[i].c_str());
@@ -169,7 +184,10 @@ void ShaderProgram::add_attributes(std::vector<std::string> attr) {
  *  Does NOT happen in the destructor,
  *  so you can copy and move programs
  */
-void ShaderProgram::clean_up() { glDeleteProgram(id); }
+void ShaderProgram::clean_up() {
+  glDeleteProgram(id);
+  untrack_memory(CEL_MEMORY_PROGRAMS, id);
+}
 /**
  *  Tells OpenGL to draw the following draw calls
  *  with this program
@@ -193,7 +211,7 @@ void ShaderProgram::load(std::string id, float value) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -213,7 +231,7 @@ void ShaderProgram::load(std::string id, glm::vec2 value) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -233,7 +251,7 @@ void ShaderProgram::load(std::string id, glm::vec3 value) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -253,7 +271,7 @@ void ShaderProgram::load(std::string id, glm::vec4 value) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -273,7 +291,7 @@ void ShaderProgram::load(std::string id, int value) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -293,7 +311,7 @@ void ShaderProgram::load(std::string id, glm::ivec2 value) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -313,7 +331,7 @@ void ShaderProgram::load(std::string id, glm::ivec3 value) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -333,7 +351,7 @@ void ShaderProgram::load(std::string id, glm::ivec4 value) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -354,7 +372,7 @@ void ShaderProgram::load(std::string id, glm::mat2 value) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -374,7 +392,7 @@ void ShaderProgram::load(std::string id, glm::mat3 value) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -394,7 +412,7 @@ void ShaderProgram::load(std::string id, glm::mat4 value) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -414,7 +432,7 @@ void ShaderProgram::load(std::string id, glm::mat2x3 value) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -434,7 +452,7 @@ void ShaderProgram::load(std::string id, glm::mat2x4 value) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -454,7 +472,7 @@ void ShaderProgram::load(std::string id, glm::mat3x2 value) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -474,7 +492,7 @@ void ShaderProgram::load(std::string id, glm::mat3x4 value) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -494,7 +512,7 @@ void ShaderProgram::load(std::string id, glm::mat4x2 value) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -514,7 +532,7 @@ void ShaderProgram::load(std::string id, glm::mat4x3 value) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -537,7 +555,7 @@ void ShaderProgram::load_texture(std::string id, GLuint tex, int unit) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -559,7 +577,7 @@ void ShaderProgram::load_texture_array(std::string id, GLuint tex, int unit) {
     uniformCache.insert({id, glGetUniformLocation(this->id, id.c_str())});
     i = uniformCache[id];
     if (i == -1) {
-      log(WARNING, "Uniform \"" + id + "\" does not exist!");
+      CEL_LOG(WARNING, "Uniform \"{}\" does not exist!", id);
       return;
     }
   } else
@@ -574,13 +592,29 @@ void ShaderProgram::load_texture_array(std::string id, GLuint tex, int unit) {
   loaded_uniforms.insert({id, {std::pair<int, int>{tex, unit}}});
 #endif
 }
+bool ShaderProgram::bind_uniform_block(std::string name, GLuint binding) {
+  GLuint i = glGetUniformBlockIndex(this->id, name.c_str());
+  if (i == GL_INVALID_INDEX) {
+    CEL_LOG(VERBOSE, "Uniform block \"{}\" is not active!", name);
+    return false;
+  }
+  glUniformBlockBinding(this->id, i, binding);
+  return true;
+}
 void ComputeShader::dispatch(GLuint workGroupX, GLuint workGroupY,
                              GLuint workGroupZ) {
   glDispatchCompute(workGroupX, workGroupY, workGroupZ);
   drawingTextures = 0;
 }
 void ComputeShader::wait_for_barriers() const {
-  glMemoryBarrier(GL_ALL_BARRIER_BITS);
+  if (barriers)
+    glMemoryBarrier(barriers);
+  barriers = 0;
+}
+void ComputeShader::bind_storage_buffer(GLuint buffer, GLuint binding,
+                                        GLbitfield consumers) {
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+  barriers |= consumers;
 }
 /**
  *  Waits for all memory barriers and unbinds this shader
@@ -600,4 +634,8 @@ void ComputeShader::bind_image(GLuint tex, GLenum access, GLenum format,
     unit = drawingTextures;
   drawingTextures = unit + 1;
   glBindImageTexture(unit, tex, 0, GL_FALSE, 0, access, format);
+  // written images are read by later image loads or texture fetches
+  if (access != GL_READ_ONLY)
+    barriers |= GL_SHADER_IMAGE_ACCESS_BARRIER_BIT |
+                GL_TEXTURE_FETCH_BARRIER_BIT;
 }
@@ -201,10 +201,21 @@ public:
    * automatically assigned if -1.
    */
   void load_texture_array(std::string id, GLuint tex, int unit = -1);
+  /**
+   * Associates a named uniform block of this program with a uniform buffer
+   * binding point. Programs that bind the same block to the same binding
+   * point share the data of the buffer bound there.
+   * @param name the name of the uniform block
+   * @param binding the binding point the block should read from
+   * @return false if the block is not active in this program
+   */
+  bool bind_uniform_block(std::string name, GLuint binding);
 };
 class ComputeShader : public ShaderProgram {
 private:
   int drawingTextures = 0;
+  // barrier bits for the consumers of the data written since the last wait
+  mutable GLbitfield barriers = 0;
 
 public:
   ComputeShader(std::string source) : ShaderProgram() {
@@ -215,7 +226,23 @@ public:
    *  Waits for all memory barriers and unbinds this shader
    */
   void stop() const;
+  /**
+   *  Issues a memory barrier for the consumers of the data written by the
+   * dispatches since the last call, nothing if there are none
+   */
   void wait_for_barriers() const;
+  /**
+   *  Adds barrier bits waited for by the next wait_for_barriers
+   */
+  void add_barriers(GLbitfield bits) { barriers |= bits; }
+  /**
+   *  Binds a buffer as shader storage buffer to the binding point
+   *  @param consumers barrier bits of how the written data is read later on,
+   * e.g. GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT if it is drawn as vertex data
+   */
+  void bind_storage_buffer(
+      GLuint buffer, GLuint binding,
+      GLbitfield consumers = GL_SHADER_STORAGE_BARRIER_BIT);
   /**
    *  Binds the texture to the n-th image unit
    *  Can be called multiple times. The first bound texture per iteration will
@@ -0,0 +1,79 @@
+#ifndef STD140_HPP
+#define STD140_HPP
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <type_traits>
+/**
+ * Base alignments of the std140 layout rules for the supported member types.
+ * vec3 and the smaller matrices are left out on purpose, their std140 size
+ * differs from the C++ size and they would silently shift following members.
+ */
+template <typename T>
+struct std140_traits {
+	static_assert(!std::is_same<T, glm::vec3>() &&
+					  !std::is_same<T, glm::ivec3>(),
+				  "vec3 has no matching C++ layout in std140, use a vec4!");
+};
+template <>
+struct std140_traits<float> {
+	static constexpr size_t alignment = 4;
+};
+template <>
+struct std140_traits<int> {
+	static constexpr size_t alignment = 4;
+};
+template <>
+struct std140_traits<unsigned int> {
+	static constexpr size_t alignment = 4;
+};
+template <>
+struct std140_traits<glm::vec2> {
+	static constexpr size_t alignment = 8;
+};
+template <>
+struct std140_traits<glm::ivec2> {
+	static constexpr size_t alignment = 8;
+};
+template <>
+struct std140_traits<glm::vec4> {
+	static constexpr size_t alignment = 16;
+};
+template <>
+struct std140_traits<glm::ivec4> {
+	static constexpr size_t alignment = 16;
+};
+template <>
+struct std140_traits<glm::mat4> {
+	static constexpr size_t alignment = 16;
+};
+/**
+ * A member of a uniform block that is placed at the offset the std140 layout
+ * rules demand. A struct that only consists of std140 members, declared in
+ * the same order as the GLSL block, can be uploaded as is, e.g.
+ *   struct Block { std140<glm::mat4> view; std140<float> time; };
+ */
+template <typename T>
+struct alignas(std140_traits<T>::alignment) std140 {
+	T value;
+	std140() = default;
+	std140(const T &value) : value(value) {}
+	std140 &operator=(const T &v) {
+		value = v;
+		return *this;
+	}
+	operator const T &() const { return value; }
+};
+/**
+ * An array member of a uniform block. In std140 every array element is
+ * rounded up to the alignment of a vec4.
+ */
+template <typename T, size_t N>
+struct alignas(16) std140_array {
+	struct alignas(16) element {
+		T value;
+	};
+	element data[N];
+	T &operator[](size_t i) { return data[i].value; }
+	const T &operator[](size_t i) const { return data[i].value; }
+};
+#endif
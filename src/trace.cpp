@@ -0,0 +1,153 @@
+#include "trace.hpp"
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "src/logger.hpp"
+static_assert(std::endian::native == std::endian::little,
+			  "Traces are written in little-endian byte order!");
+// records are buffered and written in chunks of this size
+#define TRACE_BUFFER_SIZE (1024 * 1024)
+std::atomic<bool> trace_active = false;
+static std::mutex trace_lock;
+static FILE *trace_file = nullptr;
+static std::vector<char> trace_buffer;
+static std::chrono::steady_clock::time_point trace_start;
+static std::unordered_map<const void *, uint32_t> trace_ids;
+static uint32_t next_trace_id = 1;
+// last recorded fields of every traced rectangle
+static std::unordered_map<const CelRect *, TraceRectState> rect_states;
+// trace lock has to be held
+static void close_trace() {
+	trace_active = false;
+	fclose(trace_file);
+	trace_file = nullptr;
+	trace_buffer.clear();
+	trace_ids.clear();
+	rect_states.clear();
+}
+// trace lock has to be held, a failed write stops the trace instead of
+// throwing on the thread that recorded the last operation
+static void flush_trace() {
+	if (!trace_buffer.empty() &&
+		fwrite(trace_buffer.data(), 1, trace_buffer.size(), trace_file) !=
+			trace_buffer.size()) {
+		CEL_LOG(WARNING, "Could not write the trace, it was stopped!");
+		close_trace();
+		return;
+	}
+	trace_buffer.clear();
+}
+TraceRectState trace_rect_fields(const CelRect *rect) {
+	return {rect->color,		  rect->x,
+			rect->y,			  rect->width,
+			rect->height,		  rect->rotation,
+			rect->corner_radius, (int32_t)rect->shape,
+			(int32_t)rect->layer};
+}
+void trace_record(TraceOp op, const void *payload, uint32_t size,
+				  const void *extra, uint32_t extra_size) {
+	const std::lock_guard<std::mutex> lk(trace_lock);
+	if (!trace_file)
+		return;
+	const TraceRecord record = {
+		op, 0, size + extra_size,
+		(uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - trace_start)
+			.count()};
+	const char *r = (const char *)&record;
+	trace_buffer.insert(trace_buffer.end(), r, r + sizeof(record));
+	trace_buffer.insert(trace_buffer.end(), (const char *)payload,
+						(const char *)payload + size);
+	if (extra_size)
+		trace_buffer.insert(trace_buffer.end(), (const char *)extra,
+							(const char *)extra + extra_size);
+	if (trace_buffer.size() >= TRACE_BUFFER_SIZE)
+		flush_trace();
+}
+uint32_t trace_id(const void *object) {
+	if (!object || !tracing())
+		return 0;
+	const std::lock_guard<std::mutex> lk(trace_lock);
+	auto [it, inserted] = trace_ids.insert({object, next_trace_id});
+	if (inserted)
+		next_trace_id++;
+	return it->second;
+}
+void trace_create_window(const CelWin *win) {
+	if (!tracing())
+		return;
+	const struct {
+		uint32_t window;
+		int32_t width, height;
+	} payload = {trace_id(win), win->width, win->height};
+	trace_record(TRACE_CREATE_WINDOW, &payload, sizeof(payload), win->name,
+				 strlen(win->name) + 1);
+}
+void trace_forget(const void *object) {
+	if (!tracing())
+		return;
+	const std::lock_guard<std::mutex> lk(trace_lock);
+	trace_ids.erase(object);
+	rect_states.erase((const CelRect *)object);
+}
+void trace_rect(const CelRect *rect) {
+	if (!tracing())
+		return;
+	const TraceRectState state = trace_rect_fields(rect);
+	{
+		const std::lock_guard<std::mutex> lk(trace_lock);
+		auto [it, inserted] = rect_states.insert({rect, state});
+		if (!inserted &&
+			std::memcmp(&it->second, &state, sizeof(state)) == 0)
+			return;
+		it->second = state;
+	}
+	trace(TRACE_RECT_STATE, trace_id(rect), state);
+}
+void trace_rect_sync(const CelRect *rect) {
+	if (!tracing())
+		return;
+	const std::lock_guard<std::mutex> lk(trace_lock);
+	rect_states[rect] = trace_rect_fields(rect);
+}
+int cel_start_trace(const char *path) {
+	const std::lock_guard<std::mutex> lk(trace_lock);
+	if (trace_file) {
+		CEL_LOG(WARNING, "A trace is already recorded!");
+		return 0;
+	}
+	trace_file = fopen(path, "wb");
+	if (!trace_file) {
+		CEL_LOG(WARNING, "Could not open trace file \"{}\"!", path);
+		return 0;
+	}
+	TraceHeader header = {};
+	std::memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.header_size = sizeof(header);
+	if (fwrite(&header, sizeof(header), 1, trace_file) != 1) {
+		CEL_LOG(WARNING, "Could not write trace file \"{}\"!", path);
+		fclose(trace_file);
+		trace_file = nullptr;
+		return 0;
+	}
+	trace_buffer.reserve(TRACE_BUFFER_SIZE + 4096);
+	trace_start = std::chrono::steady_clock::now();
+	trace_ids.clear();
+	rect_states.clear();
+	next_trace_id = 1;
+	trace_active = true;
+	return 1;
+}
+void cel_stop_trace() {
+	const std::lock_guard<std::mutex> lk(trace_lock);
+	if (!trace_file)
+		return;
+	flush_trace();
+	// the failed flush already closed it
+	if (trace_file)
+		close_trace();
+}
@@ -0,0 +1,130 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "celerityui.h"
+/**
+ * Binary API trace. The file starts with a TraceHeader followed by records,
+ * each a TraceRecord and `size` bytes of payload. All integers and floats
+ * are little-endian, objects are referenced by ids assigned on creation, 0
+ * stands for NULL. The payload of every op is listed next to it.
+ */
+#define TRACE_MAGIC "CELTRACE"
+#define TRACE_VERSION 1
+struct TraceHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+};
+struct TraceRecord {
+	uint16_t op;
+	uint16_t reserved;
+	uint32_t size;
+	// since the trace was started
+	uint64_t time_ns;
+};
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord has to be packed!");
+enum TraceOp : uint16_t {
+	// window, width, height, followed by the NUL terminated title
+	TRACE_CREATE_WINDOW = 1,
+	// window
+	TRACE_DESTROY_WINDOW,
+	// window, width, height
+	TRACE_RESIZE_WINDOW,
+	// window, x, y
+	TRACE_MOVE_WINDOW,
+	// window, rect
+	TRACE_CREATE_RECT,
+	// window, rect
+	TRACE_DELETE_RECT,
+	// rect, TraceRectState
+	TRACE_RECT_STATE,
+	// rect, property, float to[4], delay, duration, easing
+	TRACE_ANIMATE,
+	// window, node, parent
+	TRACE_CREATE_NODE,
+	// node
+	TRACE_DELETE_NODE,
+	// node, x, y, rotation, scale
+	TRACE_NODE_TRANSFORM,
+	// node, rect
+	TRACE_NODE_ATTACH,
+	// node, x, y, width, height
+	TRACE_NODE_CLIP,
+	// node
+	TRACE_NODE_CLEAR_CLIP,
+	// node, cached
+	TRACE_NODE_CACHED,
+	// window, TraceEvent, double a, b, c
+	TRACE_EVENT,
+	// window, double seconds the frame took on the CPU
+	TRACE_FRAME,
+};
+enum TraceEvent : uint32_t {
+	TRACE_EVENT_RESIZE,
+	TRACE_EVENT_POSITION,
+	TRACE_EVENT_FOCUS,
+	TRACE_EVENT_CURSOR,
+	TRACE_EVENT_MOUSE,
+	TRACE_EVENT_SCROLL,
+};
+/**
+ * The fields of a rectangle the user may change directly
+ */
+struct TraceRectState {
+	CelPaint color;
+	float x, y, width, height, rotation, corner_radius;
+	int32_t shape, layer;
+};
+TraceRectState trace_rect_fields(const CelRect *rect);
+extern std::atomic<bool> trace_active;
+inline bool tracing() {
+	return trace_active.load(std::memory_order_relaxed);
+}
+/**
+ * Appends a record, thread safe
+ */
+void trace_record(TraceOp op, const void *payload, uint32_t size,
+				  const void *extra = nullptr, uint32_t extra_size = 0);
+/**
+ * Id of a traced object, assigns a new one to unknown objects. 0 for nullptr
+ * and while no trace is recorded
+ */
+uint32_t trace_id(const void *object);
+/**
+ * Records the creation of a window, its title is part of the record
+ */
+void trace_create_window(const CelWin *win);
+/**
+ * Releases the id of a deleted object, after its deletion was recorded
+ */
+void trace_forget(const void *object);
+/**
+ * Records the values as payload of a record, if a trace is recorded
+ */
+template <typename... Args>
+inline void trace(TraceOp op, const Args &...args) {
+	static_assert((std::is_trivially_copyable_v<Args> && ...),
+				  "Only plain values can be traced!");
+	if (!tracing())
+		return;
+	char payload[(sizeof(Args) + ... + 0) + 1];
+	size_t offset = 0;
+	((std::memcpy(payload + offset, &args, sizeof(Args)),
+	  offset += sizeof(Args)),
+	 ...);
+	trace_record(op, payload, offset);
+}
+/**
+ * Records the fields of the rectangle if they changed since they were
+ * recorded last, called every frame for direct mutations
+ */
+void trace_rect(const CelRect *rect);
+/**
+ * Takes the current fields of the rectangle as recorded, after an API call
+ * that changed them was recorded
+ */
+void trace_rect_sync(const CelRect *rect);
+#endif
@@ -0,0 +1,31 @@
+#include "ubo.hpp"
+#include "logger.hpp"
+#include <string>
+UniformRing::UniformRing(size_t frame_size)
+	: ring(GL_UNIFORM_BUFFER, frame_size) {
+	GLint align;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+	if (align > 0)
+		alignment = align;
+}
+void UniformRing::begin_frame() {
+	region = ring.begin_region();
+	used = 0;
+}
+size_t UniformRing::allocate(size_t size) {
+	const size_t start = (used + alignment - 1) / alignment * alignment;
+	if (start + size > ring.get_region_size())
+		CEL_LOG(ERROR, "Uniform ring overflow, {} bytes requested in one frame",
+			start + size);
+	used = start + size;
+	return ring.region_offset() + start;
+}
+void UniformRing::flush() { ring.flush(used); }
+void UniformRing::bind(GLuint binding, size_t offset, size_t size) {
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, ring.get_id(), offset, size);
+}
+void UniformRing::end_frame() {
+	ring.end_region();
+	region = nullptr;
+}
+void UniformRing::clean_up() { ring.clean_up(); }
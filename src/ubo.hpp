@@ -0,0 +1,83 @@
+#ifndef UBO_HPP
+#define UBO_HPP
+#include <GL/glew.h>
+#include <cstring>
+#include <glm/glm.hpp>
+#include "buffer.hpp"
+#include "std140.hpp"
+/**
+ * Binding point of the per frame uniform block, it is shared by all programs
+ * that declare FRAME_UBO_GLSL
+ */
+#define FRAME_UBO_BINDING 0
+/**
+ * GLSL declaration of the per frame uniform block, has to match FrameUniforms
+ */
+#define FRAME_UBO_GLSL                 \
+	"layout (std140) uniform Frame {\n" \
+	"  mat4 view;\n"                     \
+	"  vec2 window_size;\n"              \
+	"  float time;\n"                    \
+	"};\n"
+struct FrameUniforms {
+	std140<glm::mat4> view;
+	std140<glm::vec2> window_size;
+	std140<float> time;
+};
+/**
+ * Streams uniform blocks through a fenced ring buffer. Every frame gets its
+ * own region from which the blocks of that frame are sub allocated, so
+ * uploading never has to wait for the GPU to finish the previous frame.
+ */
+class UniformRing {
+	RingBuffer ring;
+	char *region = nullptr;
+	size_t used = 0;
+	size_t alignment = 256;
+
+   public:
+	/**
+	 * @param frame_size maximum number of bytes uploaded per frame
+	 */
+	UniformRing(size_t frame_size = 16 * 1024);
+	/**
+	 * Acquires the region of this frame, might wait for the GPU to release it
+	 */
+	void begin_frame();
+	/**
+	 * Copies a uniform block into the region of this frame
+	 * @return the byte offset of the block in the buffer
+	 */
+	template <typename T>
+	size_t push(const T &block) {
+		static_assert(std::is_trivially_copyable<T>(),
+					  "Uniform blocks have to be trivially copyable!");
+		const size_t offset = allocate(sizeof(T));
+		std::memcpy(region + offset - ring.region_offset(), &block,
+					sizeof(T));
+		return offset;
+	}
+	/**
+	 * Sub allocates `size` bytes from the region of this frame, respecting
+	 * the uniform buffer offset alignment of the implementation
+	 * @return the byte offset in the buffer
+	 */
+	size_t allocate(size_t size);
+	/**
+	 * Uploads the pushed blocks, has to be called before the draw calls
+	 */
+	void flush();
+	/**
+	 * Binds a pushed block to a uniform block binding point
+	 */
+	void bind(GLuint binding, size_t offset, size_t size);
+	/**
+	 * Fences the region of this frame, after the last draw call
+	 */
+	void end_frame();
+	/**
+	 * Replaces Destructor, cleans up all OpenGL related data.
+	 */
+	void clean_up();
+};
+#endif
@@ -1,4 +1,7 @@
 #include "vao.hpp"
+#include "logger.hpp"
+#include "memory.hpp"
+#include <cstring>
 void Vao::add_index_buffer(const unsigned int *data, size_t count) {
   itemsCount = count;
   glBindVertexArray(id);
@@ -8,13 +11,23 @@ void Vao::add_index_buffer(const unsigned int *data, size_t count) {
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indicesId.value());
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * sizeof(unsigned int), data,
                GL_STATIC_DRAW);
+  track_memory(CEL_MEMORY_INDEX_BUFFERS, indid, count * sizeof(unsigned int));
   glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 void Vao::clean_up() {
-  for (Vbo v : vbos)
-    glDeleteBuffers(1, &v.id);
-  if (indicesId.has_value())
+  for (Vbo v : vbos) {
+    if (v.stream) {
+      v.stream->clean_up();
+      delete v.stream;
+    } else {
+      glDeleteBuffers(1, &v.id);
+      untrack_memory(CEL_MEMORY_VERTEX_BUFFERS, v.id);
+    }
+  }
+  if (indicesId.has_value()) {
     glDeleteBuffers(1, &indicesId.value());
+    untrack_memory(CEL_MEMORY_INDEX_BUFFERS, indicesId.value());
+  }
   glDeleteVertexArrays(1, &id);
 }
 template <typename T>
@@ -27,7 +40,8 @@ unsigned int Vao::gen_vbo(unsigned int index, unsigned int stride, T *data,
   unsigned int id;
   glGenBuffers(1, &id);
   glBindBuffer(GL_ARRAY_BUFFER, id);
-  glBufferData(GL_ARRAY_BUFFER, len * sizeof(float), data, GL_STATIC_DRAW);
+  glBufferData(GL_ARRAY_BUFFER, len * sizeof(T), data, GL_STATIC_DRAW);
+  track_memory(CEL_MEMORY_VERTEX_BUFFERS, id, len * sizeof(T));
   glEnableVertexAttribArray(index);
   if (std::is_same<T, float>() || std::is_same<T, const float>())
     glVertexAttribPointer(index, stride, GL_FLOAT, GL_FALSE, 0, nullptr);
@@ -48,6 +62,7 @@ unsigned int Vao::gen_instanced_vbo(unsigned int index, unsigned int stride,
   glGenBuffers(1, &id);
   glBindBuffer(GL_ARRAY_BUFFER, id);
   glBufferData(GL_ARRAY_BUFFER, len * sizeof(T), data, GL_DYNAMIC_DRAW);
+  track_memory(CEL_MEMORY_VERTEX_BUFFERS, id, len * sizeof(T));
   glEnableVertexAttribArray(index);
   if (std::is_same<T, float>() || std::is_same<T, const float>())
     glVertexAttribPointer(index, stride, GL_FLOAT, GL_FALSE, 0, nullptr);
@@ -61,7 +76,8 @@ template <typename T>
 unsigned int Vao::add_vertex_buffer(unsigned int dim, const T *data,
                                     unsigned int len) {
   glBindVertexArray(id);
-  vbos.emplace_back(gen_vbo(vbos.size(), dim, data, len), vbos.size(), dim);
+  vbos.emplace_back(gen_vbo(attribCount, dim, data, len), attribCount, dim);
+  attribCount++;
   if (!indicesId.has_value())
     itemsCount = len / dim;
   return vbos.size() - 1;
@@ -78,8 +94,9 @@ template <typename T>
 unsigned int Vao::add_instanced_vertex_buffer(unsigned int dim, const T *data,
                                               unsigned int len, int div) {
   glBindVertexArray(id);
-  vbos.emplace_back(gen_instanced_vbo(vbos.size(), dim, data, len, div),
-                    vbos.size(), dim, true);
+  vbos.emplace_back(gen_instanced_vbo(attribCount, dim, data, len, div),
+                    attribCount, dim, true);
+  attribCount++;
   if (!instanceCount.has_value())
     instanceCount = 1;
   if (!indicesId.has_value())
@@ -99,16 +116,140 @@ template <typename T>
 void Vao::update_vbo(int index, const T *data, size_t start, unsigned int len) {
   static_assert(std::is_same<T, float>() || std::is_same<T, int>(),
                 "Only float and int data is permitted in vbos!");
+  if (vbos[index].stream)
+    CEL_LOG(ERROR, "Streaming vbos can only be updated as a whole!");
   glBindVertexArray(this->id);
   glBindBuffer(GL_ARRAY_BUFFER, vbos[index].id);
   glBufferSubData(GL_ARRAY_BUFFER, start, sizeof(T) * len, &data[0]);
   glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 template <typename T>
+unsigned int Vao::add_streaming_vertex_buffer(unsigned int dim,
+                                              unsigned int capacity, int div) {
+  static_assert(std::is_same<T, float>() || std::is_same<T, int>(),
+                "Only float and int data is permitted in vbos!");
+  const VertexAttrib attrib = {gl_type<T>::value, (GLint)dim, false,
+                               std::is_same<T, int>(), 0};
+  return add_interleaved_buffer(&attrib, 1, 0, nullptr, capacity * sizeof(T),
+                                div, true);
+}
+template unsigned int Vao::add_streaming_vertex_buffer<float>(unsigned int,
+                                                             unsigned int,
+                                                             int);
+template unsigned int Vao::add_streaming_vertex_buffer<int>(unsigned int,
+                                                           unsigned int, int);
+unsigned int Vao::add_interleaved_buffer(const VertexAttrib *attribs,
+                                         size_t count, GLsizei stride,
+                                         const void *data, size_t bytes,
+                                         int div, bool streaming) {
+  glBindVertexArray(id);
+  RingBuffer *stream = nullptr;
+  GLuint vid;
+  if (streaming) {
+    stream = new RingBuffer(GL_ARRAY_BUFFER, bytes);
+    vid = stream->get_id();
+  } else {
+    glGenBuffers(1, &vid);
+    glBindBuffer(GL_ARRAY_BUFFER, vid);
+    glBufferData(GL_ARRAY_BUFFER, bytes, data,
+                 div ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+    track_memory(CEL_MEMORY_VERTEX_BUFFERS, vid, bytes);
+  }
+  vbos.emplace_back(vid, attribCount, count == 1 ? attribs[0].components : 0,
+                    div != 0);
+  Vbo &vbo = vbos.back();
+  vbo.attribs.assign(attribs, attribs + count);
+  vbo.stride = stride;
+  vbo.stream = stream;
+  attribCount += count;
+  point_attribs(vbo, 0);
+  for (size_t i = 0; i < count; i++) {
+    glEnableVertexAttribArray(vbo.index + i);
+    glVertexAttribDivisor(vbo.index + i, div);
+  }
+  if (div && !instanceCount.has_value())
+    instanceCount = 1;
+  return vbos.size() - 1;
+}
+void Vao::point_attribs(const Vbo &vbo, size_t offset) {
+  glBindBuffer(GL_ARRAY_BUFFER, vbo.id);
+  for (size_t i = 0; i < vbo.attribs.size(); i++) {
+    const VertexAttrib &a = vbo.attribs[i];
+    const void *ptr = (const void *)(offset + a.offset);
+    if (a.integer)
+      glVertexAttribIPointer(vbo.index + i, a.components, a.type, vbo.stride,
+                             ptr);
+    else
+      glVertexAttribPointer(vbo.index + i, a.components, a.type,
+                            a.normalized ? GL_TRUE : GL_FALSE, vbo.stride,
+                            ptr);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+void *Vao::map_bytes(int index, size_t bytes) {
+  Vbo &vbo = vbos[index];
+  if (vbo.stream->get_region_size() < bytes) {
+    // regions are too small, deleting a buffer that is still in use is
+    // deferred by the driver until the GPU is done with it
+    size_t size = vbo.stream->get_region_size();
+    while (size < bytes)
+      size *= 2;
+    vbo.stream->clean_up();
+    delete vbo.stream;
+    vbo.stream = new RingBuffer(GL_ARRAY_BUFFER, size);
+    vbo.id = vbo.stream->get_id();
+    vbo.stream_pending = false;
+  }
+  return vbo.stream->begin_region();
+}
+void Vao::unmap_bytes(int index, size_t bytes) {
+  Vbo &vbo = vbos[index];
+  vbo.stream->flush(bytes);
+  vbo.stream_pending = true;
+  glBindVertexArray(this->id);
+  point_attribs(vbo, vbo.stream->region_offset());
+}
+void Vao::update_bytes(int index, const void *data, size_t bytes) {
+  Vbo &vbo = vbos[index];
+  if (vbo.stream) {
+    std::memcpy(map_bytes(index, bytes), data, bytes);
+    unmap_bytes(index, bytes);
+    return;
+  }
+  glBindVertexArray(this->id);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo.id);
+  glBufferData(GL_ARRAY_BUFFER, bytes, data, GL_DYNAMIC_DRAW);
+  track_memory(CEL_MEMORY_VERTEX_BUFFERS, vbo.id, bytes);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+void Vao::update_bytes(int index, const void *data, size_t start,
+                       size_t bytes) {
+  if (vbos[index].stream)
+    CEL_LOG(ERROR, "Streaming vbos can only be updated as a whole!");
+  glBindBuffer(GL_ARRAY_BUFFER, vbos[index].id);
+  glBufferSubData(GL_ARRAY_BUFFER, start, bytes, data);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+void Vao::fence_streams() {
+  for (Vbo &vbo : vbos) {
+    if (vbo.stream_pending) {
+      vbo.stream->end_region();
+      vbo.stream_pending = false;
+    }
+  }
+}
+template <typename T>
 void Vao::update_vbo(int index, const T *data, unsigned int len) {
+  if (vbos[index].stream) {
+    update_bytes(index, data, sizeof(T) * len);
+    if (!indicesId.has_value())
+      itemsCount = len / vbos[index].dim;
+    return;
+  }
   glBindVertexArray(this->id);
   glBindBuffer(GL_ARRAY_BUFFER, vbos[index].id);
   glBufferData(GL_ARRAY_BUFFER, sizeof(T) * len, &(data[0]), GL_DYNAMIC_DRAW);
+  track_memory(CEL_MEMORY_VERTEX_BUFFERS, vbos[index].id, sizeof(T) * len);
   if (!indicesId.has_value())
     itemsCount = len / vbos[index].dim;
   glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -127,8 +268,82 @@ void Vao::draw(GLenum mode) {
     } else
       glDrawArrays(mode, 0, itemsCount);
   }
+  fence_streams();
+}
+void Vao::draw_indirect(
+    const std::vector<DrawElementsIndirectCommand> &commands, GLenum mode) {
+  if (commands.empty())
+    return;
+  if (GLEW_ARB_multi_draw_indirect && command_ring) {
+    const size_t offset = command_ring->push(commands);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_ring->get_id());
+    glMultiDrawElementsIndirect(mode, GL_UNSIGNED_INT, (const void *)offset,
+                                commands.size(), 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  } else if (GLEW_ARB_base_instance) {
+    for (const DrawElementsIndirectCommand &c : commands)
+      glDrawElementsInstancedBaseVertexBaseInstance(
+          mode, c.count, GL_UNSIGNED_INT,
+          (const void *)(c.firstIndex * sizeof(unsigned int)),
+          c.instanceCount, c.baseVertex, c.baseInstance);
+  } else {
+    for (const DrawElementsIndirectCommand &c : commands) {
+      for (const Vbo &vbo : vbos) {
+        if (vbo.instanced && !vbo.attribs.empty())
+          point_attribs(vbo, (vbo.stream ? vbo.stream->region_offset() : 0) +
+                                 c.baseInstance * vbo.stride);
+      }
+      glDrawElementsInstancedBaseVertex(
+          mode, c.count, GL_UNSIGNED_INT,
+          (const void *)(c.firstIndex * sizeof(unsigned int)),
+          c.instanceCount, c.baseVertex);
+    }
+    for (const Vbo &vbo : vbos) {
+      if (vbo.instanced && !vbo.attribs.empty())
+        point_attribs(vbo, vbo.stream ? vbo.stream->region_offset() : 0);
+    }
+  }
+  fence_streams();
 }
 void Vao::bind() { glBindVertexArray(id); }
+CommandRing *Vao::command_ring = nullptr;
+CommandRing::CommandRing(size_t frame_commands)
+    : ring(new RingBuffer(GL_DRAW_INDIRECT_BUFFER,
+                          frame_commands *
+                              sizeof(DrawElementsIndirectCommand))) {}
+void CommandRing::begin_frame() {
+  region = ring->begin_region();
+  used = 0;
+}
+size_t CommandRing::push(
+    const std::vector<DrawElementsIndirectCommand> &commands) {
+  const size_t bytes = commands.size() * sizeof(DrawElementsIndirectCommand);
+  if (used + bytes > ring->get_region_size()) {
+    // the earlier draws of this frame keep reading the old buffer, its
+    // deletion is deferred by OpenGL until they finished
+    size_t size = ring->get_region_size();
+    while (size < used + bytes)
+      size *= 2;
+    ring->clean_up();
+    delete ring;
+    ring = new RingBuffer(GL_DRAW_INDIRECT_BUFFER, size);
+    region = ring->begin_region();
+    used = 0;
+  }
+  std::memcpy(region + used, commands.data(), bytes);
+  ring->flush(used, bytes);
+  const size_t offset = ring->region_offset() + used;
+  used += bytes;
+  return offset;
+}
+void CommandRing::end_frame() {
+  ring->end_region();
+  region = nullptr;
+}
+void CommandRing::clean_up() {
+  ring->clean_up();
+  delete ring;
+}
 void Vao::update_vbo(int index, const float *data, size_t start,
                      unsigned int len) {
 
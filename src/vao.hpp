@@ -1,23 +1,86 @@
 #ifndef VAO_HPP
 #define VAO_HPP
 #include <GL/glew.h>
+#include <cstring>
 #include <optional>
 #include <type_traits>
 #include <vector>
+#include "buffer.hpp"
+#include "vertex_layout.hpp"
 struct Vbo {
-	const GLuint id;
+	GLuint id;
+	// first attribute location of this vbo
 	unsigned int index;
 	GLuint dim;
 	bool instanced = false;
+	// attributes of interleaved vbos, they occupy consecutive locations
+	std::vector<VertexAttrib> attribs;
+	GLsizei stride = 0;
+	// set for streaming vbos, the vbo then is a fenced, mapped ring buffer
+	RingBuffer *stream = nullptr;
+	// true if the current region of the stream has been written since the
+	// last draw
+	bool stream_pending = false;
 	Vbo(const GLuint id, unsigned int index, GLuint dim, bool instanced = false)
 		: id(id), index(index), dim(dim), instanced(instanced) {}
 };
+/**
+ * Layout of one command in a GL_DRAW_INDIRECT_BUFFER
+ */
+struct DrawElementsIndirectCommand {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+/**
+ * Streams the indirect commands of one context through a fenced ring buffer.
+ * Every frame gets one region from which the commands of all indirect draws
+ * of that frame are sub allocated, so the ring only advances once per frame.
+ */
+class CommandRing {
+	RingBuffer *ring;
+	char *region = nullptr;
+	size_t used = 0;
+
+   public:
+	/**
+	 * @param frame_commands number of commands one frame can hold, grows if
+	 * needed
+	 */
+	CommandRing(size_t frame_commands = 1024);
+	/**
+	 * Acquires the region of this frame, might wait for the GPU to release it
+	 */
+	void begin_frame();
+	/**
+	 * Copies the commands into the region of this frame and makes them
+	 * visible to the GPU. The indirect buffer might change if the region
+	 * overflows, so it has to be bound after pushing.
+	 * @return the byte offset of the commands in the buffer
+	 */
+	size_t push(const std::vector<DrawElementsIndirectCommand> &commands);
+	inline GLuint get_id() const { return ring->get_id(); }
+	/**
+	 * Fences the region of this frame, after the last draw call
+	 */
+	void end_frame();
+	/**
+	 * Replaces Destructor, cleans up all OpenGL related data.
+	 */
+	void clean_up();
+};
 class Vao {
 	GLuint id;
 	std::vector<Vbo> vbos;
 	std::optional<GLuint> indicesId;
 	std::optional<long> instanceCount;
 	long itemsCount = 0;
+	// next free attribute location
+	unsigned int attribCount = 0;
+	// command stream of the frame rendered on the current context
+	static CommandRing *command_ring;
 	template <typename T>
 	unsigned int gen_vbo(unsigned int index, unsigned int stride, T *data,
 						 unsigned int len);
@@ -36,6 +99,17 @@ class Vao {
 
 	template <typename T>
 	void update_vbo(int index, const T *data, unsigned int len);
+	void point_attribs(const Vbo &vbo, size_t offset);
+	void fence_streams();
+	unsigned int add_interleaved_buffer(const VertexAttrib *attribs,
+										size_t count, GLsizei stride,
+										const void *data, size_t bytes,
+										int div, bool streaming);
+	void *map_bytes(int index, size_t bytes);
+	void unmap_bytes(int index, size_t bytes);
+	void update_bytes(int index, const void *data, size_t bytes);
+	void update_bytes(int index, const void *data, size_t start,
+					  size_t bytes);
 
    public:
 	Vao() { glGenVertexArrays(1, &id); };
@@ -54,6 +128,12 @@ class Vao {
    */
   inline size_t get_number_vertex_buffers() const {
     return vbos.size();
+  }
+  /**
+   *  Returns the OpenGL buffer of a vbo, e.g. to bind it as shader storage
+   */
+  inline GLuint get_vbo_id(unsigned int index) const {
+    return vbos[index].id;
   }
 	/**
    * Adds a vertex buffer to the Vao.
@@ -139,6 +219,109 @@ class Vao {
 		return add_instanced_vertex_buffer(dim, data.data(), data.size(), div);
 	}
 	/**
+   * Adds an instanced streaming vertex buffer to the Vao.
+   * The buffer consists of three regions that are written in turn and guarded
+   * by fences, so the CPU never waits for the GPU to finish reading the data of
+   * the previous frames. With ARB_buffer_storage the regions are persistently
+   * mapped, else they are uploaded with glBufferSubData.
+   * Only int and float datatypes are supported, see
+   * `add_streaming_interleaved_buffer` for other types.
+   * @param dim      Dimension or stride of the vbo (e.g. 3 for a ivec3)
+   * @param capacity number of entries one region can hold, grows if needed
+   * @param div      Attribute Divisor Count, default is 1
+   * @return the index of this vbo
+   */
+	template <typename T>
+	unsigned int add_streaming_vertex_buffer(unsigned int dim,
+											 unsigned int capacity,
+											 int div = 1);
+	/**
+   * Adds an interleaved vertex buffer to the Vao that holds the vertex struct
+   * of a VertexLayout. All attributes of the layout share this buffer and
+   * are bound to consecutive locations starting at the count of attributes
+   * already present.
+   * @param data  Pointer to the vertex array
+   * @param count number of vertices in the array
+   * @param div   Attribute Divisor Count, 0 for per vertex data
+   * @return the index of this vbo
+   */
+	template <typename Layout>
+	unsigned int add_interleaved_buffer(const typename Layout::vertex *data,
+										unsigned int count, int div = 0) {
+		const unsigned int index = add_interleaved_buffer(
+			Layout::attribs.data(), Layout::attribs.size(), Layout::stride,
+			data, count * sizeof(typename Layout::vertex), div, false);
+		if (!indicesId.has_value() && div == 0)
+			itemsCount = count;
+		return index;
+	}
+	/**
+   * Adds an interleaved streaming vertex buffer to the Vao, see
+   * `add_streaming_vertex_buffer` and `add_interleaved_buffer`.
+   * @param capacity number of vertices one region can hold, grows if needed
+   * @param div      Attribute Divisor Count, default is 1
+   * @return the index of this vbo
+   */
+	template <typename Layout>
+	unsigned int add_streaming_interleaved_buffer(unsigned int capacity,
+												  int div = 1) {
+		return add_interleaved_buffer(
+			Layout::attribs.data(), Layout::attribs.size(), Layout::stride,
+			nullptr, capacity * sizeof(typename Layout::vertex), div, true);
+	}
+	/**
+   * Updates the data of an interleaved vbo
+   * @param index the index of this vbo in the vao
+   * @param data  the vertices that should be stored in the vbo
+   * @param count number of vertices in the array
+   */
+	template <typename Vertex>
+	void update_interleaved_buffer(int index, const Vertex *data,
+								   unsigned int count) {
+		update_bytes(index, data, count * sizeof(Vertex));
+	}
+	/**
+   * Updates a range of an interleaved vbo without reallocating it, the vbo
+   * has to be large enough to hold the range
+   * @param index the index of this vbo in the vao
+   * @param data  the vertices that should be stored in the vbo
+   * @param first index of the first vertex that should be overwritten
+   * @param count number of vertices in the array
+   */
+	template <typename Vertex>
+	void update_interleaved_buffer(int index, const Vertex *data,
+								   unsigned int first, unsigned int count) {
+		update_bytes(index, data, first * sizeof(Vertex),
+					 count * sizeof(Vertex));
+	}
+	/**
+   * Reallocates an interleaved vbo so it can hold `capacity` vertices, the
+   * previous content is lost
+   */
+	template <typename Vertex>
+	void reserve_interleaved_buffer(int index, unsigned int capacity) {
+		update_bytes(index, nullptr, capacity * sizeof(Vertex));
+	}
+	/**
+   * Returns a pointer to the region of a streaming vbo the CPU may write this
+   * frame. The data is drawn after `unmap_vbo` was called.
+   * @param index the index of the streaming vbo
+   * @param len   the count of entries that will be written
+   */
+	template <typename T>
+	T *map_vbo(int index, unsigned int len) {
+		return (T *)map_bytes(index, len * sizeof(T));
+	}
+	/**
+   * Publishes the data written to a mapped streaming vbo
+   * @param index the index of the streaming vbo
+   * @param len   the count of entries that were written
+   */
+	template <typename T>
+	void unmap_vbo(int index, unsigned int len) {
+		unmap_bytes(index, len * sizeof(T));
+	}
+	/**
    * Updates the data of an instanced vbo
    * @param index the index of this vbo in the vao
    * @param data  the data that should be stored in the vbo
@@ -157,7 +340,9 @@ class Vao {
 	void update_vbo(int index, const int *data, size_t start, unsigned int len);
 
 	/**
-   * Updates the data of an instanced vbo
+   * Updates the data of an instanced vbo.
+   * Streaming vbos are written into their current region instead of
+   * reallocating the buffer.
    * @param index the index of this vbo i.e. the number at which this vbo has
    * been added to this vao
    * @param data  the data that should be stored in the vbo
@@ -210,6 +395,28 @@ class Vao {
    */
 	void draw(GLenum mode = GL_TRIANGLES);
 	/**
+   * Draws several ranges of instances of the indexed vao. With
+   * ARB_multi_draw_indirect and a command ring set the commands are streamed
+   * into the indirect buffer of the frame and submitted with a single
+   * glMultiDrawElementsIndirect, else they are
+   * drawn one by one with glDrawElementsInstancedBaseInstance or, without
+   * ARB_base_instance, by moving the instanced attributes to the first
+   * instance of each command. The vao has to be bound.
+   * @param commands the ranges to draw, `baseInstance` is the first instance
+   */
+	void draw_indirect(const std::vector<DrawElementsIndirectCommand> &commands,
+					   GLenum mode = GL_TRIANGLES);
+	/**
+   * Sets the command ring used by draw_indirect, has to be the ring of the
+   * current context, nullptr after the frame was rendered
+   */
+	static void set_command_ring(CommandRing *ring) { command_ring = ring; }
+	/**
+   * Returns the number of indices (or vertices if there is no index buffer)
+   * drawn per instance
+   */
+	inline long get_items_count() const { return itemsCount; }
+	/**
    * Activates and binds the vao to the current context
    */
 	void bind();
@@ -0,0 +1,159 @@
+#ifndef VERTEX_LAYOUT_HPP
+#define VERTEX_LAYOUT_HPP
+#include <GL/glew.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <type_traits>
+/**
+ * 16 bit IEEE half float, stored as GL_HALF_FLOAT
+ */
+struct half {
+	uint16_t bits = 0;
+	half() = default;
+	half(float f) {
+		uint32_t x;
+		std::memcpy(&x, &f, sizeof(x));
+		const uint32_t sign = (x >> 16) & 0x8000;
+		const int exponent = (int)((x >> 23) & 0xff) - 127 + 15;
+		uint32_t mantissa = x & 0x7fffff;
+		if (((x >> 23) & 0xff) == 0xff) {
+			// inf and nan
+			bits = sign | 0x7c00 | (mantissa ? 0x200 : 0);
+		} else if (exponent >= 31) {
+			bits = sign | 0x7c00;
+		} else if (exponent <= 0) {
+			// subnormal or zero
+			if (exponent < -10) {
+				bits = sign;
+			} else {
+				mantissa |= 0x800000;
+				bits = sign | (mantissa >> (14 - exponent));
+			}
+		} else {
+			bits = sign | (exponent << 10) | (mantissa >> 13);
+		}
+	}
+};
+/**
+ * Description of one attribute inside an (interleaved) vertex buffer
+ */
+struct VertexAttrib {
+	GLenum type;
+	GLint components;
+	// integer data is mapped to [0, 1] resp. [-1, 1]
+	bool normalized;
+	// integer data is passed to integer attributes with glVertexAttribIPointer
+	bool integer;
+	size_t offset;
+};
+template <typename T>
+struct gl_type;
+template <>
+struct gl_type<float> {
+	static constexpr GLenum value = GL_FLOAT;
+};
+template <>
+struct gl_type<half> {
+	static constexpr GLenum value = GL_HALF_FLOAT;
+};
+template <>
+struct gl_type<int32_t> {
+	static constexpr GLenum value = GL_INT;
+};
+template <>
+struct gl_type<uint32_t> {
+	static constexpr GLenum value = GL_UNSIGNED_INT;
+};
+template <>
+struct gl_type<int16_t> {
+	static constexpr GLenum value = GL_SHORT;
+};
+template <>
+struct gl_type<uint16_t> {
+	static constexpr GLenum value = GL_UNSIGNED_SHORT;
+};
+template <>
+struct gl_type<int8_t> {
+	static constexpr GLenum value = GL_BYTE;
+};
+template <>
+struct gl_type<uint8_t> {
+	static constexpr GLenum value = GL_UNSIGNED_BYTE;
+};
+/**
+ * Deduces component type and count of a vertex struct member
+ */
+template <typename T>
+struct field_traits {
+	using component = T;
+	static constexpr GLint components = 1;
+};
+template <typename T, size_t N>
+struct field_traits<T[N]> {
+	static_assert(N >= 1 && N <= 4, "Attributes have 1 to 4 components!");
+	using component = T;
+	static constexpr GLint components = N;
+};
+template <>
+struct field_traits<glm::vec2> {
+	using component = float;
+	static constexpr GLint components = 2;
+};
+template <>
+struct field_traits<glm::vec3> {
+	using component = float;
+	static constexpr GLint components = 3;
+};
+template <>
+struct field_traits<glm::vec4> {
+	using component = float;
+	static constexpr GLint components = 4;
+};
+/**
+ * One attribute of a vertex layout, use CEL_ATTRIB to declare it
+ */
+template <typename Field, size_t Offset, bool Normalized>
+struct Attrib {
+	using component = typename field_traits<Field>::component;
+	static constexpr VertexAttrib describe() {
+		constexpr bool is_float = std::is_same<component, float>() ||
+								  std::is_same<component, half>();
+		static_assert(is_float || std::is_integral<component>(),
+					  "Unsupported attribute type!");
+		static_assert(!Normalized || !is_float,
+					  "Only integer attributes can be normalized!");
+		return {gl_type<component>::value, field_traits<Field>::components,
+				Normalized, !is_float && !Normalized, Offset};
+	}
+};
+/**
+ * Declares the member `member` of the vertex struct `Vertex` as an attribute.
+ * The component type and count are deduced from the member type, e.g.
+ * `float[2]` or `glm::vec2` is a vec2, `uint8_t[4]` with normalized set is a
+ * vec4 color in [0, 1] and `half[2]` is a vec2 of half floats.
+ */
+#define CEL_ATTRIB(Vertex, member, normalized)                       \
+	Attrib<decltype(Vertex::member), offsetof(Vertex, member), \
+		   normalized>
+/**
+ * Compile time description of an interleaved vertex buffer holding `Vertex`
+ * structs. The attributes are bound to consecutive locations in the order
+ * they are listed, e.g.
+ *   using Layout = VertexLayout<Vertex, CEL_ATTRIB(Vertex, pos, false),
+ *                               CEL_ATTRIB(Vertex, color, true)>;
+ */
+template <typename Vertex, typename... Attribs>
+struct VertexLayout {
+	static_assert(std::is_standard_layout<Vertex>() &&
+					  std::is_trivially_copyable<Vertex>(),
+				  "Vertices have to be trivially copyable standard layout "
+				  "structs!");
+	using vertex = Vertex;
+	static constexpr GLsizei stride = sizeof(Vertex);
+	static constexpr std::array<VertexAttrib, sizeof...(Attribs)> attribs = {
+		Attribs::describe()...};
+};
+#endif
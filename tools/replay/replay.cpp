@@ -0,0 +1,342 @@
+/* CelerityUI - A fast, portable, OpenGL based GUI Framework
+ * Copyright (C) 2024 David Schwarzbeck
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+/* Executes a trace recorded with cel_start_trace again and reports the frame
+ * times of the recording and of the replay. The trace is memory mapped and
+ * pages that were replayed are dropped, so traces larger than the memory can
+ * be replayed.
+ *
+ *   celerityui_replay <trace> [--realtime] [--visible]
+ *
+ * By default records are executed as fast as possible, every recorded frame
+ * is rendered before the next record is read. With --realtime the replay
+ * waits for the timestamps of the records. */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "celerityui.h"
+#include "trace.hpp"
+// replayed parts of the mapping are dropped in steps of this size
+#define RELEASE_STEP (64ull * 1024 * 1024)
+struct Reader {
+	const char *pos;
+	template <typename T>
+	T get() {
+		T res;
+		std::memcpy(&res, pos, sizeof(T));
+		pos += sizeof(T);
+		return res;
+	}
+};
+struct FrameTimes {
+	// copied, the window may be destroyed before the report
+	std::string title;
+	std::vector<double> recorded, replayed;
+};
+static void report(const char *name, std::vector<double> times) {
+	if (times.empty()) {
+		printf("  %-9s no frames\n", name);
+		return;
+	}
+	std::sort(times.begin(), times.end());
+	double sum = 0;
+	for (double t : times)
+		sum += t;
+	const auto at = [&](double q) {
+		return times[std::min(times.size() - 1, (size_t)(q * times.size()))];
+	};
+	printf("  %-9s %zu frames, mean %.3f ms, p50 %.3f ms, p99 %.3f ms, "
+		   "max %.3f ms\n",
+		   name, times.size(), sum / times.size() * 1e3, at(0.5) * 1e3,
+		   at(0.99) * 1e3, times.back() * 1e3);
+}
+// requests a frame and waits until the render thread finished it
+static double render_frame(CelWin *win) {
+	CelFrameStats before, after;
+	cel_get_frame_stats(win, &before);
+	cel_request_redraw(win);
+	const auto timeout =
+		std::chrono::steady_clock::now() + std::chrono::seconds(1);
+	do {
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+		cel_get_frame_stats(win, &after);
+	} while (after.frames == before.frames &&
+			 std::chrono::steady_clock::now() < timeout);
+	return after.frame_time;
+}
+int main(int argc, char **argv) {
+	const char *path = nullptr;
+	bool realtime = false, visible = false;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--realtime"))
+			realtime = true;
+		else if (!strcmp(argv[i], "--visible"))
+			visible = true;
+		else
+			path = argv[i];
+	}
+	if (!path) {
+		fprintf(stderr, "usage: %s <trace> [--realtime] [--visible]\n",
+				argv[0]);
+		return 1;
+	}
+	const int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		fprintf(stderr, "could not open %s\n", path);
+		return 1;
+	}
+	const size_t size = st.st_size;
+	const char *data =
+		size ? (const char *)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)
+			 : nullptr;
+	close(fd);
+	TraceHeader header;
+	if (!data || data == MAP_FAILED || size < sizeof(header) ||
+		(std::memcpy(&header, data, sizeof(header)),
+		 std::memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0)) {
+		fprintf(stderr, "%s is no trace\n", path);
+		return 1;
+	}
+	if (header.version != TRACE_VERSION) {
+		fprintf(stderr, "unsupported trace version %u\n", header.version);
+		return 1;
+	}
+	madvise((void *)data, size, MADV_SEQUENTIAL);
+	cel_set_hidden_windows(!visible);
+	std::unordered_map<uint32_t, CelWin *> windows;
+	std::unordered_map<uint32_t, CelRect *> rects;
+	std::unordered_map<uint32_t, CelNode *> nodes;
+	// by the id of the window in the trace
+	std::unordered_map<uint32_t, FrameTimes> times;
+	std::deque<std::string> titles;
+	size_t records = 0, events = 0, released = 0;
+	const auto start = std::chrono::steady_clock::now();
+	size_t offset = header.header_size;
+	while (offset + sizeof(TraceRecord) <= size) {
+		TraceRecord record;
+		std::memcpy(&record, data + offset, sizeof(record));
+		offset += sizeof(record);
+		if (offset + record.size > size)
+			break;
+		Reader in = {data + offset};
+		offset += record.size;
+		records++;
+		if (realtime)
+			std::this_thread::sleep_until(
+				start + std::chrono::nanoseconds(record.time_ns));
+		switch (record.op) {
+			case TRACE_CREATE_WINDOW: {
+				const uint32_t id = in.get<uint32_t>();
+				const int32_t width = in.get<int32_t>(),
+							  height = in.get<int32_t>();
+				titles.emplace_back(in.pos);
+				windows[id] =
+					cel_create_window(titles.back().c_str(), width, height);
+				break;
+			}
+			case TRACE_DESTROY_WINDOW: {
+				auto it = windows.find(in.get<uint32_t>());
+				if (it == windows.end())
+					break;
+				cel_destroy_window(it->second);
+				windows.erase(it);
+				break;
+			}
+			case TRACE_RESIZE_WINDOW: {
+				CelWin *win = windows[in.get<uint32_t>()];
+				const int32_t w = in.get<int32_t>(), h = in.get<int32_t>();
+				if (win)
+					cel_resize_window(win, w, h);
+				break;
+			}
+			case TRACE_MOVE_WINDOW: {
+				CelWin *win = windows[in.get<uint32_t>()];
+				const int32_t x = in.get<int32_t>(), y = in.get<int32_t>();
+				if (win)
+					cel_move_window(win, x, y);
+				break;
+			}
+			case TRACE_CREATE_RECT: {
+				CelWin *win = windows[in.get<uint32_t>()];
+				const uint32_t id = in.get<uint32_t>();
+				// the fields follow in a state record
+				if (win)
+					rects[id] = cel_create_rectangle(win, 0, 0, 0, 0, {});
+				break;
+			}
+			case TRACE_DELETE_RECT: {
+				CelWin *win = windows[in.get<uint32_t>()];
+				auto it = rects.find(in.get<uint32_t>());
+				if (!win || it == rects.end())
+					break;
+				cel_delete_rectangle(win, it->second);
+				rects.erase(it);
+				break;
+			}
+			case TRACE_RECT_STATE: {
+				CelRect *rect = rects[in.get<uint32_t>()];
+				const TraceRectState s = in.get<TraceRectState>();
+				if (!rect)
+					break;
+				rect->color = s.color;
+				rect->x = s.x;
+				rect->y = s.y;
+				rect->width = s.width;
+				rect->height = s.height;
+				rect->rotation = s.rotation;
+				rect->corner_radius = s.corner_radius;
+				rect->shape = (CelShape)s.shape;
+				rect->layer = s.layer;
+				break;
+			}
+			case TRACE_ANIMATE: {
+				CelRect *rect = rects[in.get<uint32_t>()];
+				const uint32_t property = in.get<uint32_t>();
+				float to[4];
+				for (float &v : to)
+					v = in.get<float>();
+				const float delay = in.get<float>(),
+							duration = in.get<float>();
+				const CelEasing easing = (CelEasing)in.get<uint32_t>();
+				if (!rect)
+					break;
+				switch (property) {
+					case CEL_ANIMATE_POSITION:
+						cel_animate_position(rect, to[0], to[1], delay,
+											 duration, easing);
+						break;
+					case CEL_ANIMATE_SIZE:
+						cel_animate_size(rect, to[0], to[1], delay, duration,
+										 easing);
+						break;
+					case CEL_ANIMATE_ROTATION:
+						cel_animate_rotation(rect, to[0], delay, duration,
+											 easing);
+						break;
+					case CEL_ANIMATE_COLOR:
+						cel_animate_color(rect, {to[0], to[1], to[2], to[3]},
+										  delay, duration, easing);
+						break;
+				}
+				break;
+			}
+			case TRACE_CREATE_NODE: {
+				CelWin *win = windows[in.get<uint32_t>()];
+				const uint32_t id = in.get<uint32_t>();
+				const uint32_t parent = in.get<uint32_t>();
+				if (win)
+					nodes[id] =
+						cel_create_node(win, parent ? nodes[parent] : nullptr);
+				break;
+			}
+			case TRACE_DELETE_NODE: {
+				auto it = nodes.find(in.get<uint32_t>());
+				if (it != nodes.end())
+					cel_delete_node(it->second);
+				// ids of the subtree are not reused by the recording
+				break;
+			}
+			case TRACE_NODE_TRANSFORM: {
+				CelNode *node = nodes[in.get<uint32_t>()];
+				const float x = in.get<float>(), y = in.get<float>(),
+							rotation = in.get<float>(),
+							scale = in.get<float>();
+				if (node)
+					cel_node_set_transform(node, x, y, rotation, scale);
+				break;
+			}
+			case TRACE_NODE_ATTACH: {
+				const uint32_t node = in.get<uint32_t>();
+				CelRect *rect = rects[in.get<uint32_t>()];
+				if (rect)
+					cel_node_attach_rectangle(node ? nodes[node] : nullptr,
+											  rect);
+				break;
+			}
+			case TRACE_NODE_CLIP: {
+				CelNode *node = nodes[in.get<uint32_t>()];
+				const float x = in.get<float>(), y = in.get<float>(),
+							w = in.get<float>(), h = in.get<float>();
+				if (node)
+					cel_node_set_clip(node, x, y, w, h);
+				break;
+			}
+			case TRACE_NODE_CLEAR_CLIP: {
+				CelNode *node = nodes[in.get<uint32_t>()];
+				if (node)
+					cel_node_clear_clip(node);
+				break;
+			}
+			case TRACE_NODE_CACHED: {
+				CelNode *node = nodes[in.get<uint32_t>()];
+				const int32_t cached = in.get<int32_t>();
+				if (node)
+					cel_node_set_cached(node, cached);
+				break;
+			}
+			case TRACE_EVENT:
+				// there is no application to deliver the events to
+				events++;
+				break;
+			case TRACE_FRAME: {
+				const uint32_t id = in.get<uint32_t>();
+				CelWin *win = windows[id];
+				const double recorded = in.get<double>();
+				if (!win)
+					break;
+				FrameTimes &t = times[id];
+				if (t.title.empty())
+					t.title = win->name;
+				t.recorded.push_back(recorded);
+				t.replayed.push_back(render_frame(win));
+				break;
+			}
+			default:
+				// records of newer versions are skipped
+				break;
+		}
+		if (offset - released >= RELEASE_STEP) {
+			const size_t page = sysconf(_SC_PAGESIZE);
+			const size_t end = offset / page * page;
+			madvise((void *)(data + released), end - released, MADV_DONTNEED);
+			released = end;
+		}
+	}
+	const double wall = std::chrono::duration<double>(
+							std::chrono::steady_clock::now() - start)
+							.count();
+	printf("%zu records, %zu events in %.3f s\n", records, events, wall);
+	for (auto &[id, t] : times) {
+		printf("window \"%s\"\n", t.title.c_str());
+		report("recorded", t.recorded);
+		report("replayed", t.replayed);
+	}
+	for (auto &[id, win] : windows)
+		cel_destroy_window(win);
+	munmap((void *)data, size);
+	return 0;
+}